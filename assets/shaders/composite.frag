@@ -0,0 +1,13 @@
+#version 330 core
+
+in vec2 texCoords;
+
+out vec4 color;
+
+// Already premultiplied; see ui_layer.cpp.
+uniform sampler2D uiTexture;
+
+void main()
+{
+    color = texture(uiTexture, texCoords);
+}
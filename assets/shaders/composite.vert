@@ -0,0 +1,13 @@
+#version 330 core
+
+// Draws one triangle big enough to cover the whole screen, without needing any vertex data.
+
+out vec2 texCoords;
+
+void main()
+{
+    vec2 position = vec2((gl_VertexID == 1) ? 3.0 : -1.0, (gl_VertexID == 2) ? 3.0 : -1.0);
+    texCoords = position * 0.5 + 0.5;
+
+    gl_Position = vec4(position, 0.0, 1.0);
+}
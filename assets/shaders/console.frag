@@ -0,0 +1,24 @@
+#version 330 core
+
+in vec2 texCoords;
+flat in vec4 fg;
+flat in vec4 bg;
+
+out vec4 color;
+
+// White glyphs; only the alpha matters.
+uniform sampler2D atlas;
+
+void main()
+{
+    // The glyph goes over the background, and then the whole cell over whatever's underneath.
+    float coverage = texture(atlas, texCoords).a * fg.a;
+    float alpha = coverage + bg.a * (1.0 - coverage);
+
+    if (alpha <= 0.0)
+    {
+        discard;
+    }
+
+    color = vec4((fg.rgb * coverage + bg.rgb * bg.a * (1.0 - coverage)) / alpha, alpha);
+}
@@ -0,0 +1,34 @@
+#version 330 core
+
+// One instance per console cell. The corners come from gl_VertexID (it's drawn as a four-vertex strip)
+// and the cell's place in the grid from gl_InstanceID, so the only per-cell data is what's in the cell.
+
+layout (location = 0) in uint glyph;
+layout (location = 1) in vec4 fgColor;
+layout (location = 2) in vec4 bgColor;
+
+// All in pixels, with the origin measured from the top-left corner of the window.
+uniform vec2 origin;
+uniform vec2 cellSize;
+uniform vec2 screenSize;
+uniform int columns;
+
+out vec2 texCoords;
+flat out vec4 fg;
+flat out vec4 bg;
+
+void main()
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 cell = vec2(gl_InstanceID % columns, gl_InstanceID / columns);
+    vec2 pixel = origin + (cell + corner) * cellSize;
+
+    gl_Position = vec4(pixel.x / screenSize.x * 2.0 - 1.0, 1.0 - pixel.y / screenSize.y * 2.0, 0.0, 1.0);
+
+    // The atlas got flipped on its way in (like every texture), so its first row is at the top of the texture.
+    vec2 atlasCell = vec2(glyph % 16u, glyph / 16u);
+    texCoords = vec2((atlasCell.x + corner.x) / 16.0, 1.0 - (atlasCell.y + corner.y) / 16.0);
+
+    fg = fgColor;
+    bg = bgColor;
+}
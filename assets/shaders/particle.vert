@@ -0,0 +1,33 @@
+#version 330
+
+// One instance per particle (see particle_renderer.h); the four corners come from a little shared buffer.
+// Everything that comes out the other end is what quad.vert hands over, so quad.frag does the rest.
+
+layout (location = 0) in vec2 corner;
+layout (location = 1) in vec4 instanceRect;
+layout (location = 2) in vec4 instanceColor;
+layout (location = 3) in vec2 instanceSlots;
+layout (location = 4) in vec2 instanceMapMod;
+
+out vec4 rgbaColor;
+out vec2 texCoords;
+out float texIndex;
+out float mapIndex;
+out vec2 mapMod;
+
+layout (std140) uniform FrameData
+{
+    mat4 MVP;
+};
+
+void main()
+{
+    rgbaColor = instanceColor;
+    texCoords = corner;
+    texIndex = instanceSlots.x;
+    mapIndex = instanceSlots.y;
+    mapMod = instanceMapMod;
+
+    vec2 position = instanceRect.xy + (corner - 0.5) * instanceRect.zw;
+    gl_Position = MVP * vec4(position, 0.0, 1.0);
+}
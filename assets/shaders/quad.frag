@@ -14,16 +14,34 @@ out vec4 color;
 
 uniform sampler2D batchQuadTextures[32];
 
+// Anything less opaque than this gets thrown away. The opaque pass (see renderer.cpp) writes depth,
+// so it can't have half-transparent pixels, and our sprites' edges are hard anyway; the translucent pass sets it to 0.
+uniform float alphaCutoff;
+
 void main()
 {
     int tIndex = int(texIndex);
     int mIndex = int(mapIndex);
-    
-    // ivec2 mapSize = textureSize(batchQuadTextures[mIndex], lod);
 
-    vec4 sourceColor = texture(batchQuadTextures[tIndex], texCoords);
-    vec2 mapCoord = vec2(sourceColor.r * mapMod.x,  sourceColor.g * mapMod.y);
+    // A negative map index means the sprite's already been looked up in its map ahead of time
+    // (see palette_cache.h), so its texture already has the final colors in it.
+    if (mIndex < 0)
+    {
+        color = rgbaColor * texture(batchQuadTextures[tIndex], texCoords);
+    }
+    else
+    {
+        vec4 sourceColor = texture(batchQuadTextures[tIndex], texCoords);
+        vec2 mapCoord = vec2(sourceColor.r * mapMod.x,  sourceColor.g * mapMod.y);
+
+        color = rgbaColor * texture(batchQuadTextures[mIndex], mapCoord);
+    }
 
-    color = rgbaColor * texture(batchQuadTextures[mIndex], mapCoord);
+    if (color.a < alphaCutoff)
+    {
+        discard;
+    }
+
+    // ivec2 mapSize = textureSize(batchQuadTextures[mIndex], lod);
     // color = vec4(sourceColor.r * mapSize.x, sourceColor.g * mapSize.y, 0.0, 1.0);
 }
@@ -1,6 +1,6 @@
 #version 330
 
-layout (location = 0) in vec2 posCoords;
+layout (location = 0) in vec3 posCoords;
 layout (location = 1) in vec4 vertRgbaColor;
 layout (location = 2) in vec2 vertTexCoords;
 layout (location = 3) in float vertTexIndex;
@@ -13,7 +13,10 @@ out float texIndex;
 out float mapIndex;
 out vec2 mapMod;
 
-uniform mat4 MVP;
+layout (std140) uniform FrameData
+{
+    mat4 MVP;
+};
 
 void main()
 {
@@ -24,5 +27,5 @@ void main()
     mapMod = vertMapMod;
     // mLod = vertLod;
     
-    gl_Position = MVP * vec4(posCoords, 0.0, 1.0);
+    gl_Position = MVP * vec4(posCoords, 1.0);
 }
@@ -0,0 +1,255 @@
+#include "bench.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "component.h"
+#include "particle_kernels.h"
+#include "particleengine.h"
+#include "quad_kernels.h"
+#include "rng.h"
+
+int Bench::Run(const std::string& name)
+{
+    if (name == "corners")
+    {
+        return Corners();
+    }
+
+    if (name == "particles")
+    {
+        return Particles();
+    }
+
+    std::cout << "Unknown benchmark \"" << name << "\". Try one of: corners, particles\n";
+    return 1;
+}
+
+// How many milliseconds it takes to call work() once, averaged over a few runs (after one to warm up).
+template <typename F>
+static double Time(int runs, F work)
+{
+    work();
+
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    for (int r = 0; r < runs; r++)
+    {
+        work();
+    }
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / runs;
+}
+
+static float MaxDifference(const std::vector<glm::vec2>& a, const std::vector<glm::vec2>& b)
+{
+    float worst = 0.0f;
+
+    for (int i = 0; i < a.size(); i++)
+    {
+        worst = std::max(worst, std::max(std::fabs(a[i].x - b[i].x), std::fabs(a[i].y - b[i].y)));
+    }
+
+    return worst;
+}
+
+int Bench::Corners()
+{
+    // Roughly what a busy scene looks like: most things sit still, but a good chunk
+    // (debris, projectiles and the like) are spinning.
+    const int count = 100000;
+    const int runs = 50;
+
+    std::vector<float> centerX(count), centerY(count), halfWidth(count), halfHeight(count), rotation(count);
+    RandomStream random(12345);
+
+    for (int i = 0; i < count; i++)
+    {
+        centerX[i] = random.Range(0, 19999) / 10.0f - 1000.0f;
+        centerY[i] = random.Range(0, 19999) / 10.0f - 1000.0f;
+        halfWidth[i] = 1.0f + random.Range(0, 63);
+        halfHeight[i] = 1.0f + random.Range(0, 63);
+        rotation[i] = (random.Range(0, 2) == 0) ? random.Range(0, 3599) / 10.0f : 0.0f;
+    }
+
+    std::vector<glm::vec2> old(count * 4), scalar(count * 4), sse(count * 4);
+
+    const double oldTime = Time(runs, [&]()
+        {
+            // This is what prepareQuad() used to do: four separate rotations per sprite.
+            for (int i = 0; i < count; i++)
+            {
+                const glm::vec2 center = glm::vec2(centerX[i], centerY[i]);
+                old[4 * i + 0] = center + GlobalPositionComponent::RotateBy(glm::vec2(halfWidth[i], halfHeight[i]), rotation[i]);
+                old[4 * i + 1] = center + GlobalPositionComponent::RotateBy(glm::vec2(halfWidth[i], -halfHeight[i]), rotation[i]);
+                old[4 * i + 2] = center + GlobalPositionComponent::RotateBy(glm::vec2(-halfWidth[i], -halfHeight[i]), rotation[i]);
+                old[4 * i + 3] = center + GlobalPositionComponent::RotateBy(glm::vec2(-halfWidth[i], halfHeight[i]), rotation[i]);
+            }
+        });
+
+    const double scalarTime = Time(runs, [&]()
+        {
+            QuadKernels::CornersScalar(count, centerX.data(), centerY.data(), halfWidth.data(), halfHeight.data(), rotation.data(), scalar.data());
+        });
+
+    const double sseTime = Time(runs, [&]()
+        {
+            QuadKernels::CornersSSE(count, centerX.data(), centerY.data(), halfWidth.data(), halfHeight.data(), rotation.data(), sse.data());
+        });
+
+    std::cout << "Corners for " << count << " quads (a third of them rotated), " << runs << " runs each:\n";
+    std::cout << "  RotateBy x4: " << oldTime << " ms\n";
+    std::cout << "  Scalar:      " << scalarTime << " ms (" << oldTime / scalarTime << "x), max difference " << MaxDifference(old, scalar) << "\n";
+    std::cout << "  SSE:         " << sseTime << " ms (" << oldTime / sseTime << "x), max difference " << MaxDifference(old, sse) << (QuadKernels::sse ? "" : " (not available here, so this is the scalar one again)") << "\n";
+
+    return 0;
+}
+
+int Bench::Particles()
+{
+    // A million particles of every element, at every age, spread over a big room.
+    const int count = 1000000;
+    const int runs = 20;
+
+    std::vector<float> startX(count), startY(count);
+    std::vector<int32_t> element(count), startTicks(count);
+    RandomStream random(12345);
+
+    for (int i = 0; i < count; i++)
+    {
+        startX[i] = random.Range(0, 19999) / 10.0f - 1000.0f;
+        startY[i] = random.Range(0, 19999) / 10.0f - 1000.0f;
+        element[i] = random.Range(0, 3);  // The old loop only knows the first four.
+        startTicks[i] = random.Range(0, 99);
+    }
+
+    // The same table the engine uses.
+    ParticleEngine engine;
+    engine.Init(0.05f, 1);
+
+    if (!engine.LoadElements("assets/particles/elements.txt"))
+    {
+        return 1;
+    }
+
+    const ElementTable& table = engine.elements;
+
+    struct Run
+    {
+        std::vector<float> x, y, shade;
+        std::vector<int32_t> ticks;
+        ParticleKernels::Rng rng;
+    };
+
+    // Each version starts from the same particles and the same seed, and does runs + 1 ticks (see Time()),
+    // so they should all end up in exactly the same place.
+    auto fresh = [&]()
+    {
+        Run run{ startX, startY, std::vector<float>(count), startTicks, {} };
+        RandomStream seeds(777);
+        run.rng.Seed(seeds);
+        return run;
+    };
+
+    Run old = fresh(), scalar = fresh(), sse2 = fresh(), avx2 = fresh();
+
+    const double oldTime = Time(runs, [&]()
+        {
+            // Roughly what ParticleEngine::Update() used to do: two rand()s and a chain of ifs per particle.
+            for (int i = 0; i < count; i++)
+            {
+                const int r = rand() % 100 + 1;
+                const float cr = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+                const int e = element[i];
+
+                if (e == 1 || e == 2)
+                {
+                    old.y[i] += 2.0f;
+
+                    if (r > 75) old.x[i] += 2.0f;
+                    else if (r > 50) old.x[i] -= 2.0f;
+                    else if (r < 10) old.y[i] -= 2.0f;
+                }
+                else if (e == 0)
+                {
+                    if (r > 70) old.x[i] += 2.0f;
+                    else if (r > 40) old.x[i] -= 2.0f;
+                    else if (r < 20) old.y[i] += 2.0f;
+                }
+                else
+                {
+                    if (r > 95) old.x[i] += 2.0f;
+                    else if (r > 90) old.x[i] -= 2.0f;
+                    else if (r < 70) old.y[i] += 2.0f;
+                }
+
+                old.ticks[i] += 1;
+                old.shade[i] = cr;
+            }
+        });
+
+    const double scalarTime = Time(runs, [&]()
+        {
+            ParticleKernels::StepScalar(count, scalar.x.data(), scalar.y.data(), element.data(), scalar.ticks.data(), scalar.shade.data(), table, scalar.rng);
+        });
+
+    const double sse2Time = Time(runs, [&]()
+        {
+            ParticleKernels::StepSSE2(count, sse2.x.data(), sse2.y.data(), element.data(), sse2.ticks.data(), sse2.shade.data(), table, sse2.rng);
+        });
+
+    const double avx2Time = Time(runs, [&]()
+        {
+            ParticleKernels::StepAVX2(count, avx2.x.data(), avx2.y.data(), element.data(), avx2.ticks.data(), avx2.shade.data(), table, avx2.rng);
+        });
+
+    auto matches = [&](const Run& run)
+    {
+        return run.x == scalar.x && run.y == scalar.y && run.ticks == scalar.ticks && run.shade == scalar.shade ? "same as scalar" : "DIFFERENT from scalar";
+    };
+
+    std::cout << "One tick for " << count << " particles, " << runs << " runs each:\n";
+    std::cout << "  rand() + ifs: " << oldTime << " ms\n";
+    std::cout << "  Scalar:       " << scalarTime << " ms (" << oldTime / scalarTime << "x)\n";
+    std::cout << "  SSE2:         " << sse2Time << " ms (" << oldTime / sse2Time << "x), " << matches(sse2) << (PARTICLE_KERNELS_SSE ? "" : " (not available here, so this is the scalar one again)") << "\n";
+    std::cout << "  AVX2:         " << avx2Time << " ms (" << oldTime / avx2Time << "x), " << matches(avx2) << (ParticleKernels::HasAVX2() ? "" : " (not available here, so this is SSE2 again)") << "\n";
+
+    // Then the same particles against a room with a third of its cells walled off, going from where they started
+    // to where the scalar run left them. Collide() moves them, so every run starts from a copy (in both versions).
+    OccupancyGrid grid;
+    grid.Resize(400, 400, 5.0f, -1000.0f, -1000.0f);
+
+    for (int cy = 0; cy < grid.height; cy++)
+    {
+        for (int cx = 0; cx < grid.width; cx++)
+        {
+            grid.Set(cx, cy, random.Range(0, 2) == 0);
+        }
+    }
+
+    std::vector<int32_t> lifetime(count, 100);
+    Run collideScalar = scalar, collideAVX2 = scalar;
+
+    const double collideScalarTime = Time(runs, [&]()
+        {
+            collideScalar = scalar;
+            ParticleKernels::CollideScalar(count, startX.data(), startY.data(), collideScalar.x.data(), collideScalar.y.data(), element.data(), collideScalar.ticks.data(), lifetime.data(), table, grid);
+        });
+
+    const double collideAVX2Time = Time(runs, [&]()
+        {
+            collideAVX2 = scalar;
+            ParticleKernels::CollideAVX2(count, startX.data(), startY.data(), collideAVX2.x.data(), collideAVX2.y.data(), element.data(), collideAVX2.ticks.data(), lifetime.data(), table, grid);
+        });
+
+    const bool collideSame = collideAVX2.x == collideScalar.x && collideAVX2.y == collideScalar.y && collideAVX2.ticks == collideScalar.ticks;
+
+    std::cout << "Collisions for the same particles, " << runs << " runs each (copy included):\n";
+    std::cout << "  Scalar:       " << collideScalarTime << " ms\n";
+    std::cout << "  AVX2:         " << collideAVX2Time << " ms (" << collideScalarTime / collideAVX2Time << "x), " << (collideSame ? "same as scalar" : "DIFFERENT from scalar") << (ParticleKernels::HasAVX2() ? "" : " (not available here, so this is scalar again)") << "\n";
+
+    return 0;
+}
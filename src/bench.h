@@ -0,0 +1,21 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Microbenchmarks for the hot loops, run with "asciismos --bench <name>" (no window, no GL).
+// Each one races the old way of doing something against the new one(s) on made-up data,
+// checks they agree, and prints how long they took.
+
+#include <string>
+
+class Bench
+{
+public:
+    // Returns what main() should return; unknown names list the ones we have.
+    static int Run(const std::string& name);
+
+private:
+    static int Corners();
+    static int Particles();
+};
+
+#endif
@@ -9,10 +9,12 @@
 #include "renderer.h"
 #include "particleengine.h"
 #include <math.h>
+#include <cstdint>
 #include <map>
 #include <vector>
 
 class Entity;
+class RetainedMesh;
 
 // There is surely a more elegant way to handle IDs; we could dynamically assign them at runtime,
 // but honestly, this works so I'm not particularly compelled to change it.
@@ -27,6 +29,7 @@ static int aiComponentID = 8;
 static int imageComponentID = 9;
 static int buttonComponentID = 10;
 static int worldComponentID = 11;
+static int tilemapComponentID = 12;
 
 static int exampleAnimControllerSubID = 1;
 
@@ -69,7 +72,8 @@ public:
 	// I'm making an exception here for simplicity's sake.
 	// These just help calculate rotation for rendering.
 	glm::vec2 Rotate(glm::vec2 point);
-	glm::vec2 RelativeLocation(glm::vec2 p, glm::vec2 up, glm::vec2 right);
+	static glm::vec2 RotateBy(glm::vec2 point, float rotation);
+	static glm::vec2 RelativeLocation(glm::vec2 p, glm::vec2 up, glm::vec2 right);
 
 	// And the constructor.
 	GlobalPositionComponent(Entity* entity, bool active, bool stat, float x, float y, float z, float rotation);
@@ -139,7 +143,15 @@ public:
 	// Again, a quick and dirty reference to the position component allows us to reference it directly instead of going through the entity's component map.
 	GlobalPositionComponent* pos;
 
-	StaticSpriteComponent(Entity* entity, bool active, GlobalPositionComponent* pos, float width, float height, float scaleX, float scaleY, Texture2D* sprite, Texture2D* mapTex, bool flippedX, bool flippedY, bool tiled);
+	// Set for sprites that belong to an ImageComponent; those are drawn by the UI layer, not with the rest of the world.
+	bool screenSpace = false;
+
+	// For sprites with soft (half-transparent) edges. Everything else in the world is drawn hard-edged, front to back
+	// with the depth test, so anything that's neither fully there nor fully not gets drawn over whatever's behind it.
+	// Translucent sprites are sorted back to front instead, and never baked into the static layer (see render_queue.h).
+	bool translucent;
+
+	StaticSpriteComponent(Entity* entity, bool active, GlobalPositionComponent* pos, float width, float height, float scaleX, float scaleY, Texture2D* sprite, Texture2D* mapTex, bool flippedX, bool flippedY, bool tiled, bool translucent = false);
 };
 
 class InputComponent : public Component
@@ -178,11 +190,14 @@ public:
 	bool flippedX;
 	bool flippedY;
 
+	// The same as StaticSpriteComponent::translucent.
+	bool translucent;
+
 	void SetAnimation(std::string s);
 
 	void AddAnimation(std::string s, Animation2D* anim);
 
-	AnimationComponent(Entity* entity, bool active, GlobalPositionComponent* pos, Animation2D* idleAnimation, std::string animationName, Texture2D* mapTex, float scaleX, float scaleY, bool flippedX, bool flippedY);
+	AnimationComponent(Entity* entity, bool active, GlobalPositionComponent* pos, Animation2D* idleAnimation, std::string animationName, Texture2D* mapTex, float scaleX, float scaleY, bool flippedX, bool flippedY, bool translucent = false);
 };
 
 class AnimationControllerComponent : public Component
@@ -211,7 +226,65 @@ public:
 	float minLifetime;
 	float maxLifetime;
 
-	ParticleComponent(Entity* entity, bool active, float tickRate, float xOffset, float yOffset, int number, Element element, float minLifetime, float maxLifetime);
+	// How much it matters when there are too many particles about (0 to ParticleEngine::PRIORITIES - 1, higher
+	// keeps spawning for longer), and the most it can have alive at once (0 for as many as the budget allows).
+	int priority;
+	int maxAlive;
+
+	// Set by the particle system; see ParticleEngine::RegisterEmitter().
+	int budgetSlot;
+
+	// The entity's position, looked up by the particle system when it gets the component (or every frame after
+	// that until the entity has one; the emitter doesn't do anything until then).
+	GlobalPositionComponent* pos;
+
+	ParticleComponent(Entity* entity, bool active, float tickRate, float xOffset, float yOffset, int number, Element element, float minLifetime, float maxLifetime, int priority = 1, int maxAlive = 0);
+};
+
+// A whole floor's worth of tiles in one component, rather than an entity (and a sprite) for every tile.
+// Each tile is just an index into the tileset, a texture cut up into cols x rows cells and numbered along the rows
+// (the same way animation frames are laid out), starting from 1; 0 means there's nothing there. The tiles are kept in CHUNK_TILES-square chunks,
+// which the tilemap system bakes into their own meshes and only rebuilds when one of their tiles changes.
+// Chunks nobody has put anything in don't take up any room at all.
+class TilemapComponent : public Component
+{
+public:
+	static constexpr int CHUNK_TILES = 32;
+
+	struct Chunk
+	{
+		vector<uint16_t> tiles;
+		RetainedMesh* mesh = nullptr;
+		bool dirty = true;
+
+		// The last frame the camera could see it, so we know when to let go of the mesh.
+		int lastSeen = 0;
+	};
+
+	// The position is the bottom-left corner of tile (0, 0); tilemaps don't rotate.
+	GlobalPositionComponent* pos;
+
+	int width;
+	int height;
+	float tileSize;
+
+	Texture2D* tileset;
+	Texture2D* mapTex;
+	int cols;
+	int rows;
+
+	int chunksX;
+	int chunksY;
+	vector<Chunk> chunks;
+
+	uint16_t GetTile(int x, int y);
+	void SetTile(int x, int y, uint16_t tile);
+
+	// Fills in every tile from (x0, y0) to (x1, y1), inclusive.
+	void Fill(int x0, int y0, int x1, int y1, uint16_t tile);
+
+	TilemapComponent(Entity* entity, bool active, GlobalPositionComponent* pos, int width, int height, float tileSize, Texture2D* tileset, Texture2D* mapTex, int cols, int rows);
+	~TilemapComponent();
 };
 
 enum class Anchor { topLeft, bottomLeft, topRight, bottomRight };
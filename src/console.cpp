@@ -0,0 +1,174 @@
+#include "console.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <GLFW/glfw3.h>
+#include "check_error.h"
+#include "game.h"
+#include "shader.h"
+#include "texture_2D.h"
+
+// See console.h. The cells live in one instanced vertex buffer, in the same order as the cells vector,
+// so uploading a change is just a glBufferSubData() over the range of cells that were touched.
+
+Console::Console(int cols, int rows, const char* atlasPath) : cols(cols), rows(rows)
+{
+    cells.assign(cols * rows, Cell{ ' ', Color(1.0f, 1.0f, 1.0f), 0 });
+
+    atlas = new Texture2D(atlasPath, true, GL_NEAREST);
+
+    shader = new Shader("assets/shaders/console.vert", "assets/shaders/console.frag");
+    originLocation = shader->Uniform("origin");
+    cellSizeLocation = shader->Uniform("cellSize");
+    screenSizeLocation = shader->Uniform("screenSize");
+    columnsLocation = shader->Uniform("columns");
+    atlasLocation = shader->Uniform("atlas");
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, cells.size() * sizeof(Cell), cells.data(), GL_DYNAMIC_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(Cell), (void*)offsetof(Cell, glyph));
+    glVertexAttribDivisor(0, 1);
+
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Cell), (void*)offsetof(Cell, fg));
+    glVertexAttribDivisor(1, 1);
+
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Cell), (void*)offsetof(Cell, bg));
+    glVertexAttribDivisor(2, 1);
+
+    glBindVertexArray(0);
+    glCheckError();
+}
+
+Console::~Console()
+{
+    glDeleteBuffers(1, &VBO);
+    glDeleteVertexArrays(1, &VAO);
+
+    delete shader;
+
+    glDeleteTextures(1, &atlas->ID);
+    delete atlas;
+}
+
+uint32_t Console::Color(float r, float g, float b, float a)
+{
+    auto channel = [](float v)
+    {
+        return (uint32_t)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+    };
+
+    return channel(r) | (channel(g) << 8) | (channel(b) << 16) | (channel(a) << 24);
+}
+
+void Console::MarkDirty(int index)
+{
+    if (dirtyBegin >= dirtyEnd)
+    {
+        dirtyBegin = index;
+        dirtyEnd = index + 1;
+    }
+    else
+    {
+        dirtyBegin = std::min(dirtyBegin, index);
+        dirtyEnd = std::max(dirtyEnd, index + 1);
+    }
+}
+
+void Console::Put(int x, int y, uint32_t glyph, uint32_t fg, uint32_t bg)
+{
+    if (x < 0 || y < 0 || x >= cols || y >= rows)
+    {
+        return;
+    }
+
+    const int index = y * cols + x;
+    Cell& cell = cells[index];
+
+    // Writing the same thing again (which is most of what a redrawn panel does) doesn't cost an upload.
+    if (cell.glyph == glyph && cell.fg == fg && cell.bg == bg)
+    {
+        return;
+    }
+
+    cell.glyph = glyph;
+    cell.fg = fg;
+    cell.bg = bg;
+    MarkDirty(index);
+}
+
+void Console::Print(int x, int y, const std::string& text, uint32_t fg, uint32_t bg)
+{
+    for (size_t i = 0; i < text.size() && x + (int)i < cols; i++)
+    {
+        Put(x + (int)i, y, (unsigned char)text[i], fg, bg);
+    }
+}
+
+void Console::Fill(int x, int y, int width, int height, uint32_t glyph, uint32_t fg, uint32_t bg)
+{
+    for (int cy = std::max(y, 0); cy < std::min(y + height, rows); cy++)
+    {
+        for (int cx = std::max(x, 0); cx < std::min(x + width, cols); cx++)
+        {
+            Put(cx, cy, glyph, fg, bg);
+        }
+    }
+}
+
+void Console::Clear(uint32_t bg)
+{
+    Fill(0, 0, cols, rows, ' ', Color(1.0f, 1.0f, 1.0f), bg);
+}
+
+const Console::Cell& Console::Get(int x, int y) const
+{
+    return cells[y * cols + x];
+}
+
+void Console::Draw()
+{
+    if (!visible)
+    {
+        return;
+    }
+
+    int pixelWidth, pixelHeight;
+    glfwGetFramebufferSize(Game::main.window, &pixelWidth, &pixelHeight);
+
+    if (pixelWidth <= 0 || pixelHeight <= 0)
+    {
+        return;
+    }
+
+    if (dirtyBegin < dirtyEnd)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, dirtyBegin * sizeof(Cell), (dirtyEnd - dirtyBegin) * sizeof(Cell), cells.data() + dirtyBegin);
+        cellsUploaded += dirtyEnd - dirtyBegin;
+        dirtyBegin = dirtyEnd = 0;
+    }
+
+    shader->use();
+    glUniform2f(originLocation, x, y);
+    glUniform2f(cellSizeLocation, scale * atlas->width / ATLAS_COLS, scale * atlas->height / ATLAS_ROWS);
+    glUniform2f(screenSizeLocation, (float)pixelWidth, (float)pixelHeight);
+    shader->setInt(columnsLocation, cols);
+    shader->setInt(atlasLocation, 0);
+
+    glActiveTexture(GL_TEXTURE0);
+    atlas->bind();
+
+    glBindVertexArray(VAO);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, cols * rows);
+    glBindVertexArray(0);
+
+    glCheckError();
+}
@@ -0,0 +1,90 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+// A console is a grid of character cells, each with a glyph, a foreground and a background color,
+// for the places where we want text rather than sprites: logs, inventories, map overlays, the stats overlay.
+// The glyphs come out of an atlas laid out like code page 437 (16 by 16 cells, so plain ASCII is just
+// the character itself), and the whole grid goes out in one instanced draw, one instance per cell.
+// Only the cells that changed since the last draw get uploaded.
+//
+// Consoles sit in screen space, measured in pixels from the top-left corner of the window.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+class Shader;
+class Texture2D;
+
+class Console
+{
+public:
+    static constexpr int ATLAS_COLS = 16;
+    static constexpr int ATLAS_ROWS = 16;
+
+    struct Cell
+    {
+        uint32_t glyph;
+        uint32_t fg;
+        uint32_t bg;
+    };
+
+    const int cols;
+    const int rows;
+
+    // Where the top-left corner goes, and how many screen pixels each atlas pixel takes up.
+    float x = 0.0f;
+    float y = 0.0f;
+    float scale = 1.0f;
+
+    bool visible = true;
+
+    // Just so we can see what it's doing.
+    unsigned long long cellsUploaded = 0;
+
+    // Needs a GL context, like everything else that owns GL objects.
+    Console(int cols, int rows, const char* atlasPath);
+    ~Console();
+
+    Console(const Console&) = delete;
+    Console& operator=(const Console&) = delete;
+
+    // Colors are packed as 0xAABBGGRR, which is just r, g, b, a in memory; Color() does the packing.
+    static uint32_t Color(float r, float g, float b, float a = 1.0f);
+
+    void Put(int x, int y, uint32_t glyph, uint32_t fg, uint32_t bg);
+
+    // Writes a string along a row, cutting it off at the edge. Bytes are glyph indices, so ASCII just works.
+    void Print(int x, int y, const std::string& text, uint32_t fg, uint32_t bg);
+
+    void Fill(int x, int y, int width, int height, uint32_t glyph, uint32_t fg, uint32_t bg);
+    void Clear(uint32_t bg);
+
+    const Cell& Get(int x, int y) const;
+
+    // Uploads whatever changed and draws the grid. Call it after the world (and UI) have been drawn.
+    void Draw();
+
+private:
+    std::vector<Cell> cells;
+
+    // The range of cells changed since the last upload; empty when dirtyBegin >= dirtyEnd.
+    int dirtyBegin = 0;
+    int dirtyEnd = 0;
+
+    Texture2D* atlas = nullptr;
+    Shader* shader = nullptr;
+    GLuint VAO = 0;
+    GLuint VBO = 0;
+
+    GLint originLocation = -1;
+    GLint cellSizeLocation = -1;
+    GLint screenSizeLocation = -1;
+    GLint columnsLocation = -1;
+    GLint atlasLocation = -1;
+
+    void MarkDirty(int index);
+};
+
+#endif
@@ -14,6 +14,10 @@
 #include "system.h"
 #include "component.h"
 #include "entity.h"
+#include "static_layer.h"
+#include "thread_pool.h"
+#include "ui_layer.h"
+#include "visibility.h"
 #include <algorithm>
 
 #pragma region Utility
@@ -97,6 +101,11 @@ void ECS::Init()
 	ComponentBlock* particleBlock = new ComponentBlock(particleSystem, particleComponentID);
 	componentBlocks.push_back(particleBlock);
 
+	// Floors go in before the sprites so they end up underneath them.
+	TilemapSystem* tilemapSystem = new TilemapSystem();
+	ComponentBlock* tilemapBlock = new ComponentBlock(tilemapSystem, tilemapComponentID);
+	componentBlocks.push_back(tilemapBlock);
+
 	ImageSystem* imageSystem = new ImageSystem();
 	ComponentBlock* imageBlock = new ComponentBlock(imageSystem, imageComponentID);
 	componentBlocks.push_back(imageBlock);
@@ -116,6 +125,30 @@ void ECS::Init()
 	AnimationSystem* animationSystem = new AnimationSystem();
 	ComponentBlock* animationBlock = new ComponentBlock(animationSystem, animationComponentID);
 	componentBlocks.push_back(animationBlock);
+
+	// Every node starts out open; levels block off their walls with SetBlocked().
+	for (int x = 0; x < mWidth; x++)
+	{
+		for (int y = 0; y < mHeight; y++)
+		{
+			nodeMap[x][y] = new Node(x, y);
+		}
+	}
+
+	nodeVersion++;
+}
+
+void ECS::SetBlocked(int x0, int y0, int x1, int y1, bool blocked)
+{
+	for (int x = std::max(x0, 0); x <= std::min(x1, mWidth - 1); x++)
+	{
+		for (int y = std::max(y0, 0); y <= std::min(y1, mHeight - 1); y++)
+		{
+			nodeMap[x][y]->blocked = blocked;
+		}
+	}
+
+	nodeVersion++;
 }
 
 void ECS::Update(float deltaTime)
@@ -130,13 +163,17 @@ void ECS::Update(float deltaTime)
 		Texture2D* watermark = Game::main.textureMap["watermark"];
 		Texture2D* watermarkMap = Game::main.textureMap["watermarkMap"];
 
-		ECS::main.RegisterComponent(new GlobalPositionComponent(alphaWatermark, true, true, 0, 0, 100, 0), alphaWatermark);
+		// The watermark's drawn by the UI layer, so it mustn't be static (or it'd get baked into the static layer as well).
+		ECS::main.RegisterComponent(new GlobalPositionComponent(alphaWatermark, true, false, 0, 0, 100, 0), alphaWatermark);
 		ECS::main.RegisterComponent(new StaticSpriteComponent(alphaWatermark, true, (GlobalPositionComponent*)alphaWatermark->componentIDMap[globalPositionComponentID], watermark->width, watermark->height, 1.0f, 1.0f, watermark, watermarkMap, false, false, false), alphaWatermark);
 		ECS::main.RegisterComponent(new ImageComponent(alphaWatermark, true, Anchor::topRight, 0, 0), alphaWatermark);
 
 		#pragma endregion
 	}
 
+	// Work out what the camera can see once, up front, for every system that draws something.
+	Visibility::main.Update();
+
 	for (int i = 0; i < componentBlocks.size(); i++)
 	{
 		componentBlocks[i]->Update(activeScene, deltaTime);
@@ -232,6 +269,11 @@ void ECS::RegisterComponent(Component* component, Entity* entity)
 
 #pragma region Position Component
 glm::vec2 GlobalPositionComponent::Rotate(glm::vec2 point)
+{
+	return RotateBy(point, rotation);
+}
+
+glm::vec2 GlobalPositionComponent::RotateBy(glm::vec2 point, float rotation)
 {
 	glm::vec3 forward = glm::vec3();
 	glm::vec3 up = glm::vec3();
@@ -274,7 +316,7 @@ GlobalPositionComponent::GlobalPositionComponent(Entity* entity, bool active, bo
 
 #pragma region Static Sprite Component
 
-StaticSpriteComponent::StaticSpriteComponent(Entity* entity, bool active, GlobalPositionComponent* pos, float width, float height, float scaleX, float scaleY, Texture2D* sprite, Texture2D* mapTex, bool flippedX, bool flippedY, bool tiled)
+StaticSpriteComponent::StaticSpriteComponent(Entity* entity, bool active, GlobalPositionComponent* pos, float width, float height, float scaleX, float scaleY, Texture2D* sprite, Texture2D* mapTex, bool flippedX, bool flippedY, bool tiled, bool translucent)
 {
 	ID = spriteComponentID;
 	this->active = active;
@@ -294,6 +336,7 @@ StaticSpriteComponent::StaticSpriteComponent(Entity* entity, bool active, Global
 	this->flippedY = flippedY;
 
 	this->tiled = tiled;
+	this->translucent = translucent;
 }
 
 #pragma endregion
@@ -342,7 +385,7 @@ void AnimationComponent::AddAnimation(std::string s, Animation2D* anim)
 	animations.emplace(s, anim);
 }
 
-AnimationComponent::AnimationComponent(Entity* entity, bool active, GlobalPositionComponent* pos, Animation2D* idleAnimation, std::string animationName, Texture2D* mapTex, float scaleX, float scaleY, bool flippedX, bool flippedY)
+AnimationComponent::AnimationComponent(Entity* entity, bool active, GlobalPositionComponent* pos, Animation2D* idleAnimation, std::string animationName, Texture2D* mapTex, float scaleX, float scaleY, bool flippedX, bool flippedY, bool translucent)
 {
 	this->ID = animationComponentID;
 	this->entity = entity;
@@ -359,6 +402,7 @@ AnimationComponent::AnimationComponent(Entity* entity, bool active, GlobalPositi
 
 	this->flippedX = flippedX;
 	this->flippedY = flippedY;
+	this->translucent = translucent;
 
 	this->activeAnimation = animationName;
 	this->animations.emplace(animationName, idleAnimation);
@@ -385,7 +429,7 @@ PlayerAnimationControllerComponent::PlayerAnimationControllerComponent(Entity* e
 
 #pragma region Particle Component
 
-ParticleComponent::ParticleComponent(Entity* entity, bool active, float tickRate, float xOffset, float yOffset, int number, Element element, float minLifetime, float maxLifetime)
+ParticleComponent::ParticleComponent(Entity* entity, bool active, float tickRate, float xOffset, float yOffset, int number, Element element, float minLifetime, float maxLifetime, int priority, int maxAlive)
 {
 	this->ID = particleComponentID;
 	this->entity = entity;
@@ -403,6 +447,11 @@ ParticleComponent::ParticleComponent(Entity* entity, bool active, float tickRate
 	
 	this->minLifetime = minLifetime;
 	this->maxLifetime = maxLifetime;
+
+	this->priority = priority;
+	this->maxAlive = maxAlive;
+	this->budgetSlot = -1;
+	this->pos = nullptr;
 }
 
 #pragma endregion
@@ -422,6 +471,95 @@ ImageComponent::ImageComponent(Entity* entity, bool active, Anchor anchor, float
 
 #pragma endregion
 
+#pragma region Tilemap Component
+
+TilemapComponent::TilemapComponent(Entity* entity, bool active, GlobalPositionComponent* pos, int width, int height, float tileSize, Texture2D* tileset, Texture2D* mapTex, int cols, int rows)
+{
+	this->ID = tilemapComponentID;
+	this->entity = entity;
+	this->active = active;
+	this->pos = pos;
+
+	this->width = width;
+	this->height = height;
+	this->tileSize = tileSize;
+
+	this->tileset = tileset;
+	this->mapTex = mapTex;
+	this->cols = cols;
+	this->rows = rows;
+
+	chunksX = (width + CHUNK_TILES - 1) / CHUNK_TILES;
+	chunksY = (height + CHUNK_TILES - 1) / CHUNK_TILES;
+	chunks.resize(chunksX * chunksY);
+}
+
+TilemapComponent::~TilemapComponent()
+{
+	for (Chunk& c : chunks)
+	{
+		delete c.mesh;
+	}
+}
+
+uint16_t TilemapComponent::GetTile(int x, int y)
+{
+	if (x < 0 || y < 0 || x >= width || y >= height)
+	{
+		return 0;
+	}
+
+	Chunk& c = chunks[(y / CHUNK_TILES) * chunksX + (x / CHUNK_TILES)];
+
+	if (c.tiles.empty())
+	{
+		return 0;
+	}
+
+	return c.tiles[(y % CHUNK_TILES) * CHUNK_TILES + (x % CHUNK_TILES)];
+}
+
+void TilemapComponent::SetTile(int x, int y, uint16_t tile)
+{
+	if (x < 0 || y < 0 || x >= width || y >= height)
+	{
+		return;
+	}
+
+	Chunk& c = chunks[(y / CHUNK_TILES) * chunksX + (x / CHUNK_TILES)];
+
+	if (c.tiles.empty())
+	{
+		if (tile == 0)
+		{
+			return;
+		}
+
+		c.tiles.assign(CHUNK_TILES * CHUNK_TILES, 0);
+	}
+
+	uint16_t& t = c.tiles[(y % CHUNK_TILES) * CHUNK_TILES + (x % CHUNK_TILES)];
+
+	if (t != tile)
+	{
+		t = tile;
+		c.dirty = true;
+	}
+}
+
+void TilemapComponent::Fill(int x0, int y0, int x1, int y1, uint16_t tile)
+{
+	for (int y = std::max(y0, 0); y <= std::min(y1, height - 1); y++)
+	{
+		for (int x = std::max(x0, 0); x <= std::min(x1, width - 1); x++)
+		{
+			SetTile(x, y, tile);
+		}
+	}
+}
+
+#pragma endregion
+
 #pragma endregion
 
 #pragma region Systems
@@ -430,33 +568,58 @@ ImageComponent::ImageComponent(Entity* entity, bool active, Anchor anchor, float
 
 void StaticRenderingSystem::Update(int activeScene, float deltaTime)
 {
-	std::sort(sprites.begin(), sprites.end(), [](StaticSpriteComponent* a, StaticSpriteComponent* b)
-		{
-			return a->pos->z < b->pos->z;
-		});
+	// Static sprites are baked into the static layer, which only has to redo the chunks that changed.
+	StaticLayer::main.Update(activeScene);
 
-	for (int i = 0; i < sprites.size(); i++)
-	{
-		StaticSpriteComponent* s = sprites[i];
+	// The rest go into the render queue, which sorts everything by z (and texture) at the end of the frame.
+	// Only the ones on screen (see visibility.h) get a slot, and the copying's split up between threads.
+	const vector<StaticSpriteComponent*>& visible = Visibility::main.sprites;
+	RenderQueue& queue = Game::main.renderer->queue;
+	const int first = queue.Reserve(static_cast<int>(visible.size()));
 
-		if (s->active && s->entity->Get_Scene() == activeScene ||
-			s->active && s->entity->Get_Scene() == 0)
+	ThreadPool::main.ParallelFor(static_cast<int>(visible.size()), 256, [&](int begin, int end, int worker)
 		{
-			GlobalPositionComponent* pos = s->pos;
-
-			if (pos->x + (s->width / 2.0f) > Game::main.leftX && pos->x - (s->width / 2.0f) < Game::main.rightX &&
-				pos->y + (s->height / 2.0f) > Game::main.bottomY && pos->y - (s->height / 2.0f) < Game::main.topY &&
-				pos->z < Game::main.camZ)
+			for (int i = begin; i < end; i++)
 			{
-				Game::main.renderer->prepareQuad(pos, s->width, s->height, s->scaleX, s->scaleY, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), s->sprite->ID, s->mapTex->ID, s->tiled, s->flippedX, s->flippedY);
+				StaticSpriteComponent* s = visible[i];
+
+				if (s->active && s->entity->Get_Scene() == activeScene ||
+					s->active && s->entity->Get_Scene() == 0)
+				{
+					GlobalPositionComponent* pos = s->pos;
+
+					if (pos->z < Game::main.camZ)
+					{
+						DrawCommand command = DrawCommand::Sprite(pos->x, pos->y, pos->rotation, s->width, s->height, s->scaleX, s->scaleY, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), s->sprite->ID, s->mapTex->ID, s->tiled, s->flippedX, s->flippedY);
+						command.translucent = s->translucent;
+						queue.Place(first + i, RenderLayer::world, pos->z, command);
+					}
+				}
 			}
-		}
-	}
+		});
 }
 
 void StaticRenderingSystem::AddComponent(Component* component)
 {
-	sprites.push_back((StaticSpriteComponent*)component);
+	StaticSpriteComponent* s = (StaticSpriteComponent*)component;
+
+	if (s->entity->componentIDMap.count(imageComponentID) != 0)
+	{
+		// Its image got here first, so it's the UI layer's to draw (see ImageSystem::AddComponent()).
+		s->screenSpace = true;
+		sprites.push_back(s);
+	}
+	else if (s->pos->stat && !s->translucent)
+	{
+		// The static layer's drawn with the opaque pass, so translucent sprites stay out of it.
+		bakedSprites.push_back(s);
+		StaticLayer::main.Add(s);
+	}
+	else
+	{
+		sprites.push_back(s);
+		Visibility::main.Add(s);
+	}
 }
 
 void StaticRenderingSystem::PurgeEntity(Entity* e)
@@ -467,6 +630,18 @@ void StaticRenderingSystem::PurgeEntity(Entity* e)
 		{
 			StaticSpriteComponent* s = sprites[i];
 			sprites.erase(std::remove(sprites.begin(), sprites.end(), s), sprites.end());
+			Visibility::main.Remove(s);
+			delete s;
+		}
+	}
+
+	for (int i = 0; i < bakedSprites.size(); i++)
+	{
+		if (bakedSprites[i]->entity == e)
+		{
+			StaticSpriteComponent* s = bakedSprites[i];
+			bakedSprites.erase(std::remove(bakedSprites.begin(), bakedSprites.end(), s), bakedSprites.end());
+			StaticLayer::main.Remove(s);
 			delete s;
 		}
 	}
@@ -601,85 +776,99 @@ void AnimationControllerSystem::PurgeEntity(Entity* e)
 
 void AnimationSystem::Update(int activeScene, float deltaTime)
 {
-	std::sort(anims.begin(), anims.end(), [](AnimationComponent* a, AnimationComponent* b)
+	// Each animation only ever touches itself, so like the sprites they're split up between threads.
+	// Every animation keeps ticking, on screen or not, but only the visible ones (see visibility.h) get drawn.
+	ThreadPool::main.ParallelFor(static_cast<int>(anims.size()), 128, [&](int begin, int end, int worker)
 		{
-			return a->pos->z < b->pos->z;
-		});
-
-	for (int i = 0; i < anims.size(); i++)
-	{
-		// Animations work by taking a big-ass spritesheet
-		// and moving through the uvs by increments equal
-		// to one divided by the width and height of each sprite;
-		// this means we need to know how many such cells are in
-		// the whole sheet (for both rows and columns), so that
-		// we can feed the right cell coordinates into the
-		// renderer. This shouldn't be too difficult; the real
-		// question is how we'll manage conditions for different
-		// animations.
-		// We could just have a map containing strings and animations
-		// and set the active animation by calling some function, sending
-		// to that the name of the requested animation in the form of that
-		// string, but that doesn't seem like the ideal way to do it.
-		// We might try that first and then decide later whether
-		// there isn't a better way to handle this.
-
-		AnimationComponent* a = anims[i];
-
-		if (a->active && a->entity->Get_Scene() == activeScene ||
-			a->active && a->entity->Get_Scene() == 0)
-		{
-			a->lastTick += deltaTime;
-
-			Animation2D* activeAnimation = a->animations[a->activeAnimation];
-
-			int cellX = a->activeX, cellY = a->activeY;
-
-			if (activeAnimation->speed < a->lastTick)
+			for (int i = begin; i < end; i++)
 			{
-				a->lastTick = 0;
-
-				if (a->activeX + 1 < activeAnimation->rowsToCols[cellY])
+				// Animations work by taking a big-ass spritesheet
+				// and moving through the uvs by increments equal
+				// to one divided by the width and height of each sprite;
+				// this means we need to know how many such cells are in
+				// the whole sheet (for both rows and columns), so that
+				// we can feed the right cell coordinates into the
+				// renderer. This shouldn't be too difficult; the real
+				// question is how we'll manage conditions for different
+				// animations.
+				// We could just have a map containing strings and animations
+				// and set the active animation by calling some function, sending
+				// to that the name of the requested animation in the form of that
+				// string, but that doesn't seem like the ideal way to do it.
+				// We might try that first and then decide later whether
+				// there isn't a better way to handle this.
+
+				AnimationComponent* a = anims[i];
+
+				if (a->active && a->entity->Get_Scene() == activeScene ||
+					a->active && a->entity->Get_Scene() == 0)
 				{
-					cellX = a->activeX += 1;
-				}
-				else
-				{
-					if (activeAnimation->loop ||
-						a->activeY > 0)
-					{
-						cellX = a->activeX = 0;
-					}
+					a->lastTick += deltaTime;
 
-					if (a->activeY - 1 >= 0)
-					{
-						cellY = a->activeY -= 1;
-					}
-					else if (activeAnimation->loop)
+					Animation2D* activeAnimation = a->animations[a->activeAnimation];
+
+					if (activeAnimation->speed < a->lastTick)
 					{
-						cellX = a->activeX = 0;
-						cellY = a->activeY = activeAnimation->rows - 1;
+						a->lastTick = 0;
+
+						if (a->activeX + 1 < activeAnimation->rowsToCols[a->activeY])
+						{
+							a->activeX += 1;
+						}
+						else
+						{
+							if (activeAnimation->loop ||
+								a->activeY > 0)
+							{
+								a->activeX = 0;
+							}
+
+							if (a->activeY - 1 >= 0)
+							{
+								a->activeY -= 1;
+							}
+							else if (activeAnimation->loop)
+							{
+								a->activeX = 0;
+								a->activeY = activeAnimation->rows - 1;
+							}
+						}
 					}
 				}
 			}
+		});
 
-			GlobalPositionComponent* pos = a->pos;
+	// And the ones on screen each get their own slot in the render queue.
+	const vector<AnimationComponent*>& visible = Visibility::main.animations;
+	RenderQueue& queue = Game::main.renderer->queue;
+	const int first = queue.Reserve(static_cast<int>(visible.size()));
 
-			if (pos->x + ((activeAnimation->width / activeAnimation->columns) / 2.0f) > Game::main.leftX && pos->x - ((activeAnimation->width / activeAnimation->columns) / 2.0f) < Game::main.rightX &&
-				pos->y + ((activeAnimation->height / activeAnimation->rows) / 2.0f) > Game::main.bottomY && pos->y - ((activeAnimation->height / activeAnimation->rows) / 2.0f) < Game::main.topY &&
-				pos->z < Game::main.camZ)
+	ThreadPool::main.ParallelFor(static_cast<int>(visible.size()), 256, [&](int begin, int end, int worker)
+		{
+			for (int i = begin; i < end; i++)
 			{
-				// std::cout << std::to_string(activeAnimation->width) + "/" + std::to_string(activeAnimation->height) + "\n";
-				Game::main.renderer->prepareQuad(pos, activeAnimation->width, activeAnimation->height, a->scaleX, a->scaleY, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), activeAnimation->ID, a->mapTex->ID, cellX, cellY, activeAnimation->columns, activeAnimation->rows, a->flippedX, a->flippedY);
-			}
+				AnimationComponent* a = visible[i];
+				GlobalPositionComponent* pos = a->pos;
 
-		}
-	}
+				if ((a->active && a->entity->Get_Scene() == activeScene ||
+					a->active && a->entity->Get_Scene() == 0) &&
+					pos->z < Game::main.camZ)
+				{
+					Animation2D* activeAnimation = a->animations.at(a->activeAnimation);
+
+					// std::cout << std::to_string(activeAnimation->width) + "/" + std::to_string(activeAnimation->height) + "\n";
+					DrawCommand command = DrawCommand::Cell(pos->x, pos->y, pos->rotation, activeAnimation->width, activeAnimation->height, a->scaleX, a->scaleY, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), activeAnimation->ID, a->mapTex->ID, a->activeX, a->activeY, activeAnimation->columns, activeAnimation->rows, a->flippedX, a->flippedY);
+					command.translucent = a->translucent;
+					queue.Place(first + i, RenderLayer::world, pos->z, command);
+				}
+			}
+		});
 }
 
 void AnimationSystem::AddComponent(Component* component)
 {
 	anims.push_back((AnimationComponent*)component);
+	Visibility::main.Add((AnimationComponent*)component);
 }
 
 void AnimationSystem::PurgeEntity(Entity* e)
@@ -690,6 +879,7 @@ void AnimationSystem::PurgeEntity(Entity* e)
 		{
 			AnimationComponent* s = anims[i];
 			anims.erase(std::remove(anims.begin(), anims.end(), s), anims.end());
+			Visibility::main.Remove(s);
 			delete s;
 		}
 	}
@@ -701,44 +891,76 @@ void AnimationSystem::PurgeEntity(Entity* e)
 
 void ParticleSystem::Update(int activeScene, float deltaTime)
 {
-	float screenLeft = (Game::main.camX - (Game::main.windowWidth * Game::main.zoom / 1.0f));
-	float screenRight = (Game::main.camX + (Game::main.windowWidth * Game::main.zoom / 1.0f));
-	float screenBottom = (Game::main.camY - (Game::main.windowHeight * Game::main.zoom / 1.0f));
-	float screenTop = (Game::main.camY + (Game::main.windowHeight * Game::main.zoom / 1.0f));
-	float screenElev = Game::main.camZ;
-
-	for (int i = 0; i < particles.size(); i++)
+	// Emitters that came before their entity's position get another look every frame, and start emitting
+	// (once Visibility's seen them) as soon as it's there.
+	for (int i = 0; i < waiting.size();)
 	{
-		ParticleComponent* p = particles[i];
+		if (FindPosition(waiting[i]))
+		{
+			Visibility::main.Add(waiting[i]);
+			waiting.erase(waiting.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	// Only emitters near enough to the screen (see visibility.h) do anything; the rest just wait
+	// until the camera comes back around to them.
+	const vector<ParticleComponent*>& visible = Visibility::main.emitters;
 
-		if (p->active && p->entity->Get_Scene() == activeScene ||
-			p->active && p->entity->Get_Scene() == 0)
+	// Each emitter only touches itself, and Emit() is safe from any thread, so they're split up between the workers.
+	// An emitter's place in the list stands in for it when the spawns get merged (and for its lifetime roll).
+	ThreadPool::main.ParallelFor(static_cast<int>(visible.size()), 64, [&](int begin, int end, int worker)
 		{
-			if (p->lastTick >= p->tickRate)
+			for (int i = begin; i < end; i++)
 			{
-				p->lastTick = 0.0f;
-				GlobalPositionComponent* pos = (GlobalPositionComponent*)p->entity->componentIDMap[globalPositionComponentID];
-				glm::vec2 pPos = glm::vec2(pos->x + p->xOffset, pos->y + p->yOffset);
+				ParticleComponent* p = visible[i];
 
-				if (pPos.x > screenLeft && pPos.x < screenRight &&
-					pPos.y > screenBottom && pPos.y < screenTop)
+				if (p->active && p->entity->Get_Scene() == activeScene ||
+					p->active && p->entity->Get_Scene() == 0)
 				{
-					float lifetime = p->minLifetime + static_cast<float>(rand()) * static_cast<float>(p->maxLifetime - p->minLifetime) / RAND_MAX;
+					if (p->lastTick >= p->tickRate)
+					{
+						p->lastTick = 0.0f;
+						glm::vec2 pPos = glm::vec2(p->pos->x + p->xOffset, p->pos->y + p->yOffset);
 
-					ParticleEngine::main.AddParticles(p->number, pPos.x, pPos.y, p->element, lifetime);
+						float lifetime = p->minLifetime + ParticleEngine::main.Roll(i) * (p->maxLifetime - p->minLifetime);
+
+						ParticleEngine::main.Emit({ static_cast<uint32_t>(i), p->budgetSlot, p->priority, p->maxAlive, p->number, pPos.x, pPos.y, p->element, static_cast<int>(lifetime) });
+					}
+					else
+					{
+						p->lastTick += deltaTime;
+					}
 				}
 			}
-			else
-			{
-				p->lastTick += deltaTime;
-			}
-		}
-	}
+		});
 }
 
 void ParticleSystem::AddComponent(Component* component)
 {
-	particles.push_back((ParticleComponent*)component);
+	ParticleComponent* p = (ParticleComponent*)component;
+	p->budgetSlot = ParticleEngine::main.RegisterEmitter();
+
+	particles.push_back(p);
+
+	if (FindPosition(p))
+	{
+		Visibility::main.Add(p);
+	}
+	else
+	{
+		waiting.push_back(p);
+	}
+}
+
+bool ParticleSystem::FindPosition(ParticleComponent* p)
+{
+	auto pos = p->entity->componentIDMap.find(globalPositionComponentID);
+	p->pos = pos != p->entity->componentIDMap.end() ? (GlobalPositionComponent*)pos->second : nullptr;
+	return p->pos != nullptr;
 }
 
 void ParticleSystem::PurgeEntity(Entity* e)
@@ -749,6 +971,9 @@ void ParticleSystem::PurgeEntity(Entity* e)
 		{
 			ParticleComponent* s = particles[i];
 			particles.erase(std::remove(particles.begin(), particles.end(), s), particles.end());
+			waiting.erase(std::remove(waiting.begin(), waiting.end(), s), waiting.end());
+			Visibility::main.Remove(s);
+			ParticleEngine::main.ReleaseEmitter(s->budgetSlot);
 			delete s;
 		}
 	}
@@ -759,56 +984,181 @@ void ParticleSystem::PurgeEntity(Entity* e)
 #pragma region Image System
 
 void ImageSystem::Update(int activeScene, float deltaTime)
+{
+	// Images are drawn (and anchored) by the UI layer, which only has to bother when something changes.
+	// Switching scenes changes which ones are shown, though, so it does need to hear about that.
+	UILayer::main.SetScene(activeScene);
+}
+
+void ImageSystem::AddComponent(Component* component)
+{
+	ImageComponent* img = (ImageComponent*)component;
+	images.push_back(img);
+
+	// find() rather than [], which would leave a null behind for RegisterComponent() to trip over if the sprite
+	// isn't here yet (in which case StaticRenderingSystem::AddComponent() sorts it out when it is).
+	auto found = img->entity->componentIDMap.find(spriteComponentID);
+
+	if (found != img->entity->componentIDMap.end())
+	{
+		// The UI layer draws it from now on, so the world mustn't as well.
+		StaticSpriteComponent* sprite = (StaticSpriteComponent*)found->second;
+		sprite->screenSpace = true;
+		StaticLayer::main.Remove(sprite);
+		Visibility::main.Remove(sprite);
+	}
+
+	UILayer::main.Add(img);
+}
+
+void ImageSystem::PurgeEntity(Entity* e)
 {
 	for (int i = 0; i < images.size(); i++)
 	{
-		ImageComponent* img = images[i];
+		if (images[i]->entity == e)
+		{
+			ImageComponent* s = images[i];
+			images.erase(std::remove(images.begin(), images.end(), s), images.end());
+			UILayer::main.Remove(s);
+			delete s;
+		}
+	}
+}
 
-		if (img->active && img->entity->Get_Scene() == activeScene ||
-			img->active && img->entity->Get_Scene() == 0)
+#pragma endregion
+
+#pragma region Tilemap System
+
+void TilemapSystem::Update(int activeScene, float deltaTime)
+{
+	frame++;
+	visibleChunks = 0;
+
+	for (TilemapComponent* t : tilemaps)
+	{
+		if (!t->active || t->entity->Get_Scene() != activeScene && t->entity->Get_Scene() != 0 || t->pos->z >= Game::main.camZ)
 		{
-			GlobalPositionComponent* pos = (GlobalPositionComponent*)img->entity->componentIDMap[globalPositionComponentID];
-			StaticSpriteComponent* sprite = (StaticSpriteComponent*)img->entity->componentIDMap[spriteComponentID];
+			continue;
+		}
 
-			glm::vec2 anchorPos;
+		const float chunkSize = TilemapComponent::CHUNK_TILES * t->tileSize;
 
-			if (img->anchor == Anchor::topLeft)
-			{
-				anchorPos = glm::vec2(Game::main.leftX, Game::main.topY) - glm::vec2(-sprite->sprite->width, sprite->sprite->height);
-			}
-			else if (img->anchor == Anchor::topRight)
+		// Since the chunks are laid out on a grid, we can work out which ones the camera can see
+		// straight from its edges instead of testing each one.
+		const int firstX = std::max(0, (int)std::floor((Game::main.leftX - t->pos->x) / chunkSize));
+		const int lastX = std::min(t->chunksX - 1, (int)std::floor((Game::main.rightX - t->pos->x) / chunkSize));
+		const int firstY = std::max(0, (int)std::floor((Game::main.bottomY - t->pos->y) / chunkSize));
+		const int lastY = std::min(t->chunksY - 1, (int)std::floor((Game::main.topY - t->pos->y) / chunkSize));
+
+		for (int cy = firstY; cy <= lastY; cy++)
+		{
+			for (int cx = firstX; cx <= lastX; cx++)
 			{
-				anchorPos = glm::vec2(Game::main.rightX, Game::main.topY) - glm::vec2(sprite->sprite->width, sprite->sprite->height);;
+				TilemapComponent::Chunk& c = t->chunks[cy * t->chunksX + cx];
+
+				if (c.tiles.empty())
+				{
+					continue;
+				}
+
+				c.lastSeen = frame;
+
+				if (c.dirty || c.mesh == nullptr)
+				{
+					Rebuild(t, cx, cy);
+				}
+
+				if (c.mesh->quadCount > 0)
+				{
+					visibleChunks++;
+					Game::main.renderer->submitRetained(c.mesh);
+				}
 			}
-			else if (img->anchor == Anchor::bottomLeft)
+		}
+
+		// Let go of whatever hasn't been on screen for a while; it'll get rebuilt if we come back.
+		for (TilemapComponent::Chunk& c : t->chunks)
+		{
+			if (c.mesh != nullptr && frame - c.lastSeen > EVICT_FRAMES)
 			{
-				anchorPos = glm::vec2(Game::main.leftX, Game::main.bottomY) + glm::vec2(sprite->sprite->width, sprite->sprite->height);;
+				delete c.mesh;
+				c.mesh = nullptr;
 			}
-			else // if (img->anchor == Anchor::bottomRight)
+		}
+	}
+}
+
+void TilemapSystem::Rebuild(TilemapComponent* t, int chunkX, int chunkY)
+{
+	TilemapComponent::Chunk& c = t->chunks[chunkY * t->chunksX + chunkX];
+	c.dirty = false;
+	rebuiltChunks++;
+
+	if (c.mesh == nullptr)
+	{
+		c.mesh = new RetainedMesh();
+	}
+
+	// buildCellQuad() makes each cell (width * scaleX / cols) across from the middle, so this gets us exactly one tile.
+	const float scaleX = t->tileSize * t->cols / (2.0f * t->tileset->width);
+	const float scaleY = t->tileSize * t->rows / (2.0f * t->tileset->height);
+	const int tileCount = t->cols * t->rows;
+
+	vector<RetainedQuad> quads;
+	quads.reserve(TilemapComponent::CHUNK_TILES * TilemapComponent::CHUNK_TILES);
+
+	for (int y = 0; y < TilemapComponent::CHUNK_TILES; y++)
+	{
+		for (int x = 0; x < TilemapComponent::CHUNK_TILES; x++)
+		{
+			const uint16_t tile = c.tiles[y * TilemapComponent::CHUNK_TILES + x];
+
+			if (tile == 0 || tile > tileCount)
 			{
-				anchorPos = glm::vec2(Game::main.rightX, Game::main.bottomY) + glm::vec2(-sprite->sprite->width, sprite->sprite->height);;
+				continue;
 			}
 
-			pos->x = anchorPos.x + img->x;
-			pos->y = anchorPos.y + img->y;
+			const int tileX = chunkX * TilemapComponent::CHUNK_TILES + x;
+			const int tileY = chunkY * TilemapComponent::CHUNK_TILES + y;
+			const glm::vec2 center = glm::vec2(t->pos->x + (tileX + 0.5f) * t->tileSize, t->pos->y + (tileY + 0.5f) * t->tileSize);
+
+			RetainedQuad q;
+			q.texture = t->tileset->ID;
+			q.map = t->mapTex->ID;
+			Renderer::buildCellQuad(q.quad, center, t->pos->z, 0.0f, t->tileset->width, t->tileset->height, scaleX, scaleY, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), 0.0f, 0.0f,
+				(tile - 1) % t->cols, (tile - 1) / t->cols, t->cols, t->rows, false, false);
+			quads.push_back(q);
 		}
 	}
+
+	c.mesh->Build(quads);
 }
 
-void ImageSystem::AddComponent(Component* component)
+void TilemapSystem::AddComponent(Component* component)
 {
-	images.push_back((ImageComponent*)component);
+	tilemaps.push_back((TilemapComponent*)component);
 }
 
-void ImageSystem::PurgeEntity(Entity* e)
+void TilemapSystem::PurgeEntity(Entity* e)
 {
-	for (int i = 0; i < images.size(); i++)
+	for (int i = 0; i < tilemaps.size(); i++)
 	{
-		if (images[i]->entity == e)
+		if (tilemaps[i]->entity == e)
 		{
-			ImageComponent* s = images[i];
-			images.erase(std::remove(images.begin(), images.end(), s), images.end());
-			delete s;
+			TilemapComponent* t = tilemaps[i];
+			tilemaps.erase(std::remove(tilemaps.begin(), tilemaps.end(), t), tilemaps.end());
+
+			// Entities get purged after the systems have run but before the renderer's drawn anything,
+			// so its chunks could already be waiting to be drawn this frame.
+			for (TilemapComponent::Chunk& c : t->chunks)
+			{
+				if (c.mesh != nullptr)
+				{
+					Game::main.renderer->withdrawRetained(c.mesh);
+				}
+			}
+
+			delete t;
 		}
 	}
 }
@@ -90,10 +90,11 @@ class ECS
 private:
 	uint32_t entityIDCounter = 0;
 	int round = 0;
+
+public:
 	static const int mWidth = 100;
 	static const int mHeight = 100;
 
-public:
 	static ECS main;
 	int activeScene;
 	Entity* player;
@@ -101,9 +102,14 @@ public:
 	vector<Entity*> entities;
 	vector<Entity*> dyingEntities;
 
+	// Node (x, y) covers [x, x + 1) * nodeSize along from the world's origin, and so on.
 	float nodeSize = 5.0f;
 	Node* nodeMap[mWidth][mHeight];
 
+	// Goes up whenever a node's blocked flag changes, so anything built from them (like the particles'
+	// occupancy grid) knows to rebuild.
+	int nodeVersion = 0;
+
 	vector<ComponentBlock*> componentBlocks;
 
 	uint32_t GetID();
@@ -114,6 +120,9 @@ public:
 	void AddDeadEntity(Entity* e);
 	void PurgeDeadEntities();
 	void RegisterComponent(Component* component, Entity* entity);
+
+	// Blocks (or unblocks) every node from (x0, y0) to (x1, y1), inclusive; anything off the map is ignored.
+	void SetBlocked(int x0, int y0, int x1, int y1, bool blocked);
 };
 
 #endif
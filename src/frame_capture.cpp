@@ -0,0 +1,519 @@
+#include "frame_capture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <GLFW/glfw3.h>
+#include "check_error.h"
+#include "game.h"
+#include "gl_extensions.h"
+#include "texture_2D.h"
+#include "thread_pool.h"
+
+// See frame_capture.h. The file is a small header followed by a run of tagged records:
+//
+//     "ASCP" [ version : u32 ] [ white texture : u32 ]
+//     'T' [ id : u32 ] [ width : i32 ] [ height : i32 ]       the first time a texture shows up
+//     'F' [ MVP : 16 floats ] [ retained meshes : u32 ]      one per frame, then:
+//         [ count : u32 ] [ texturesUsed : u32 each ]
+//         [ batches : u32 ] per batch: [ count : u32 ] [ Quad each ]
+//         [ commands : u32 ] per command: [ key : u64 ] [ DrawCommand ]
+//         [ particle textures : u32 ] [ texture : u32 each ]
+//         [ particles : u32 ] [ ParticleInstance each ]
+//
+// Everything's written exactly as it sits in memory, so a capture only plays back on a build with
+// the same Quad, DrawCommand and ParticleInstance layout; the version gets bumped whenever any of them changes.
+
+static constexpr char MAGIC[4] = { 'A', 'S', 'C', 'P' };
+static constexpr uint32_t VERSION = 2;
+
+template <typename T>
+static void Write(std::ofstream& file, const T& value)
+{
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool Read(std::ifstream& file, T& value)
+{
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+#pragma region Capture
+
+FrameCapture::~FrameCapture()
+{
+    Close();
+}
+
+bool FrameCapture::Open(const std::string& path)
+{
+    Close();
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+
+    if (!file.is_open())
+    {
+        std::cout << "Couldn't open \"" << path << "\" to capture into.\n";
+        return false;
+    }
+
+    file.write(MAGIC, sizeof(MAGIC));
+    Write(file, VERSION);
+    Write(file, static_cast<uint32_t>(0));
+
+    knownTextures.clear();
+    frames = 0;
+    return true;
+}
+
+void FrameCapture::Close()
+{
+    if (file.is_open())
+    {
+        file.close();
+        std::cout << "Captured " << frames << " frames.\n";
+    }
+}
+
+void FrameCapture::RecordTexture(GLuint texture)
+{
+    // Zero is the padding between batches, not a texture.
+    if (texture == 0 || !knownTextures.insert(texture).second)
+    {
+        return;
+    }
+
+    GLint width = 1;
+    GLint height = 1;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+
+    Write(file, 'T');
+    Write(file, static_cast<uint32_t>(texture));
+    Write(file, static_cast<int32_t>(width));
+    Write(file, static_cast<int32_t>(height));
+}
+
+void FrameCapture::Record(const Renderer& renderer)
+{
+    if (!file.is_open())
+    {
+        return;
+    }
+
+    if (frames == 0)
+    {
+        // The white texture's name wasn't known when the header went out, so go back and fill it in.
+        const std::streampos here = file.tellp();
+        file.seekp(sizeof(MAGIC) + sizeof(VERSION));
+        Write(file, static_cast<uint32_t>(renderer.whiteTextureID));
+        file.seekp(here);
+    }
+
+    const RenderQueue& queue = renderer.queue;
+    const ParticleRenderer& particles = renderer.particles;
+
+    // If the particle engine didn't hand anything over this frame, nothing gets drawn.
+    const int particleCount = particles.begun ? static_cast<int>(particles.copy.size()) : 0;
+
+    // Textures first, so the replay has seen every one of them by the time a frame refers to it.
+    for (GLuint texture : renderer.texturesUsed)
+    {
+        RecordTexture(texture);
+    }
+
+    for (const RenderQueue::Item& item : queue.items)
+    {
+        if (item.command != RenderQueue::EMPTY)
+        {
+            RecordTexture(queue.commands[item.command].textureID);
+            RecordTexture(queue.commands[item.command].mapID);
+        }
+    }
+
+    for (GLuint texture : particles.textures)
+    {
+        RecordTexture(texture);
+    }
+
+    Write(file, 'F');
+    Write(file, Game::main.projection * Game::main.view);
+    Write(file, static_cast<uint32_t>(renderer.retainedMeshes.size()));
+
+    Write(file, static_cast<uint32_t>(renderer.texturesUsed.size()));
+    file.write(reinterpret_cast<const char*>(renderer.texturesUsed.data()), renderer.texturesUsed.size() * sizeof(GLuint));
+
+    Write(file, static_cast<uint32_t>(renderer.batches.size()));
+
+    for (const Batch& batch : renderer.batches)
+    {
+        Write(file, static_cast<uint32_t>(batch.quadCount));
+
+        for (const QuadChunk* chunk : batch.chunks)
+        {
+            file.write(reinterpret_cast<const char*>(&chunk->quads[0]), chunk->count * sizeof(Quad));
+        }
+    }
+
+    uint32_t placed = 0;
+
+    for (const RenderQueue::Item& item : queue.items)
+    {
+        placed += item.command != RenderQueue::EMPTY ? 1 : 0;
+    }
+
+    // In slot order, unsorted; the replay does the sorting, same as the game did.
+    Write(file, placed);
+
+    for (const RenderQueue::Item& item : queue.items)
+    {
+        if (item.command != RenderQueue::EMPTY)
+        {
+            Write(file, item.key);
+            Write(file, queue.commands[item.command]);
+        }
+    }
+
+    Write(file, static_cast<uint32_t>(particles.textures.size()));
+    file.write(reinterpret_cast<const char*>(particles.textures.data()), particles.textures.size() * sizeof(GLuint));
+
+    Write(file, static_cast<uint32_t>(particleCount));
+    file.write(reinterpret_cast<const char*>(particles.copy.data()), particleCount * sizeof(ParticleInstance));
+
+    frames++;
+}
+
+#pragma endregion
+
+#pragma region Replay
+
+namespace
+{
+    struct CapturedFrame
+    {
+        glm::mat4 MVP;
+        uint32_t retainedMeshes = 0;
+        std::vector<GLuint> texturesUsed;
+        std::vector<std::vector<Quad>> batches;
+        std::vector<uint64_t> keys;
+        std::vector<DrawCommand> commands;
+        std::vector<GLuint> particleTextures;
+        std::vector<ParticleInstance> particles;
+    };
+
+    struct CapturedTexture
+    {
+        uint32_t id;
+        int32_t width;
+        int32_t height;
+    };
+}
+
+static bool Load(const std::string& path, uint32_t& whiteTexture, std::vector<CapturedTexture>& textures, std::vector<CapturedFrame>& frames)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    char magic[sizeof(MAGIC)];
+    uint32_t version = 0;
+
+    if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || !Read(file, version))
+    {
+        std::cout << "\"" << path << "\" isn't a frame capture.\n";
+        return false;
+    }
+
+    if (version != VERSION)
+    {
+        std::cout << "\"" << path << "\" is capture version " << version << "; this build reads version " << VERSION << ".\n";
+        return false;
+    }
+
+    Read(file, whiteTexture);
+
+    char tag;
+
+    while (Read(file, tag))
+    {
+        if (tag == 'T')
+        {
+            CapturedTexture texture;
+            Read(file, texture.id);
+            Read(file, texture.width);
+            Read(file, texture.height);
+            textures.push_back(texture);
+        }
+        else if (tag == 'F')
+        {
+            CapturedFrame frame;
+            uint32_t count = 0;
+
+            Read(file, frame.MVP);
+            Read(file, frame.retainedMeshes);
+
+            Read(file, count);
+            frame.texturesUsed.resize(count);
+            file.read(reinterpret_cast<char*>(frame.texturesUsed.data()), count * sizeof(GLuint));
+
+            Read(file, count);
+            frame.batches.resize(count);
+
+            for (std::vector<Quad>& quads : frame.batches)
+            {
+                Read(file, count);
+                quads.resize(count);
+                file.read(reinterpret_cast<char*>(quads.data()), count * sizeof(Quad));
+            }
+
+            Read(file, count);
+            frame.keys.resize(count);
+            frame.commands.resize(count);
+
+            for (uint32_t i = 0; i < count; i++)
+            {
+                Read(file, frame.keys[i]);
+                Read(file, frame.commands[i]);
+            }
+
+            Read(file, count);
+            frame.particleTextures.resize(count);
+            file.read(reinterpret_cast<char*>(frame.particleTextures.data()), count * sizeof(GLuint));
+
+            Read(file, count);
+            frame.particles.resize(count);
+            file.read(reinterpret_cast<char*>(frame.particles.data()), count * sizeof(ParticleInstance));
+
+            if (!file)
+            {
+                // Most likely the game was killed partway through writing this one.
+                std::cout << "Capture cuts off partway through frame " << frames.size() << "; playing what's there.\n";
+                break;
+            }
+
+            frames.push_back(std::move(frame));
+        }
+        else
+        {
+            std::cout << "Unknown record '" << tag << "' in \"" << path << "\"; stopping there.\n";
+            break;
+        }
+    }
+
+    return true;
+}
+
+int FrameCapture::Replay(const std::string& path, int loops)
+{
+    uint32_t capturedWhite = 0;
+    std::vector<CapturedTexture> textures;
+    std::vector<CapturedFrame> frames;
+
+    if (!Load(path, capturedWhite, textures, frames))
+    {
+        return 1;
+    }
+
+    if (frames.empty())
+    {
+        std::cout << "\"" << path << "\" doesn't have any frames in it.\n";
+        return 1;
+    }
+
+    loops = std::max(loops, 1);
+
+    // Same context as the game gets, just never shown.
+    if (!glfwInit())
+        return -1;
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_DEPTH_BITS, 24);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    GLFWwindow* window = glfwCreateWindow(Game::main.windowWidth, Game::main.windowHeight, "Asciismos Replay", NULL, NULL);
+    if (!window)
+    {
+        glfwTerminate();
+        return -1;
+    }
+
+    glfwMakeContextCurrent(window);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "Failed to initialize GLAD" << '\n';
+        return -1;
+    }
+
+    GLExtensions::Load();
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    Game::main.window = window;
+    ThreadPool::main.Start(std::max(1, static_cast<int>(std::thread::hardware_concurrency())) - 1);
+
+    Texture2D* whiteTexture = Texture2D::whiteTexture();
+
+    {
+        Renderer renderer{ whiteTexture->ID };
+
+        // Blank stand-ins for the game's textures, at the same sizes, so the shader samples the same amount.
+        std::unordered_map<GLuint, GLuint> names;
+        names[capturedWhite] = whiteTexture->ID;
+        names[0] = 0;
+
+        std::vector<GLuint> standIns;
+
+        for (const CapturedTexture& texture : textures)
+        {
+            if (texture.id == capturedWhite)
+            {
+                continue;
+            }
+
+            const std::vector<unsigned char> pixels(static_cast<size_t>(texture.width) * texture.height * 4, 0xFF);
+
+            GLuint id;
+            glGenTextures(1, &id);
+            glBindTexture(GL_TEXTURE_2D, id);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.width, texture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+            standIns.push_back(id);
+            names[texture.id] = id;
+        }
+
+        auto rename = [&names](GLuint id)
+        {
+            auto it = names.find(id);
+            return it != names.end() ? it->second : id;
+        };
+
+        // The keys are kept as they were, so everything sorts exactly the way it did in the game.
+        for (CapturedFrame& frame : frames)
+        {
+            for (GLuint& id : frame.texturesUsed)
+            {
+                id = rename(id);
+            }
+
+            for (DrawCommand& command : frame.commands)
+            {
+                command.textureID = static_cast<int>(rename(command.textureID));
+                command.mapID = static_cast<int>(rename(command.mapID));
+            }
+
+            // The instances only refer to units, so it's just the textures in them that need renaming.
+            for (GLuint& id : frame.particleTextures)
+            {
+                id = rename(id);
+            }
+        }
+
+        glCheckError();
+
+        long long quads = 0;
+        long long batches = 0;
+        long long drawCalls = 0;
+        long long materialChanges = 0;
+        long long retainedMeshes = 0;
+        long long particles = 0;
+        double totalMilliseconds = 0.0;
+        double worstMilliseconds = 0.0;
+
+        // One untimed pass first, so the stream buffer and palette cache have settled.
+        for (int loop = -1; loop < loops; loop++)
+        {
+            for (const CapturedFrame& frame : frames)
+            {
+                const auto start = std::chrono::high_resolution_clock::now();
+
+                renderer.resetBuffers();
+                renderer.texturesUsed = frame.texturesUsed;
+
+                for (int b = 0; b < frame.batches.size(); b++)
+                {
+                    renderer.batchAt(b);
+
+                    for (const Quad& quad : frame.batches[b])
+                    {
+                        renderer.nextQuad(b) = quad;
+                    }
+                }
+
+                RenderQueue& queue = renderer.queue;
+                const int first = queue.Reserve(static_cast<int>(frame.commands.size()));
+
+                for (int i = 0; i < frame.commands.size(); i++)
+                {
+                    queue.items[first + i] = { frame.keys[i], static_cast<uint32_t>(first + i) };
+                    queue.commands[first + i] = frame.commands[i];
+                }
+
+                // Handed over just the way the particle engine would have.
+                ParticleInstance* instances = renderer.particles.BeginWith(frame.particleTextures, static_cast<int>(frame.particles.size()));
+                std::copy(frame.particles.begin(), frame.particles.end(), instances);
+                renderer.particles.End(static_cast<int>(frame.particles.size()));
+
+                Game::main.projection = frame.MVP;
+                Game::main.view = glm::mat4(1.0f);
+
+                glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                renderer.sendToGL();
+                glFinish();
+
+                const auto end = std::chrono::high_resolution_clock::now();
+                const double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+                if (loop < 0)
+                {
+                    continue;
+                }
+
+                totalMilliseconds += milliseconds;
+                worstMilliseconds = std::max(worstMilliseconds, milliseconds);
+
+                // Every batch gets flushed, empty or not, so the texture slots are the only way to count them.
+                quads += renderer.queuedQuads;
+                for (const std::vector<Quad>& direct : frame.batches)
+                {
+                    quads += direct.size();
+                }
+
+                batches += (renderer.texturesUsed.size() + Renderer::MAX_TEXTURES_PER_BATCH - 1) / Renderer::MAX_TEXTURES_PER_BATCH;
+                drawCalls += renderer.drawCalls;
+                materialChanges += queue.materialChanges;
+                retainedMeshes += frame.retainedMeshes;
+                particles += frame.particles.size();
+            }
+        }
+
+        const double played = static_cast<double>(frames.size()) * loops;
+
+        std::cout << "Replayed " << frames.size() << " frames " << loops << " times from \"" << path << "\"\n";
+        std::cout << "  " << totalMilliseconds / played << " ms per frame (worst " << worstMilliseconds << " ms)\n";
+        std::cout << "  " << quads / played << " quads, " << batches / played << " batches, " << drawCalls / played << " draw calls per frame\n";
+        std::cout << "  " << materialChanges / played << " material changes per frame\n";
+        std::cout << "  " << particles / played << " particles per frame\n";
+        std::cout << "  " << retainedMeshes / played << " retained meshes per frame captured (not replayed)\n";
+
+        glDeleteTextures(static_cast<GLsizei>(standIns.size()), standIns.data());
+    }
+
+    delete whiteTexture;
+
+    ThreadPool::main.Stop();
+    glfwTerminate();
+    return 0;
+}
+
+#pragma endregion
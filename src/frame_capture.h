@@ -0,0 +1,47 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+// Frame capture records exactly what the renderer was asked to draw, frame by frame, so a heavy frame
+// can be played back later without having to play the game to get there. Run the game with
+// "asciismos --capture <file>" to record every frame, then "asciismos --replay <file> [loops]" feeds
+// them all back through a real Renderer (in a hidden window) as many times as you like and reports
+// how long it took and how well things batched.
+//
+// What gets recorded is the state the renderer's in when sendToGL() is called: everything in the render
+// queue (keys and commands, in the order they were placed), whatever was prepareQuad()'d straight into
+// the batches, which textures those batches were using, and the particles (their instances and the textures
+// in each unit; see particle_renderer.h). Textures themselves aren't saved, just their sizes; the replay makes
+// blank stand-ins for them. Retained meshes already live on the GPU, so they're only counted.
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <glm/glm.hpp>
+#include "renderer.h"
+
+class FrameCapture
+{
+public:
+    ~FrameCapture();
+
+    bool Open(const std::string& path);
+    void Close();
+    bool IsOpen() const { return file.is_open(); }
+
+    // Called by the renderer at the top of sendToGL().
+    void Record(const Renderer& renderer);
+
+    // Returns what main() should return.
+    static int Replay(const std::string& path, int loops);
+
+private:
+    std::ofstream file;
+    std::unordered_set<GLuint> knownTextures;
+    int frames = 0;
+
+    void RecordTexture(GLuint texture);
+};
+
+#endif
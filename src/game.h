@@ -28,6 +28,9 @@ public:
 	float camZ = 120.0f;
 	float zoom = 0.5f;
 
+	// Like zoom, but for the UI (see ui_layer.h); bigger numbers make the UI smaller.
+	float uiZoom = 0.5f;
+
 	float mouseX = 0.0f;
 	float mouseY = 0.0f;
 
@@ -0,0 +1,64 @@
+#include "gl_extensions.h"
+
+#include <GLFW/glfw3.h>
+#include <iostream>
+
+// This just figures out which of the optional extensions we care about are around
+// and grabs their function pointers. If something isn't supported, the pointer stays
+// null and the flag stays false, and the code using it should fall back to plain 3.3.
+
+bool GLExtensions::bufferStorage = false;
+PFNGLBUFFERSTORAGEPROCEXT GLExtensions::glBufferStorage = nullptr;
+
+bool GLExtensions::programBinary = false;
+PFNGLGETPROGRAMBINARYPROCEXT GLExtensions::glGetProgramBinary = nullptr;
+PFNGLPROGRAMBINARYPROCEXT GLExtensions::glProgramBinary = nullptr;
+PFNGLPROGRAMPARAMETERIPROCEXT GLExtensions::glProgramParameteri = nullptr;
+
+bool GLExtensions::parallelShaderCompile = false;
+
+void GLExtensions::Load()
+{
+    const bool gl44 = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4);
+
+    if (gl44 || glfwExtensionSupported("GL_ARB_buffer_storage"))
+    {
+        glBufferStorage = (PFNGLBUFFERSTORAGEPROCEXT)glfwGetProcAddress("glBufferStorage");
+        bufferStorage = glBufferStorage != nullptr;
+    }
+
+    const bool gl41 = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1);
+
+    if (gl41 || glfwExtensionSupported("GL_ARB_get_program_binary"))
+    {
+        glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROCEXT)glfwGetProcAddress("glGetProgramBinary");
+        glProgramBinary = (PFNGLPROGRAMBINARYPROCEXT)glfwGetProcAddress("glProgramBinary");
+        glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROCEXT)glfwGetProcAddress("glProgramParameteri");
+
+        // A driver's allowed to support the extension and then not offer any formats, which amounts to the same as not supporting it.
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+        programBinary = glGetProgramBinary != nullptr && glProgramBinary != nullptr && glProgramParameteri != nullptr && formats > 0;
+    }
+
+    PFNGLMAXSHADERCOMPILERTHREADSPROCEXT glMaxShaderCompilerThreads = nullptr;
+
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+    {
+        glMaxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSPROCEXT)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    }
+    else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+    {
+        glMaxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSPROCEXT)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+    }
+
+    if (glMaxShaderCompilerThreads != nullptr)
+    {
+        glMaxShaderCompilerThreads(0xFFFFFFFFu);
+        parallelShaderCompile = true;
+    }
+
+    std::cout << "Persistent buffer mapping: " << (bufferStorage ? "available" : "unavailable") << '\n';
+    std::cout << "Program binaries: " << (programBinary ? "available" : "unavailable") << ", parallel shader compile: " << (parallelShaderCompile ? "available" : "unavailable") << '\n';
+}
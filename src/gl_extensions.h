@@ -0,0 +1,57 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+// Our copy of glad was generated for a plain 3.3 core context, so it doesn't know about
+// anything newer. Some of that newer stuff is worth using when the driver happens to have it,
+// so we load those few entry points by hand in here (after glad has done its thing) and
+// everything else just checks the flags below before touching them.
+
+#include <glad/glad.h>
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_DYNAMIC_STORAGE_BIT
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROCEXT)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROCEXT)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROCEXT)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROCEXT)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSPROCEXT)(GLuint count);
+
+class GLExtensions
+{
+public:
+    // GL_ARB_buffer_storage (core in 4.4); lets us keep buffers persistently mapped.
+    static bool bufferStorage;
+    static PFNGLBUFFERSTORAGEPROCEXT glBufferStorage;
+
+    // GL_ARB_get_program_binary (core in 4.1); lets us save linked programs and skip compiling next time.
+    static bool programBinary;
+    static PFNGLGETPROGRAMBINARYPROCEXT glGetProgramBinary;
+    static PFNGLPROGRAMBINARYPROCEXT glProgramBinary;
+    static PFNGLPROGRAMPARAMETERIPROCEXT glProgramParameteri;
+
+    // GL_KHR_parallel_shader_compile; if it's there, we tell the driver to use as many threads as it likes.
+    static bool parallelShaderCompile;
+
+    // Must be called once the context is current and glad has been loaded.
+    static void Load();
+};
+
+#endif
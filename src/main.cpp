@@ -1,6 +1,8 @@
 // main.cpp
 //
 
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <filesystem>
 #include <map>
@@ -12,16 +14,32 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "bench.h"
+#include "console.h"
+#include "frame_capture.h"
 #include "shader.h"
 #include "game.h"
 #include "check_error.h"
+#include "gl_extensions.h"
 #include "entity.h"
 #include "particleengine.h"
 #include "ecs.h"
+#include "static_layer.h"
+#include "thread_pool.h"
+#include "palette_cache.h"
+#include "rng.h"
+#include "ui_layer.h"
+#include "visibility.h"
 
 Game Game::main;
 ECS ECS::main;
 ParticleEngine ParticleEngine::main;
+StaticLayer StaticLayer::main;
+ThreadPool ThreadPool::main;
+PaletteCache PaletteCache::main;
+RngService RngService::main;
+UILayer UILayer::main;
+Visibility Visibility::main;
 
 // This is the hub which handles updates and setup.
 // In an attempt to keep this from getting cluttered, we're keeping some information
@@ -52,8 +70,20 @@ void MessageCallback(GLenum source,
     std::cout << "\n";
 }
 
-int main(void)
+int main(int argc, char** argv)
 {
+    // "asciismos --bench <name>" just runs one of the microbenchmarks and quits, without ever opening a window.
+    if (argc >= 3 && std::string(argv[1]) == "--bench")
+    {
+        return Bench::Run(argv[2]);
+    }
+
+    // "asciismos --replay <file> [loops]" plays back a capture made with "--capture <file>"; see frame_capture.h.
+    if (argc >= 3 && std::string(argv[1]) == "--replay")
+    {
+        return FrameCapture::Replay(argv[2], argc >= 4 ? std::atoi(argv[3]) : 10);
+    }
+
     #pragma region GL Rendering Setup
     int windowWidth = Game::main.windowWidth;
     int windowHeight = Game::main.windowHeight;
@@ -68,6 +98,9 @@ int main(void)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+    // The renderer's opaque pass sorts itself out with the depth buffer.
+    glfwWindowHint(GLFW_DEPTH_BITS, 24);
+
     glfwWindowHintString(GLFW_X11_CLASS_NAME, "OpenGL");
     glfwWindowHintString(GLFW_X11_INSTANCE_NAME, "OpenGL");
 
@@ -86,6 +119,8 @@ int main(void)
         return -1;
     }
 
+    GLExtensions::Load();
+
     glfwSetWindowPosCallback(window, WindowPosCallback);
 
     glEnable(GL_BLEND);
@@ -102,9 +137,32 @@ int main(void)
 
     #pragma region World Setup
 
-    srand(time(NULL));
+    // One thread per core, counting this one; hardware_concurrency() is allowed to say 0 if it doesn't know.
+    ThreadPool::main.Start(std::max(1, static_cast<int>(std::thread::hardware_concurrency())) - 1);
+
+    // "--seed <n>" replays a run (see rng.h); otherwise it's whatever the clock says, and printed so it can be.
+    // "--deterministic" makes particles come out the same however many threads there are (see particleengine.h).
+    uint64_t seed = RngService::ClockSeed();
+    bool deterministic = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--deterministic")
+        {
+            deterministic = true;
+        }
+        else if (std::string(argv[i]) == "--seed" && i + 1 < argc)
+        {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+    }
+
+    RngService::main.Seed(seed);
+    std::cout << "Seed: " << seed << "\n";
+
     ECS::main.Init();
     ParticleEngine::main.Init(0.05f);
+    ParticleEngine::main.deterministic = deterministic;
 
     #pragma endregion
 
@@ -115,224 +173,283 @@ int main(void)
 
     Texture2D* whiteTexture = Texture2D::whiteTexture();
 
-    Renderer renderer{ whiteTexture->ID };
+    // Everything that talks to GL lives in here, so it's all gone before the context is (see Shutdown).
+    {
+        Renderer renderer{ whiteTexture->ID };
 
-    // I should talk about textures. Every texture has a source and a map.
-    // The source textures are the same across all the sprites and animations for an object or character,
-    // so instead of altering a source, one creates a map for any alternative forms of sprites or animations.
-    // Each pixel in the source sprite has an r and a b value that denotes some x and y value on the map
-    // which is used to find the color of the pixel.
+        // I should talk about textures. Every texture has a source and a map.
+        // The source textures are the same across all the sprites and animations for an object or character,
+        // so instead of altering a source, one creates a map for any alternative forms of sprites or animations.
+        // Each pixel in the source sprite has an r and a b value that denotes some x and y value on the map
+        // which is used to find the color of the pixel.
 
-    Texture2D blank{ "assets/sprites/blank.png", true, GL_NEAREST };
-    renderer.textureIDs.push_back(blank.ID);
-    Game::main.textureMap.emplace("blank", &blank);
+        Texture2D blank{ "assets/sprites/blank.png", true, GL_NEAREST };
+        renderer.textureIDs.push_back(blank.ID);
+        Game::main.textureMap.emplace("blank", &blank);
 
-    Texture2D blankMap{ "assets/sprites/blank_map.png", true, GL_NEAREST };
-    renderer.textureIDs.push_back(blankMap.ID);
-    Game::main.textureMap.emplace("base_map", &blankMap);
+        Texture2D blankMap{ "assets/sprites/blank_map.png", true, GL_NEAREST };
+        renderer.textureIDs.push_back(blankMap.ID);
+        Game::main.textureMap.emplace("base_map", &blankMap);
 
-    Texture2D watermark{ "assets/sprites/watermark/watermark.png", true, GL_NEAREST };
-    renderer.textureIDs.push_back(watermark.ID);
-    Game::main.textureMap.emplace("watermark", &watermark);
+        Texture2D watermark{ "assets/sprites/watermark/watermark.png", true, GL_NEAREST };
+        renderer.textureIDs.push_back(watermark.ID);
+        Game::main.textureMap.emplace("watermark", &watermark);
 
-    Texture2D watermarkMap{ "assets/sprites/watermark/watermark_map.png", true, GL_NEAREST };
-    renderer.textureIDs.push_back(watermarkMap.ID);
-    Game::main.textureMap.emplace("watermarkMap", &watermarkMap);
+        Texture2D watermarkMap{ "assets/sprites/watermark/watermark_map.png", true, GL_NEAREST };
+        renderer.textureIDs.push_back(watermarkMap.ID);
+        Game::main.textureMap.emplace("watermarkMap", &watermarkMap);
 
-    Game::main.renderer = &renderer;
-    #pragma endregion
+        Game::main.renderer = &renderer;
 
-    #pragma region Game Loop
-    // This is the loop where the game runs, duh.
-    // Everything that should happen each frame should occur here,
-    // or nested somewhere within methods called in here.
-    double lastTime = glfwGetTime();
-    int frameCount = 0;
+        // After the textures, since elements refer to them by name.
+        ParticleEngine::main.LoadElements("assets/particles/elements.txt");
 
-    float checkedTime = glfwGetTime();
-    float elapsedTime = 0.0f;
+        FrameCapture capture;
 
-    bool fullscreen = false;
-    float lastChange = glfwGetTime();
+        for (int i = 1; i + 1 < argc; i++)
+        {
+            if (std::string(argv[i]) == "--capture" && capture.Open(argv[i + 1]))
+            {
+                renderer.capture = &capture;
+                renderer.particles.keepCopy = true;
+            }
+        }
 
-    bool slowTime = false;
-    float slowLastChange = glfwGetTime();
+        // The stats overlay; F3 shows and hides it.
+        Console stats{ 56, 6, "assets/sprites/console/glyphs.png" };
+        stats.x = 8.0f;
+        stats.y = 8.0f;
+        stats.visible = false;
+        #pragma endregion
 
-    bool limitFPS = false;
-    int fps = 60;
-    const int ms = (int)(1000 * (1.0f / (fps * 2.0f)));
-    auto start = std::chrono::steady_clock::now();
+        #pragma region Game Loop
+        // This is the loop where the game runs, duh.
+        // Everything that should happen each frame should occur here,
+        // or nested somewhere within methods called in here.
+        double lastTime = glfwGetTime();
+        int frameCount = 0;
 
-    while (!glfwWindowShouldClose(window))
-    {
-        #pragma region Elapsed Time
+        float checkedTime = glfwGetTime();
+        float elapsedTime = 0.0f;
 
-        float deltaTime = glfwGetTime() - checkedTime;
-        // std::cout << "Delta Time: " + std::to_string(deltaTime) + "\n";
-        checkedTime = glfwGetTime();
+        bool fullscreen = false;
+        float lastChange = glfwGetTime();
 
-        #pragma endregion
+        bool slowTime = false;
+        float slowLastChange = glfwGetTime();
 
-        #pragma region FPS
-        double currentTime = glfwGetTime();
-        frameCount++;
+        float statsLastChange = glfwGetTime();
 
-        auto now = std::chrono::steady_clock::now();
-        auto diff = now - start;
-        auto end = now + std::chrono::milliseconds(ms);
+        bool limitFPS = false;
+        int fps = 60;
+        const int ms = (int)(1000 * (1.0f / (fps * 2.0f)));
+        auto start = std::chrono::steady_clock::now();
 
-        // If a second has passed.
-        if (diff >= std::chrono::seconds(1))
+        while (!glfwWindowShouldClose(window))
         {
-            start = now;
-            // Display the frame count here any way you want.
-            std::cout << "Frame Count: " + std::to_string(frameCount) + "\n";
+            #pragma region Elapsed Time
 
-            frameCount = 0;
-            lastTime = currentTime;
-        }
+            float deltaTime = glfwGetTime() - checkedTime;
+            // std::cout << "Delta Time: " + std::to_string(deltaTime) + "\n";
+            checkedTime = glfwGetTime();
 
-        #pragma endregion
+            #pragma endregion
 
-        #pragma region Update Worldview
+            #pragma region FPS
+            double currentTime = glfwGetTime();
+            frameCount++;
 
-        int w, h;
-        glfwGetWindowSize(window, &w, &h);
+            auto now = std::chrono::steady_clock::now();
+            auto diff = now - start;
+            auto end = now + std::chrono::milliseconds(ms);
 
-        Game::main.windowWidth = w;
-        Game::main.windowHeight = h;
+            // If a second has passed.
+            if (diff >= std::chrono::seconds(1))
+            {
+                start = now;
+                // Display the frame count here any way you want.
+                StreamBuffer& stream = Game::main.renderer->stream;
+                const std::string lines[] = {
+                    "Frame Count: " + std::to_string(frameCount),
+                    "Uploaded: " + std::to_string(stream.windowBytes / 1024) + " KB, Stalls: " + std::to_string(stream.windowStalls),
+                    "Palette cache: " + std::to_string(PaletteCache::main.Size()) + " baked, " + std::to_string(PaletteCache::main.bakedThisWindow) + " new, " + std::to_string(PaletteCache::main.hitsThisWindow) + " hits",
+                    "Static chunks: " + std::to_string(StaticLayer::main.visibleChunks) + " visible",
+                    "Particles: " + std::to_string(ParticleEngine::main.particles.count) + " / " + std::to_string(ParticleEngine::main.particles.Capacity()) + ", peak " + std::to_string(ParticleEngine::main.particles.peak) + ", dropped " + std::to_string(ParticleEngine::main.particles.dropped),
+                    "  drawn " + std::to_string(ParticleEngine::main.visible) + ", " + std::to_string(ParticleEngine::main.clusters) + " clusters, throttled " + std::to_string(ParticleEngine::main.throttled)
+                };
+
+                for (int i = 0; i < stats.rows; i++)
+                {
+                    std::cout << lines[i] + "\n";
+
+                    // Padded out to the full width so whatever was there before gets overwritten.
+                    std::string line = lines[i];
+                    line.resize(stats.cols, ' ');
+                    stats.Print(0, i, line, Console::Color(1.0f, 1.0f, 1.0f), Console::Color(0.0f, 0.0f, 0.0f, 0.6f));
+                }
+
+                stream.ResetCounters();
+                PaletteCache::main.ResetCounters();
+
+                frameCount = 0;
+                lastTime = currentTime;
+            }
 
-        if (glfwGetKey(window, GLFW_KEY_F11) == GLFW_PRESS && glfwGetTime() > lastChange + 0.5f)
-        {
-            lastChange = glfwGetTime();
+            #pragma endregion
+
+            #pragma region Update Worldview
 
-            if (fullscreen)
+            int w, h;
+            glfwGetWindowSize(window, &w, &h);
+
+            Game::main.windowWidth = w;
+            Game::main.windowHeight = h;
+
+            if (glfwGetKey(window, GLFW_KEY_F11) == GLFW_PRESS && glfwGetTime() > lastChange + 0.5f)
             {
-                fullscreen = false;
-                glfwSetWindowMonitor(window, NULL, 0, 0, 1280, 960, GLFW_REFRESH_RATE);
+                lastChange = glfwGetTime();
+
+                if (fullscreen)
+                {
+                    fullscreen = false;
+                    glfwSetWindowMonitor(window, NULL, 0, 0, 1280, 960, GLFW_REFRESH_RATE);
+                }
+                else
+                {
+                    fullscreen = true;
+                    glfwSetWindowMonitor(window, glfwGetPrimaryMonitor(), 0, 0, 1920, 1080, GLFW_REFRESH_RATE);
+                }
             }
-            else
+
+            // Here, we make sure the camera is oriented correctly.
+            glm::vec3 cam = glm::vec3(Game::main.camX, Game::main.camY, Game::main.camZ);
+            glm::vec3 center = cam + glm::vec3(0.0f, 0.0f, -1.0f);
+            glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+            Game::main.view = glm::lookAt(cam, center, up);
+
+            // Here we manage the game window and view.
+            const float halfWindowHeight = Game::main.windowHeight * Game::main.zoom * 0.5f;
+            const float halfWindowWidth = Game::main.windowWidth * Game::main.zoom * 0.5f;
+            Game::main.topY = Game::main.camY + halfWindowHeight;
+            Game::main.bottomY = Game::main.camY - halfWindowHeight;
+            Game::main.rightX = Game::main.camX + halfWindowWidth;
+            Game::main.leftX = Game::main.camX - halfWindowWidth;
+            #pragma endregion
+
+            #pragma region Input
+            double mPosX;
+            double mPosY;
+            glfwGetCursorPos(window, &mPosX, &mPosY);
+
+            const double xNDC = (mPosX / (Game::main.windowWidth / 2.0f)) - 1.0f;
+            const double yNDC = 1.0f - (mPosY / (Game::main.windowHeight / 2.0f));
+            glm::mat4 VP = Game::main.projection * Game::main.view;
+            glm::mat4 VPinv = glm::inverse(VP);
+            glm::vec4 mouseClip = glm::vec4((float)xNDC, (float)yNDC, 1.0f, 1.0f);
+            glm::vec4 worldMouse = VPinv * mouseClip;
+            Game::main.deltaMouseX = worldMouse.x - Game::main.mouseX;
+            Game::main.deltaMouseY = worldMouse.y - Game::main.mouseY;
+            Game::main.mouseX = worldMouse.x;
+            Game::main.mouseY = worldMouse.y;
+
+            if (glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS && glfwGetTime() > statsLastChange + 0.5f)
             {
-                fullscreen = true;
-                glfwSetWindowMonitor(window, glfwGetPrimaryMonitor(), 0, 0, 1920, 1080, GLFW_REFRESH_RATE);
+                statsLastChange = glfwGetTime();
+                stats.visible = !stats.visible;
             }
-        }
 
-        // Here, we make sure the camera is oriented correctly.
-        glm::vec3 cam = glm::vec3(Game::main.camX, Game::main.camY, Game::main.camZ);
-        glm::vec3 center = cam + glm::vec3(0.0f, 0.0f, -1.0f);
-        glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
-        Game::main.view = glm::lookAt(cam, center, up);
-
-        // Here we manage the game window and view.
-        const float halfWindowHeight = Game::main.windowHeight * Game::main.zoom * 0.5f;
-        const float halfWindowWidth = Game::main.windowWidth * Game::main.zoom * 0.5f;
-        Game::main.topY = Game::main.camY + halfWindowHeight;
-        Game::main.bottomY = Game::main.camY - halfWindowHeight;
-        Game::main.rightX = Game::main.camX + halfWindowWidth;
-        Game::main.leftX = Game::main.camX - halfWindowWidth;
-        #pragma endregion
-
-        #pragma region Input
-        double mPosX;
-        double mPosY;
-        glfwGetCursorPos(window, &mPosX, &mPosY);
-
-        const double xNDC = (mPosX / (Game::main.windowWidth / 2.0f)) - 1.0f;
-        const double yNDC = 1.0f - (mPosY / (Game::main.windowHeight / 2.0f));
-        glm::mat4 VP = Game::main.projection * Game::main.view;
-        glm::mat4 VPinv = glm::inverse(VP);
-        glm::vec4 mouseClip = glm::vec4((float)xNDC, (float)yNDC, 1.0f, 1.0f);
-        glm::vec4 worldMouse = VPinv * mouseClip;
-        Game::main.deltaMouseX = worldMouse.x - Game::main.mouseX;
-        Game::main.deltaMouseY = worldMouse.y - Game::main.mouseY;
-        Game::main.mouseX = worldMouse.x;
-        Game::main.mouseY = worldMouse.y;
-
-        if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        {
-            glfwSetWindowShouldClose(window, true);
-        }
+            if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+            {
+                glfwSetWindowShouldClose(window, true);
+            }
 
-        if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS)
-        {
-            if (Game::main.zoom - 5.0f * deltaTime > 0.1f)
+            if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS)
             {
-                Game::main.zoom -= 5.0f * deltaTime;
+                if (Game::main.zoom - 5.0f * deltaTime > 0.1f)
+                {
+                    Game::main.zoom -= 5.0f * deltaTime;
 
-                Game::main.updateOrtho();
+                    Game::main.updateOrtho();
+                }
             }
-        }
-        else if (glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS)
-        {
-            if (Game::main.zoom + 5.0f * deltaTime < 2.5f)
+            else if (glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS)
             {
-                Game::main.zoom += 5.0f * deltaTime;
+                if (Game::main.zoom + 5.0f * deltaTime < 2.5f)
+                {
+                    Game::main.zoom += 5.0f * deltaTime;
 
-                Game::main.updateOrtho();
+                    Game::main.updateOrtho();
+                }
             }
-        }
-
-        #pragma endregion
 
-        #pragma region GL Color & Clear
-        // Here we update the background color.
-        // We want it black for now, so that's what it is.
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        #pragma endregion
+            #pragma endregion
 
-        #pragma region Update World State
+            #pragma region GL Color & Clear
+            // Here we update the background color.
+            // We want it black for now, so that's what it is.
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            #pragma endregion
 
-        if (glfwGetKey(window, GLFW_KEY_TAB) == GLFW_PRESS && glfwGetTime() > slowLastChange + 0.5f)
-        {
-            slowLastChange = glfwGetTime();
+            #pragma region Update World State
 
-            if (!slowTime)
+            if (glfwGetKey(window, GLFW_KEY_TAB) == GLFW_PRESS && glfwGetTime() > slowLastChange + 0.5f)
             {
-                slowTime = true;
+                slowLastChange = glfwGetTime();
+
+                if (!slowTime)
+                {
+                    slowTime = true;
+                }
+                else
+                {
+                    slowTime = false;
+                }
             }
-            else
+
+            if (slowTime)
             {
-                slowTime = false;
+                deltaTime *= 0.5f;
             }
-        }
 
-        if (slowTime)
-        {
-            deltaTime *= 0.5f;
-        }
+            int focus = glfwGetWindowAttrib(window, GLFW_FOCUSED);
 
-        int focus = glfwGetWindowAttrib(window, GLFW_FOCUSED);
+            if (focus && !windowMoved)
+            {
+                ECS::main.Update(deltaTime);
+                ParticleEngine::main.Update(deltaTime);
+            }
+            #pragma endregion;
 
-        if (focus && !windowMoved)
-        {
-            ECS::main.Update(deltaTime);
-            ParticleEngine::main.Update(deltaTime);
-        }
-        #pragma endregion;
+            #pragma region Render
+            // This is where we finally render and reset buffers.
+            Game::main.renderer->sendToGL();
+            UILayer::main.Composite();
+            stats.Draw();
+            Game::main.renderer->resetBuffers();
 
-        #pragma region Render
-        // This is where we finally render and reset buffers.
-        Game::main.renderer->sendToGL();
-        Game::main.renderer->resetBuffers();
+            if (limitFPS)
+            {
+                std::this_thread::sleep_until(end);
+            }
+            glfwSwapBuffers(window);
 
-        if (limitFPS)
-        {
-            std::this_thread::sleep_until(end);
+            windowMoved = 0;
+            glfwPollEvents();
+            glCheckError();
+            #pragma endregion
         }
-        glfwSwapBuffers(window);
-
-        windowMoved = 0;
-        glfwPollEvents();
-        glCheckError();
         #pragma endregion
+
+        // These pointed at things that are about to go.
+        Game::main.renderer = nullptr;
+        Game::main.textureMap.clear();
     }
-    #pragma endregion
 
     #pragma region Shutdown
     delete whiteTexture;
 
+    ThreadPool::main.Stop();
     glfwTerminate();
     return 0;
     #pragma endregion
@@ -0,0 +1,230 @@
+#include "palette_cache.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "check_error.h"
+
+// See palette_cache.h. Baking does on the CPU exactly what quad.frag does per pixel, just once per
+// texel of the sprite instead of once per pixel on screen: the sprite's red and green (times the
+// modifiers) give a coordinate on the map, which repeats, and whatever's there is the final color.
+
+size_t PaletteCache::KeyHash::operator()(const Key& key) const
+{
+    uint32_t w;
+    uint32_t h;
+    std::memcpy(&w, &key.widthMod, sizeof(w));
+    std::memcpy(&h, &key.heightMod, sizeof(h));
+
+    size_t hash = key.texture;
+    hash = hash * 31 + key.map;
+    hash = hash * 31 + w;
+    hash = hash * 31 + h;
+    return hash;
+}
+
+void PaletteCache::BeginFrame()
+{
+    frame++;
+    bakesLeft = BAKES_PER_FRAME;
+
+    // Pairs that are only ever asked for now and then could pile up in here forever otherwise.
+    if (uses.size() > 4096)
+    {
+        uses.clear();
+    }
+}
+
+void PaletteCache::ResetCounters()
+{
+    bakedThisWindow = 0;
+    hitsThisWindow = 0;
+}
+
+GLuint PaletteCache::Find(const Key& key)
+{
+    auto found = lookup.find(key);
+
+    if (found == lookup.end())
+    {
+        return 0;
+    }
+
+    // Move it to the front, since it's now the most recently used.
+    entries.splice(entries.begin(), entries, found->second);
+    found->second->lastUsedFrame = frame;
+    hitsThisWindow++;
+    return found->second->baked;
+}
+
+GLuint PaletteCache::Resolve(GLuint texture, GLuint map, float widthMod, float heightMod)
+{
+    if (!enabled || texture == map)
+    {
+        return 0;
+    }
+
+    const Key key = { texture, map, widthMod, heightMod };
+    const GLuint baked = Find(key);
+
+    if (baked != 0)
+    {
+        return baked;
+    }
+
+    int& count = uses[key];
+    count++;
+
+    if (count < USES_BEFORE_BAKE || bakesLeft <= 0)
+    {
+        return 0;
+    }
+
+    uses.erase(key);
+    return Bake(key);
+}
+
+GLuint PaletteCache::Acquire(GLuint texture, GLuint map, float widthMod, float heightMod)
+{
+    if (!enabled || texture == map)
+    {
+        return 0;
+    }
+
+    const Key key = { texture, map, widthMod, heightMod };
+    GLuint baked = Find(key);
+
+    if (baked == 0)
+    {
+        baked = Bake(key);
+    }
+
+    if (baked != 0)
+    {
+        byTexture[baked]->pins++;
+    }
+
+    return baked;
+}
+
+void PaletteCache::Release(GLuint baked)
+{
+    auto found = byTexture.find(baked);
+
+    if (found != byTexture.end() && found->second->pins > 0)
+    {
+        found->second->pins--;
+    }
+}
+
+bool PaletteCache::MakeRoom(size_t bytes)
+{
+    // Work back from the least recently used, skipping anything that's pinned or that's
+    // already been handed out this frame (and so is about to be drawn with).
+    auto it = entries.end();
+
+    while ((static_cast<int>(entries.size()) >= MAX_ENTRIES || totalBytes + bytes > MAX_BYTES) && it != entries.begin())
+    {
+        --it;
+
+        if (it->pins > 0 || it->lastUsedFrame == frame)
+        {
+            continue;
+        }
+
+        glDeleteTextures(1, &it->baked);
+        totalBytes -= it->bytes;
+        lookup.erase(it->key);
+        byTexture.erase(it->baked);
+        it = entries.erase(it);
+    }
+
+    return static_cast<int>(entries.size()) < MAX_ENTRIES && totalBytes + bytes <= MAX_BYTES;
+}
+
+GLuint PaletteCache::Bake(const Key& key)
+{
+    GLint spriteWidth = 0, spriteHeight = 0, mapWidth = 0, mapHeight = 0;
+    GLint minFilter = GL_NEAREST, magFilter = GL_NEAREST;
+
+    GLint mapMinFilter = 0, mapMagFilter = 0, mapWrapS = 0, mapWrapT = 0;
+
+    glBindTexture(GL_TEXTURE_2D, key.map);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &mapWidth);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &mapHeight);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &mapMinFilter);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &mapMagFilter);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, &mapWrapS);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, &mapWrapT);
+
+    // The bake below only knows how to sample the map the way nearest and repeat would. quad.frag samples it
+    // however the map says to, so for anything else (like Texture2D's default of GL_LINEAR) the two would
+    // come out different colors; those pairs just don't get baked.
+    if (mapMinFilter != GL_NEAREST || mapMagFilter != GL_NEAREST || mapWrapS != GL_REPEAT || mapWrapT != GL_REPEAT)
+    {
+        return 0;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, key.texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &spriteWidth);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &spriteHeight);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &minFilter);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &magFilter);
+
+    if (spriteWidth <= 0 || spriteHeight <= 0 || mapWidth <= 0 || mapHeight <= 0)
+    {
+        return 0;
+    }
+
+    const size_t bytes = static_cast<size_t>(spriteWidth) * spriteHeight * 4;
+
+    if (!MakeRoom(bytes))
+    {
+        return 0;
+    }
+
+    bakesLeft--;
+    bakedThisWindow++;
+
+    std::vector<unsigned char> sprite(bytes);
+    std::vector<unsigned char> map(static_cast<size_t>(mapWidth) * mapHeight * 4);
+    std::vector<unsigned char> result(bytes);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, sprite.data());
+    glBindTexture(GL_TEXTURE_2D, key.map);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, map.data());
+
+    for (size_t i = 0; i < bytes; i += 4)
+    {
+        // The same sum as quad.frag, sampling the map as GL_REPEAT and nearest.
+        const float u = (sprite[i + 0] / 255.0f) * key.widthMod;
+        const float v = (sprite[i + 1] / 255.0f) * key.heightMod;
+
+        int mx = static_cast<int>((u - std::floor(u)) * mapWidth);
+        int my = static_cast<int>((v - std::floor(v)) * mapHeight);
+        mx = mx < 0 ? 0 : (mx >= mapWidth ? mapWidth - 1 : mx);
+        my = my < 0 ? 0 : (my >= mapHeight ? mapHeight - 1 : my);
+
+        std::memcpy(&result[i], &map[(static_cast<size_t>(my) * mapWidth + mx) * 4], 4);
+    }
+
+    GLuint baked;
+    glGenTextures(1, &baked);
+    glBindTexture(GL_TEXTURE_2D, baked);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, spriteWidth, spriteHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, result.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glCheckError();
+
+    entries.push_front({ key, baked, bytes, 0, frame });
+    lookup[key] = entries.begin();
+    byTexture[baked] = entries.begin();
+    totalBytes += bytes;
+
+    return baked;
+}
@@ -0,0 +1,101 @@
+#ifndef PALETTE_CACHE_H
+#define PALETTE_CACHE_H
+
+// Every sprite is drawn by looking up its own texture, turning that texel's red and green into a
+// coordinate on its map, and then looking up the map; two texture reads per pixel, one depending on
+// the other, which is a lot to ask of an integrated GPU when the camera's zoomed out. But a sprite
+// drawn with the same map at the same size always comes out the same, so for the pairs we see a lot
+// the palette cache works the final colors out once (on the CPU) and keeps them as a texture of their
+// own. Quads using one of those get a map slot of -1, which tells quad.frag to do a single read.
+//
+// Baked textures are keyed on the sprite, the map and the two modifiers that go into the map lookup
+// (see Renderer::CalculateModifier()), since those change which part of the map gets used. Only maps
+// sampled nearest and repeating get baked, since that's the only lookup the bake knows how to copy.
+// There's a cap on how many we keep; the least recently used go first, except ones drawn this frame
+// or held onto by a retained mesh (see Acquire()).
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <glad/glad.h>
+
+class PaletteCache
+{
+public:
+    static PaletteCache main;
+
+    // How many baked textures (and how many of their bytes) we keep at most.
+    static constexpr int MAX_ENTRIES = 128;
+    static constexpr size_t MAX_BYTES = 32 * 1024 * 1024;
+
+    // A pair has to be asked for this many times before it's worth baking,
+    // and we don't bake more than this many per frame (each one means reading textures back).
+    static constexpr int USES_BEFORE_BAKE = 16;
+    static constexpr int BAKES_PER_FRAME = 2;
+
+    bool enabled = true;
+
+    // For the stats printout.
+    int bakedThisWindow = 0;
+    int hitsThisWindow = 0;
+
+    void BeginFrame();
+
+    // Returns the baked texture for this pair if there is one (or if it's time to make one), otherwise 0,
+    // in which case draw it the usual way. Only good for this frame.
+    GLuint Resolve(GLuint texture, GLuint map, float widthMod, float heightMod);
+
+    // Like Resolve(), but bakes straight away (if there's room) and keeps the result around until it's Release()'d.
+    GLuint Acquire(GLuint texture, GLuint map, float widthMod, float heightMod);
+    void Release(GLuint baked);
+
+    int Size() const { return static_cast<int>(entries.size()); }
+    void ResetCounters();
+
+private:
+    struct Key
+    {
+        GLuint texture;
+        GLuint map;
+        float widthMod;
+        float heightMod;
+
+        bool operator==(const Key& other) const
+        {
+            return texture == other.texture && map == other.map && widthMod == other.widthMod && heightMod == other.heightMod;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Entry
+    {
+        Key key;
+        GLuint baked;
+        size_t bytes;
+        int pins;
+        uint64_t lastUsedFrame;
+    };
+
+    // Front is most recently used.
+    std::list<Entry> entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> lookup;
+    std::unordered_map<GLuint, std::list<Entry>::iterator> byTexture;
+
+    // How often we've been asked about pairs that haven't been baked yet.
+    std::unordered_map<Key, int, KeyHash> uses;
+
+    uint64_t frame = 0;
+    int bakesLeft = BAKES_PER_FRAME;
+    size_t totalBytes = 0;
+
+    GLuint Find(const Key& key);
+    GLuint Bake(const Key& key);
+    bool MakeRoom(size_t bytes);
+};
+
+#endif
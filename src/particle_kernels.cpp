@@ -0,0 +1,586 @@
+#include "particle_kernels.h"
+
+#include <cmath>
+#include <cstring>
+#include "rng.h"
+
+#if PARTICLE_KERNELS_SSE
+#include <emmintrin.h>
+#endif
+
+#if PARTICLE_KERNELS_AVX2
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+// See particle_kernels.h. Each roll is one step of the lane's xorshift generator, and every version
+// turns its bits into numbers the same way, using nothing but shifts, one small multiply and float adds:
+//
+//     roll  = ((bits >> 17) * 100 >> 15) + 1     the top 15 bits scaled down to 1..100
+//     shade = float(0x3F800000 | bits >> 9) - 1  the top 23 bits as the fraction of a float in [1, 2), less one
+//
+// and every version does the movement as x += ((r > right ? step : 0) - (left < r <= right ? step : 0)) * ticksPerStep
+// and y += (rise + (r < vertical ? verticalStep : 0)) * ticksPerStep, so they all round the same way too.
+
+#pragma region Scalar
+
+static inline uint32_t Next(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static inline float Roll(uint32_t bits)
+{
+    return static_cast<float>((((bits >> 17) * 100) >> 15) + 1);
+}
+
+static inline float Unit(uint32_t bits)
+{
+    const uint32_t pattern = 0x3F800000u | (bits >> 9);
+    float value;
+    std::memcpy(&value, &pattern, sizeof(value));
+    return value - 1.0f;
+}
+
+void ParticleKernels::Rng::Seed(RandomStream& source)
+{
+    source.Fill(lanes, LANES);
+
+    // Xorshift gets stuck on zero, so steer clear of it.
+    for (uint32_t& lane : lanes)
+    {
+        lane |= 1u;
+    }
+}
+
+// Particles begin through end, one at a time; particle i uses lane i % LANES, same as in the wide versions.
+static void StepRange(int begin, int end, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, ParticleKernels::Rng& rng, int ticksPerStep)
+{
+    const float scale = static_cast<float>(ticksPerStep);
+
+    for (int i = begin; i < end; i++)
+    {
+        uint32_t& state = rng.lanes[i % ParticleKernels::LANES];
+        const float r = Roll(Next(state));
+        const float rolled = Unit(Next(state));
+        const int e = element[i];
+
+        const bool right = r > table.right[e];
+        const bool left = !right && r > table.left[e];
+        const bool vertical = r < table.vertical[e];
+
+        x[i] += ((right ? table.step[e] : 0.0f) - (left ? table.step[e] : 0.0f)) * scale;
+        y[i] += (table.rise[e] + (vertical ? table.verticalStep[e] : 0.0f)) * scale;
+        ticks[i] += ticksPerStep;
+        shade[i] = rolled;
+    }
+}
+
+static void ShadeRange(int begin, int end, float* shade, ParticleKernels::Rng& rng)
+{
+    for (int i = begin; i < end; i++)
+    {
+        shade[i] = Unit(Next(rng.lanes[i % ParticleKernels::LANES]));
+    }
+}
+
+void ParticleKernels::StepScalar(int count, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, Rng& rng, int ticksPerStep)
+{
+    StepRange(0, count, x, y, element, ticks, shade, table, rng, ticksPerStep);
+}
+
+void ParticleKernels::ShadeScalar(int count, float* shade, Rng& rng)
+{
+    ShadeRange(0, count, shade, rng);
+}
+
+#pragma endregion
+
+#pragma region Occupancy
+
+void OccupancyGrid::Resize(int width, int height, float cellSize, float originX, float originY)
+{
+    this->width = width;
+    this->height = height;
+    this->cellSize = cellSize;
+    this->originX = originX;
+    this->originY = originY;
+
+    stride = (width + 31) / 32;
+    blocked = 0;
+    words.assign(static_cast<size_t>(stride) * height, 0u);
+}
+
+void OccupancyGrid::Set(int cx, int cy, bool solid)
+{
+    if (cx < 0 || cx >= width || cy < 0 || cy >= height)
+    {
+        return;
+    }
+
+    uint32_t& word = words[cy * stride + (cx >> 5)];
+    const uint32_t bit = 1u << (cx & 31);
+
+    if (((word & bit) != 0) != solid)
+    {
+        word ^= bit;
+        blocked += solid ? 1 : -1;
+    }
+}
+
+bool OccupancyGrid::Blocked(float x, float y) const
+{
+    // The comparisons are done on the floats, before they're turned into ints, so NaNs and huge numbers come out open too.
+    const float fx = std::floor((x - originX) / cellSize);
+    const float fy = std::floor((y - originY) / cellSize);
+
+    if (!(fx >= 0.0f && fx < static_cast<float>(width) && fy >= 0.0f && fy < static_cast<float>(height)))
+    {
+        return false;
+    }
+
+    const int cx = static_cast<int>(fx);
+    const int cy = static_cast<int>(fy);
+    return ((words[cy * stride + (cx >> 5)] >> (cx & 31)) & 1u) != 0;
+}
+
+// Particles begin through end, one at a time. The wide version works everything out for every particle and then picks,
+// where this only works out what it needs, but the arithmetic for each result is the same.
+static void CollideRange(int begin, int end, const float* prevX, const float* prevY, float* x, float* y, const int32_t* element, int32_t* ticks, const int32_t* lifetime, const ElementTable& table, const OccupancyGrid& grid)
+{
+    for (int i = begin; i < end; i++)
+    {
+        const Collision response = static_cast<Collision>(table.collide[element[i]]);
+
+        if (response == Collision::pass || !grid.Blocked(x[i], y[i]))
+        {
+            continue;
+        }
+
+        const float px = prevX[i];
+        const float py = prevY[i];
+        const float nx = x[i];
+        const float ny = y[i];
+
+        float outX = px;
+        float outY = py;
+
+        if (response == Collision::bounce)
+        {
+            const bool hitX = grid.Blocked(nx, py);
+            const bool hitY = grid.Blocked(px, ny);
+
+            outX = hitX || !hitY ? px - (nx - px) : nx;
+            outY = hitY || !hitX ? py - (ny - py) : ny;
+
+            if (grid.Blocked(outX, outY))
+            {
+                outX = px;
+                outY = py;
+            }
+        }
+        else if (response == Collision::die)
+        {
+            ticks[i] = lifetime[i] + 1;
+        }
+
+        x[i] = outX;
+        y[i] = outY;
+    }
+}
+
+void ParticleKernels::CollideScalar(int count, const float* prevX, const float* prevY, float* x, float* y, const int32_t* element, int32_t* ticks, const int32_t* lifetime, const ElementTable& table, const OccupancyGrid& grid)
+{
+    CollideRange(0, count, prevX, prevY, x, y, element, ticks, lifetime, table, grid);
+}
+
+#pragma endregion
+
+#pragma region Dispatch
+
+#if PARTICLE_KERNELS_AVX2
+static bool DetectAVX2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    // AVX2 itself, plus the OS saving the ymm registers for us (which is what OSXSAVE and XGETBV are about).
+    int info[4];
+    __cpuid(info, 0);
+
+    if (info[0] < 7)
+    {
+        return false;
+    }
+
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+bool ParticleKernels::HasAVX2()
+{
+#if PARTICLE_KERNELS_AVX2
+    static const bool has = DetectAVX2();
+    return has;
+#else
+    return false;
+#endif
+}
+
+void ParticleKernels::Step(int count, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, Rng& rng, int ticksPerStep)
+{
+    if (HasAVX2())
+    {
+        StepAVX2(count, x, y, element, ticks, shade, table, rng, ticksPerStep);
+    }
+    else
+    {
+        StepSSE2(count, x, y, element, ticks, shade, table, rng, ticksPerStep);
+    }
+}
+
+void ParticleKernels::Shade(int count, float* shade, Rng& rng)
+{
+    if (HasAVX2())
+    {
+        ShadeAVX2(count, shade, rng);
+    }
+    else
+    {
+        ShadeSSE2(count, shade, rng);
+    }
+}
+
+void ParticleKernels::Collide(int count, const float* prevX, const float* prevY, float* x, float* y, const int32_t* element, int32_t* ticks, const int32_t* lifetime, const ElementTable& table, const OccupancyGrid& grid)
+{
+    if (grid.blocked == 0)
+    {
+        return;
+    }
+
+    if (HasAVX2())
+    {
+        CollideAVX2(count, prevX, prevY, x, y, element, ticks, lifetime, table, grid);
+    }
+    else
+    {
+        CollideScalar(count, prevX, prevY, x, y, element, ticks, lifetime, table, grid);
+    }
+}
+
+#pragma endregion
+
+#pragma region SSE2
+
+#if PARTICLE_KERNELS_SSE
+
+static inline __m128i Next(__m128i& state)
+{
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+    state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+    return state;
+}
+
+static inline __m128 Roll(__m128i bits)
+{
+    // The top 15 bits sit in the bottom half of each 32-bit lane with zeros above, so multiplying 16-bit
+    // pairs and adding them up (all SSE2 has for 32-bit lanes) gives exactly bits * 100.
+    const __m128i scaled = _mm_madd_epi16(_mm_srli_epi32(bits, 17), _mm_set1_epi32(100));
+    return _mm_cvtepi32_ps(_mm_add_epi32(_mm_srli_epi32(scaled, 15), _mm_set1_epi32(1)));
+}
+
+static inline __m128 Unit(__m128i bits)
+{
+    const __m128i pattern = _mm_or_si128(_mm_srli_epi32(bits, 9), _mm_set1_epi32(0x3F800000));
+    return _mm_sub_ps(_mm_castsi128_ps(pattern), _mm_set1_ps(1.0f));
+}
+
+// SSE2 can't gather, so the table lookups are four loads apiece.
+static inline __m128 Lookup(const float* column, const int32_t* element)
+{
+    return _mm_set_ps(column[element[3]], column[element[2]], column[element[1]], column[element[0]]);
+}
+
+static inline void StepFour(int i, __m128i& state, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, __m128 scale, __m128i age)
+{
+    const __m128 r = Roll(Next(state));
+    const __m128 rolled = Unit(Next(state));
+    const int32_t* e = element + i;
+
+    const __m128 step = Lookup(table.step, e);
+    const __m128 right = _mm_cmpgt_ps(r, Lookup(table.right, e));
+    const __m128 left = _mm_andnot_ps(right, _mm_cmpgt_ps(r, Lookup(table.left, e)));
+    const __m128 vertical = _mm_cmplt_ps(r, Lookup(table.vertical, e));
+
+    const __m128 dx = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(right, step), _mm_and_ps(left, step)), scale);
+    const __m128 dy = _mm_mul_ps(_mm_add_ps(Lookup(table.rise, e), _mm_and_ps(vertical, Lookup(table.verticalStep, e))), scale);
+
+    _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), dx));
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), dy));
+
+    __m128i* t = reinterpret_cast<__m128i*>(ticks + i);
+    _mm_storeu_si128(t, _mm_add_epi32(_mm_loadu_si128(t), age));
+
+    _mm_storeu_ps(shade + i, rolled);
+}
+
+void ParticleKernels::StepSSE2(int count, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, Rng& rng, int ticksPerStep)
+{
+    // Lanes 0-3 and 4-7 of the generator, for the first and second four of each eight.
+    __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rng.lanes));
+    __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rng.lanes + 4));
+
+    const __m128 scale = _mm_set1_ps(static_cast<float>(ticksPerStep));
+    const __m128i age = _mm_set1_epi32(ticksPerStep);
+
+    int i = 0;
+
+    for (; i + LANES <= count; i += LANES)
+    {
+        StepFour(i, low, x, y, element, ticks, shade, table, scale, age);
+        StepFour(i + 4, high, x, y, element, ticks, shade, table, scale, age);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rng.lanes), low);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rng.lanes + 4), high);
+
+    // Whatever doesn't fill a group of eight.
+    StepRange(i, count, x, y, element, ticks, shade, table, rng, ticksPerStep);
+}
+
+void ParticleKernels::ShadeSSE2(int count, float* shade, Rng& rng)
+{
+    __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rng.lanes));
+    __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rng.lanes + 4));
+
+    int i = 0;
+
+    for (; i + LANES <= count; i += LANES)
+    {
+        _mm_storeu_ps(shade + i, Unit(Next(low)));
+        _mm_storeu_ps(shade + i + 4, Unit(Next(high)));
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rng.lanes), low);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rng.lanes + 4), high);
+
+    ShadeRange(i, count, shade, rng);
+}
+
+#else
+
+void ParticleKernels::StepSSE2(int count, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, Rng& rng, int ticksPerStep)
+{
+    StepScalar(count, x, y, element, ticks, shade, table, rng, ticksPerStep);
+}
+
+void ParticleKernels::ShadeSSE2(int count, float* shade, Rng& rng)
+{
+    ShadeScalar(count, shade, rng);
+}
+
+#endif
+
+#pragma endregion
+
+#pragma region AVX2
+
+#if PARTICLE_KERNELS_AVX2
+
+// Same as the SSE2 ones above, just eight wide, and with a real gather for the table lookups.
+AVX2_TARGET static inline __m256i Next(__m256i& state)
+{
+    state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+    state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+    state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+    return state;
+}
+
+AVX2_TARGET static inline __m256 Roll(__m256i bits)
+{
+    const __m256i scaled = _mm256_madd_epi16(_mm256_srli_epi32(bits, 17), _mm256_set1_epi32(100));
+    return _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_srli_epi32(scaled, 15), _mm256_set1_epi32(1)));
+}
+
+AVX2_TARGET static inline __m256 Unit(__m256i bits)
+{
+    const __m256i pattern = _mm256_or_si256(_mm256_srli_epi32(bits, 9), _mm256_set1_epi32(0x3F800000));
+    return _mm256_sub_ps(_mm256_castsi256_ps(pattern), _mm256_set1_ps(1.0f));
+}
+
+AVX2_TARGET void ParticleKernels::StepAVX2(int count, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, Rng& rng, int ticksPerStep)
+{
+    __m256i state = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rng.lanes));
+    const __m256 scale = _mm256_set1_ps(static_cast<float>(ticksPerStep));
+    const __m256i age = _mm256_set1_epi32(ticksPerStep);
+
+    int i = 0;
+
+    for (; i + LANES <= count; i += LANES)
+    {
+        const __m256 r = Roll(Next(state));
+        const __m256 rolled = Unit(Next(state));
+        const __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(element + i));
+
+        const __m256 step = _mm256_i32gather_ps(table.step, e, 4);
+        const __m256 right = _mm256_cmp_ps(r, _mm256_i32gather_ps(table.right, e, 4), _CMP_GT_OQ);
+        const __m256 left = _mm256_andnot_ps(right, _mm256_cmp_ps(r, _mm256_i32gather_ps(table.left, e, 4), _CMP_GT_OQ));
+        const __m256 vertical = _mm256_cmp_ps(r, _mm256_i32gather_ps(table.vertical, e, 4), _CMP_LT_OQ);
+
+        const __m256 dx = _mm256_mul_ps(_mm256_sub_ps(_mm256_and_ps(right, step), _mm256_and_ps(left, step)), scale);
+        const __m256 dy = _mm256_mul_ps(_mm256_add_ps(_mm256_i32gather_ps(table.rise, e, 4), _mm256_and_ps(vertical, _mm256_i32gather_ps(table.verticalStep, e, 4))), scale);
+
+        _mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), dx));
+        _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), dy));
+
+        __m256i* t = reinterpret_cast<__m256i*>(ticks + i);
+        _mm256_storeu_si256(t, _mm256_add_epi32(_mm256_loadu_si256(t), age));
+
+        _mm256_storeu_ps(shade + i, rolled);
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(rng.lanes), state);
+
+    StepRange(i, count, x, y, element, ticks, shade, table, rng, ticksPerStep);
+}
+
+AVX2_TARGET void ParticleKernels::ShadeAVX2(int count, float* shade, Rng& rng)
+{
+    __m256i state = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rng.lanes));
+
+    int i = 0;
+
+    for (; i + LANES <= count; i += LANES)
+    {
+        _mm256_storeu_ps(shade + i, Unit(Next(state)));
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(rng.lanes), state);
+
+    ShadeRange(i, count, shade, rng);
+}
+
+// An all-ones lane for every (x, y) in a blocked cell; the same steps as OccupancyGrid::Blocked().
+AVX2_TARGET static inline __m256i Blocked(const OccupancyGrid& grid, __m256 x, __m256 y)
+{
+    const __m256 fx = _mm256_floor_ps(_mm256_div_ps(_mm256_sub_ps(x, _mm256_set1_ps(grid.originX)), _mm256_set1_ps(grid.cellSize)));
+    const __m256 fy = _mm256_floor_ps(_mm256_div_ps(_mm256_sub_ps(y, _mm256_set1_ps(grid.originY)), _mm256_set1_ps(grid.cellSize)));
+    const __m256 zero = _mm256_setzero_ps();
+
+    const __m256 inside = _mm256_and_ps(
+        _mm256_and_ps(_mm256_cmp_ps(fx, zero, _CMP_GE_OQ), _mm256_cmp_ps(fx, _mm256_set1_ps(static_cast<float>(grid.width)), _CMP_LT_OQ)),
+        _mm256_and_ps(_mm256_cmp_ps(fy, zero, _CMP_GE_OQ), _mm256_cmp_ps(fy, _mm256_set1_ps(static_cast<float>(grid.height)), _CMP_LT_OQ)));
+
+    // Lanes outside the grid get cell (0, 0) so they're safe to convert, and don't get gathered anyway.
+    const __m256i cx = _mm256_cvttps_epi32(_mm256_and_ps(fx, inside));
+    const __m256i cy = _mm256_cvttps_epi32(_mm256_and_ps(fy, inside));
+    const __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(cy, _mm256_set1_epi32(grid.stride)), _mm256_srli_epi32(cx, 5));
+
+    const __m256i word = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(grid.words.data()), index, _mm256_castps_si256(inside), 4);
+    const __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(cx, _mm256_set1_epi32(31))), _mm256_set1_epi32(1));
+
+    return _mm256_cmpeq_epi32(bit, _mm256_set1_epi32(1));
+}
+
+AVX2_TARGET void ParticleKernels::CollideAVX2(int count, const float* prevX, const float* prevY, float* x, float* y, const int32_t* element, int32_t* ticks, const int32_t* lifetime, const ElementTable& table, const OccupancyGrid& grid)
+{
+    const __m256i pass = _mm256_set1_epi32(static_cast<int32_t>(Collision::pass));
+    const __m256i bounce = _mm256_set1_epi32(static_cast<int32_t>(Collision::bounce));
+    const __m256i die = _mm256_set1_epi32(static_cast<int32_t>(Collision::die));
+
+    int i = 0;
+
+    for (; i + LANES <= count; i += LANES)
+    {
+        const __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(element + i));
+        const __m256i response = _mm256_i32gather_epi32(table.collide, e, 4);
+        const __m256i cares = _mm256_xor_si256(_mm256_cmpeq_epi32(response, pass), _mm256_set1_epi32(-1));
+
+        // Most of the time nothing's near a wall (or nothing here cares), so skip the rest.
+        if (_mm256_testz_si256(cares, cares))
+        {
+            continue;
+        }
+
+        const __m256 nx = _mm256_loadu_ps(x + i);
+        const __m256 ny = _mm256_loadu_ps(y + i);
+        const __m256i hit = _mm256_and_si256(cares, Blocked(grid, nx, ny));
+
+        if (_mm256_testz_si256(hit, hit))
+        {
+            continue;
+        }
+
+        const __m256 px = _mm256_loadu_ps(prevX + i);
+        const __m256 py = _mm256_loadu_ps(prevY + i);
+
+        const __m256i hitX = Blocked(grid, nx, py);
+        const __m256i hitY = Blocked(grid, px, ny);
+        const __m256i ones = _mm256_set1_epi32(-1);
+        const __m256 reflectX = _mm256_castsi256_ps(_mm256_or_si256(hitX, _mm256_xor_si256(hitY, ones)));
+        const __m256 reflectY = _mm256_castsi256_ps(_mm256_or_si256(hitY, _mm256_xor_si256(hitX, ones)));
+
+        __m256 bx = _mm256_blendv_ps(nx, _mm256_sub_ps(px, _mm256_sub_ps(nx, px)), reflectX);
+        __m256 by = _mm256_blendv_ps(ny, _mm256_sub_ps(py, _mm256_sub_ps(ny, py)), reflectY);
+
+        const __m256 stuck = _mm256_castsi256_ps(Blocked(grid, bx, by));
+        bx = _mm256_blendv_ps(bx, px, stuck);
+        by = _mm256_blendv_ps(by, py, stuck);
+
+        // Anything that hit goes back where it was, except the bouncers, which go where they bounced to.
+        const __m256 bouncing = _mm256_castsi256_ps(_mm256_and_si256(hit, _mm256_cmpeq_epi32(response, bounce)));
+        const __m256 back = _mm256_castsi256_ps(hit);
+
+        _mm256_storeu_ps(x + i, _mm256_blendv_ps(_mm256_blendv_ps(nx, px, back), bx, bouncing));
+        _mm256_storeu_ps(y + i, _mm256_blendv_ps(_mm256_blendv_ps(ny, py, back), by, bouncing));
+
+        const __m256i dying = _mm256_and_si256(hit, _mm256_cmpeq_epi32(response, die));
+        __m256i* t = reinterpret_cast<__m256i*>(ticks + i);
+        const __m256i dead = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(lifetime + i)), _mm256_set1_epi32(1));
+        _mm256_storeu_si256(t, _mm256_blendv_epi8(_mm256_loadu_si256(t), dead, dying));
+    }
+
+    CollideRange(i, count, prevX, prevY, x, y, element, ticks, lifetime, table, grid);
+}
+
+#else
+
+void ParticleKernels::StepAVX2(int count, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, Rng& rng, int ticksPerStep)
+{
+    StepSSE2(count, x, y, element, ticks, shade, table, rng, ticksPerStep);
+}
+
+void ParticleKernels::ShadeAVX2(int count, float* shade, Rng& rng)
+{
+    ShadeSSE2(count, shade, rng);
+}
+
+void ParticleKernels::CollideAVX2(int count, const float* prevX, const float* prevY, float* x, float* y, const int32_t* element, int32_t* ticks, const int32_t* lifetime, const ElementTable& table, const OccupancyGrid& grid)
+{
+    CollideScalar(count, prevX, prevY, x, y, element, ticks, lifetime, table, grid);
+}
+
+#endif
+
+#pragma endregion
@@ -0,0 +1,150 @@
+#ifndef PARTICLE_KERNELS_H
+#define PARTICLE_KERNELS_H
+
+// The particle engine's tick, done for a whole array of particles at once.
+// Every tick each particle rolls a number from 1 to 100 to see which way it drifts, ages by one,
+// and rolls a shade (0 to 1) for its color; Shade() rolls just the shade. How the roll
+// moves it and what the shade does to its color depend on its element, which used to be a chain of ifs
+// and is now a row in an ElementTable, so every particle goes through the same instructions whatever it is.
+//
+// The rolls come from eight xorshift generators side by side, one per lane; particle i always
+// uses lane i % 8. Step() and Shade() run eight particles at a time with AVX2 when the CPU has it
+// (checked once, at runtime), otherwise four at a time (twice over) with SSE2, otherwise one at a
+// time, and since all three use the lanes the same way they give exactly the same results.
+// Nothing in here touches anything but what it's handed, so separate ranges (with separate generators)
+// can be stepped on separate threads.
+// "asciismos --bench particles" races them against each other and against the old rand() loop.
+//
+// Collide() then keeps whatever just stepped out of bounds (a blocked cell of an OccupancyGrid) from going
+// through the walls, doing whatever its element says to (see Collision).
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+class RandomStream;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARTICLE_KERNELS_SSE 1
+#else
+#define PARTICLE_KERNELS_SSE 0
+#endif
+
+// AVX2 gets compiled in wherever we're building for x86-64, whatever the compiler flags say, and only gets used if the CPU says so.
+#if defined(__x86_64__) || defined(_M_X64)
+#define PARTICLE_KERNELS_AVX2 1
+#else
+#define PARTICLE_KERNELS_AVX2 0
+#endif
+
+// What a particle does when a tick takes it into a blocked cell.
+// pass: goes in anyway. stop: stays where it was. die: that was its last tick (and it stays where it was).
+// bounce: goes back the way it came along whichever axis ran into the wall (both, if it was a corner),
+// or stays where it was if that's blocked too.
+enum class Collision : int32_t { pass, stop, bounce, die };
+
+// Which cells of the level are solid, one bit each, so the whole level fits in cache and a particle
+// finds out in a couple of shifts. Cell (cx, cy) covers [cx, cx + 1) * cellSize along from the origin, and so on;
+// anything off the edge of the grid counts as open.
+struct OccupancyGrid
+{
+    int width = 0;
+    int height = 0;
+
+    // 32-bit words per row; cell (cx, cy) is bit cx % 32 of words[cy * stride + cx / 32].
+    int stride = 0;
+
+    float originX = 0.0f;
+    float originY = 0.0f;
+    float cellSize = 1.0f;
+
+    // How many cells are set, so a level with no walls can skip the lot.
+    int blocked = 0;
+
+    std::vector<uint32_t> words;
+
+    // Clears everything.
+    void Resize(int width, int height, float cellSize, float originX = 0.0f, float originY = 0.0f);
+    void Set(int cx, int cy, bool solid);
+    bool Blocked(float x, float y) const;
+};
+
+// How each element moves, what it looks like and what it's drawn with, indexed by element.
+// The engine fills this in from assets/particles/elements.txt (see ParticleEngine::LoadElements()).
+struct ElementTable
+{
+    static constexpr int MAX_ELEMENTS = 64;
+
+    int count = 0;
+
+    // With a roll r from 1 to 100: r > right moves it step to the right; otherwise right >= r > left moves it step to the left;
+    // otherwise r < vertical moves it verticalStep up. It also goes up by rise every tick, whatever it rolled.
+    float right[MAX_ELEMENTS] = {};
+    float left[MAX_ELEMENTS] = {};
+    float vertical[MAX_ELEMENTS] = {};
+    float step[MAX_ELEMENTS] = {};
+    float verticalStep[MAX_ELEMENTS] = {};
+    float rise[MAX_ELEMENTS] = {};
+
+    // The color goes from color to fade over the particle's lifetime, plus shade * (whatever shade it rolled).
+    glm::vec4 color[MAX_ELEMENTS] = {};
+    glm::vec4 fade[MAX_ELEMENTS] = {};
+    glm::vec4 shade[MAX_ELEMENTS] = {};
+
+    float width[MAX_ELEMENTS] = {};
+    float height[MAX_ELEMENTS] = {};
+
+    // GL texture names; 0 means the engine's default (blank, and base_map for the map).
+    int texture[MAX_ELEMENTS] = {};
+    int map[MAX_ELEMENTS] = {};
+
+    // A Collision, as an int so the wide versions can gather it.
+    int32_t collide[MAX_ELEMENTS] = {};
+
+    // Age is how far through its lifetime it is, from 0 to 1.
+    glm::vec4 Color(int element, float rolled, float age) const { return color[element] + (fade[element] - color[element]) * age + shade[element] * rolled; }
+};
+
+class ParticleKernels
+{
+public:
+    static constexpr int LANES = 8;
+
+    struct Rng
+    {
+        uint32_t lanes[LANES];
+
+        // Fills the lanes with the next numbers from source (see rng.h).
+        void Seed(RandomStream& source);
+    };
+
+    // Whether Step() and Shade() are using the AVX2 versions (decided the first time anybody asks).
+    static bool HasAVX2();
+
+    // One tick for count particles: moves them, rolls their shades and adds one to their ticks. Whichever ones
+    // had already reached their lifetime come out with ticks > lifetime; it's up to the caller to get rid of them.
+    // With ticksPerStep over 1, it stands in for that many ticks at once: the step is that much bigger and they age that much,
+    // which is close enough for particles nobody's looking at.
+    static void Step(int count, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, Rng& rng, int ticksPerStep = 1);
+
+    // Just rolls new shades, without moving anything.
+    static void Shade(int count, float* shade, Rng& rng);
+
+    // For count particles that have just been stepped from (prevX, prevY) to (x, y): whichever ones landed in a blocked
+    // cell get put back, bounced or killed (their ticks set past their lifetime), according to their element's collide.
+    static void Collide(int count, const float* prevX, const float* prevY, float* x, float* y, const int32_t* element, int32_t* ticks, const int32_t* lifetime, const ElementTable& table, const OccupancyGrid& grid);
+
+    // The versions Step() and Shade() pick between; they're only public so the benchmark can race them.
+    static void StepScalar(int count, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, Rng& rng, int ticksPerStep = 1);
+    static void StepSSE2(int count, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, Rng& rng, int ticksPerStep = 1);
+    static void StepAVX2(int count, float* x, float* y, const int32_t* element, int32_t* ticks, float* shade, const ElementTable& table, Rng& rng, int ticksPerStep = 1);
+    static void ShadeScalar(int count, float* shade, Rng& rng);
+    static void ShadeSSE2(int count, float* shade, Rng& rng);
+    static void ShadeAVX2(int count, float* shade, Rng& rng);
+
+    // There's no SSE2 one of these: without a gather the lookups would be one at a time anyway.
+    static void CollideScalar(int count, const float* prevX, const float* prevY, float* x, float* y, const int32_t* element, int32_t* ticks, const int32_t* lifetime, const ElementTable& table, const OccupancyGrid& grid);
+    static void CollideAVX2(int count, const float* prevX, const float* prevY, float* x, float* y, const int32_t* element, int32_t* ticks, const int32_t* lifetime, const ElementTable& table, const OccupancyGrid& grid);
+};
+
+#endif
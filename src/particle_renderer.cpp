@@ -0,0 +1,200 @@
+#include "particle_renderer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include "check_error.h"
+#include "renderer.h"
+#include "uniform_buffer.h"
+
+// See particle_renderer.h.
+
+ParticleRenderer::ParticleRenderer() : shader("assets/shaders/particle.vert", "assets/shaders/quad.frag", true), stream(4096 * sizeof(ParticleInstance))
+{
+    // The same corners for every particle, in the same order as the texture coordinates they double as.
+    const float corners[] = {
+        0.0f, 0.0f,
+        1.0f, 0.0f,
+        0.0f, 1.0f,
+        1.0f, 1.0f
+    };
+
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
+
+    glGenBuffers(1, &cornerVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, cornerVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    DescribeInstances();
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glCheckError();
+}
+
+ParticleRenderer::~ParticleRenderer()
+{
+    glDeleteBuffers(1, &cornerVBO);
+    glDeleteVertexArrays(1, &VAO);
+}
+
+void ParticleRenderer::Setup()
+{
+    shader.BindBlock("FrameData", FrameData::BINDING);
+
+    glUseProgram(shader.ID);
+    int samplers[MAX_TEXTURES];
+    for (int i = 0; i < MAX_TEXTURES; i++)
+    {
+        samplers[i] = i;
+    }
+    glUniform1iv(shader.Uniform("batchQuadTextures"), MAX_TEXTURES, samplers);
+
+    alphaCutoffLocation = shader.Uniform("alphaCutoff");
+}
+
+void ParticleRenderer::DescribeInstances()
+{
+    // The instance attributes start wherever this frame's instances do, so this gets redone every Draw()
+    // (and whenever the stream buffer gets recreated). It's the VAO that remembers it, so bind that first.
+    glBindBuffer(GL_ARRAY_BUFFER, stream.ID);
+
+    const char* base = (const char*)offset;
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), base + offsetof(ParticleInstance, x));
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), base + offsetof(ParticleInstance, rColor));
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), base + offsetof(ParticleInstance, textureIndex));
+    glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), base + offsetof(ParticleInstance, widthMod));
+
+    for (int attribute = 1; attribute <= 4; attribute++)
+    {
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+}
+
+float ParticleRenderer::Slot(GLuint texture)
+{
+    auto it = std::find(textures.begin(), textures.end(), texture);
+
+    if (it != textures.end())
+    {
+        return static_cast<float>(it - textures.begin());
+    }
+
+    if (textures.size() == MAX_TEXTURES)
+    {
+        return -1.0f;
+    }
+
+    textures.push_back(texture);
+    return static_cast<float>(textures.size() - 1);
+}
+
+ParticleInstance* ParticleRenderer::Begin(const ElementTable& table, GLuint blank, GLuint baseMap, int capacity)
+{
+    // Blank and baseMap always get the first two units, so there's something to fall back on.
+    textures.clear();
+    const float blankSlot = Slot(blank);
+    const float baseMapSlot = Slot(baseMap);
+    plain = { blankSlot, baseMapSlot, 1.0f, 1.0f, Renderer::CalculateModifier(1.0f), Renderer::CalculateModifier(1.0f) };
+
+    for (int e = 0; e < table.count; e++)
+    {
+        Look& look = looks[e];
+        look.textureSlot = table.texture[e] != 0 ? Slot(table.texture[e]) : blankSlot;
+        look.mapSlot = table.map[e] != 0 ? Slot(table.map[e]) : baseMapSlot;
+
+        // Sixty-odd elements with two textures each won't all fit in one draw, so whoever's left over just goes plain.
+        if (look.textureSlot < 0.0f || look.mapSlot < 0.0f)
+        {
+            look.textureSlot = blankSlot;
+            look.mapSlot = baseMapSlot;
+        }
+
+        look.width = table.width[e];
+        look.height = table.height[e];
+        look.widthMod = Renderer::CalculateModifier(look.width);
+        look.heightMod = Renderer::CalculateModifier(look.height);
+    }
+
+    return Open(capacity);
+}
+
+ParticleInstance* ParticleRenderer::BeginWith(const std::vector<GLuint>& units, int capacity)
+{
+    textures.assign(units.begin(), units.begin() + std::min(static_cast<int>(units.size()), MAX_TEXTURES));
+    return Open(capacity);
+}
+
+ParticleInstance* ParticleRenderer::Open(int capacity)
+{
+    if (stream.Reserve(std::max(capacity, 1) * sizeof(ParticleInstance)))
+    {
+        glBindVertexArray(VAO);
+        DescribeInstances();
+        glBindVertexArray(0);
+    }
+
+    stream.Begin();
+    begun = true;
+    mapped = static_cast<ParticleInstance*>(stream.Allocate(capacity * sizeof(ParticleInstance), offset));
+
+    if (keepCopy)
+    {
+        copy.resize(capacity);
+        return copy.data();
+    }
+
+    return mapped;
+}
+
+void ParticleRenderer::End(int count)
+{
+    if (keepCopy)
+    {
+        copy.resize(count);
+        std::copy(copy.begin(), copy.end(), mapped);
+    }
+
+    stream.End();
+    mapped = nullptr;
+    this->count = count;
+}
+
+int ParticleRenderer::Draw()
+{
+    // Nothing was written this frame (or it's already been drawn).
+    if (!begun)
+    {
+        return 0;
+    }
+
+    begun = false;
+
+    if (count == 0)
+    {
+        stream.Fence();
+        return 0;
+    }
+
+    shader.use();
+    glUniform1f(alphaCutoffLocation, 0.0f);
+
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+
+    for (int t = 0; t < textures.size(); t++)
+    {
+        glActiveTexture(GL_TEXTURE0 + t);
+        glBindTexture(GL_TEXTURE_2D, textures[t]);
+    }
+
+    glBindVertexArray(VAO);
+    DescribeInstances();
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+
+    stream.Fence();
+    return 1;
+}
@@ -0,0 +1,123 @@
+#ifndef PARTICLE_RENDERER_H
+#define PARTICLE_RENDERER_H
+
+// Particles used to go through the render queue like everything else, one DrawCommand each, which meant
+// two textureMap lookups, a sort key, a trip through DetermineBatch() and four full vertices per particle
+// per frame. They all look alike, though: an axis-aligned quad in one of a handful of elements' textures.
+// So they get a path of their own. Begin() works out which texture unit each element's texture and map
+// go in (once a frame, per element rather than per particle), the particle engine writes one small instance
+// per particle straight into a stream buffer, and Draw() puts the lot on screen with a single instanced draw.
+//
+// The renderer draws them after the effects layer and before the overlay, with no depth test, which is
+// where the queue used to put them. Frame captures (see frame_capture.h) record the instances and the
+// textures they were drawn with, and the replay hands them back through BeginWith().
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+#include "particle_kernels.h"
+#include "shader.h"
+#include "stream_buffer.h"
+
+struct ParticleInstance
+{
+    float x;
+    float y;
+    float width;
+    float height;
+
+    float rColor;
+    float gColor;
+    float bColor;
+    float aColor;
+
+    float textureIndex;
+    float mapIndex;
+
+    float widthMod;
+    float heightMod;
+};
+
+class ParticleRenderer
+{
+public:
+    // Has to match the sampler array in quad.frag, like Renderer::MAX_TEXTURES_PER_BATCH.
+    static constexpr int MAX_TEXTURES = 32;
+
+    // What an element's particles get drawn with, worked out by Begin().
+    struct Look
+    {
+        float textureSlot;
+        float mapSlot;
+        float width;
+        float height;
+        float widthMod;
+        float heightMod;
+    };
+
+    // Per element, and for the engine's own blank quads (clusters and the like).
+    Look looks[ElementTable::MAX_ELEMENTS];
+    Look plain;
+
+    // How many instances the last End() was given.
+    int count = 0;
+
+    ParticleRenderer();
+    ~ParticleRenderer();
+
+    ParticleRenderer(const ParticleRenderer&) = delete;
+    ParticleRenderer& operator=(const ParticleRenderer&) = delete;
+
+    // Once a frame, from the main thread. Fills in looks[] for every element in the table (elements without
+    // textures of their own get blank and baseMap) and returns room for up to capacity instances, which is
+    // fine to fill in from other threads until End() is told how many were actually written.
+    ParticleInstance* Begin(const ElementTable& table, GLuint blank, GLuint baseMap, int capacity);
+    void End(int count);
+
+    // Like Begin(), but with the texture units given rather than worked out from an element table. The replay uses it.
+    ParticleInstance* BeginWith(const std::vector<GLuint>& units, int capacity);
+
+    // Set while a frame capture's running. The instances then get written to a copy here first (the stream
+    // buffer's mapped write-only) and End() puts them in the stream buffer, so the capture can read them back.
+    bool keepCopy = false;
+
+    // The shader's built along with the renderer's (see Shader::BuildPending()), so its uniforms can't be set until after that.
+    void Setup();
+
+    // Called by the renderer; see Renderer::sendToGL(). Returns how many draw calls it made.
+    int Draw();
+
+    static void Fill(ParticleInstance& instance, const Look& look, float x, float y, glm::vec4 rgb)
+    {
+        instance = { x, y, look.width, look.height, rgb.r, rgb.g, rgb.b, rgb.a, look.textureSlot, look.mapSlot, look.widthMod, look.heightMod };
+    }
+
+    Shader shader;
+
+private:
+    // The capture reads this frame's instances and textures back out; see frame_capture.h.
+    friend class FrameCapture;
+
+    GLuint VAO = 0;
+    GLuint cornerVBO = 0;
+    StreamBuffer stream;
+
+    // Where this frame's instances start in the stream buffer.
+    GLintptr offset = 0;
+    bool begun = false;
+    GLint alphaCutoffLocation = -1;
+
+    // The textures in units 0, 1, 2... this frame.
+    std::vector<GLuint> textures;
+
+    // Where this frame's instances go in the stream buffer, and the copy they're written to first if keepCopy is set.
+    ParticleInstance* mapped = nullptr;
+    std::vector<ParticleInstance> copy;
+
+    ParticleInstance* Open(int capacity);
+
+    float Slot(GLuint texture);
+    void DescribeInstances();
+};
+
+#endif
@@ -0,0 +1,620 @@
+#include "particleengine.h"
+
+#include "ecs.h"
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// The heavier parts of the particle engine: loading the elements, keeping to the budget, and the update itself.
+
+#pragma region Elements
+
+// Turning assets/particles/elements.txt (which explains its own format) into the ElementTable. Chances in the file
+// are percentages; the table wants the thresholds the roll gets compared against, so that's worked out here, once, rather than every tick.
+
+bool ParticleEngine::LoadElements(const std::string& path)
+{
+	std::ifstream file(path);
+
+	if (!file.is_open())
+	{
+		std::cout << "Couldn't open particle elements \"" << path << "\".\n";
+		return false;
+	}
+
+	struct Definition
+	{
+		std::string name;
+		float right = 0.0f;
+		float left = 0.0f;
+		float vertical = 0.0f;
+		float step = 0.0f;
+		float verticalStep = 0.0f;
+		float rise = 0.0f;
+		glm::vec4 color = glm::vec4(1.0f);
+		glm::vec4 fade = glm::vec4(-1.0f);
+		glm::vec4 shade = glm::vec4(0.0f);
+		float width = 4.0f;
+		float height = 4.0f;
+		std::string texture;
+		std::string map;
+		Collision collide = Collision::pass;
+	};
+
+	std::vector<Definition> definitions;
+	std::string line;
+	int lineNumber = 0;
+
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+
+		std::istringstream words(line.substr(0, line.find('#')));
+		std::string key;
+
+		if (!(words >> key))
+		{
+			continue;
+		}
+
+		if (key == "element")
+		{
+			definitions.emplace_back();
+			words >> definitions.back().name;
+			continue;
+		}
+
+		if (definitions.empty())
+		{
+			std::cout << path << ":" << lineNumber << ": \"" << key << "\" before any element.\n";
+			return false;
+		}
+
+		Definition& d = definitions.back();
+		bool ok = true;
+
+		if (key == "right") ok = static_cast<bool>(words >> d.right);
+		else if (key == "left") ok = static_cast<bool>(words >> d.left);
+		else if (key == "vertical") ok = static_cast<bool>(words >> d.vertical);
+		else if (key == "step") ok = static_cast<bool>(words >> d.step);
+		else if (key == "verticalStep") ok = static_cast<bool>(words >> d.verticalStep);
+		else if (key == "rise") ok = static_cast<bool>(words >> d.rise);
+		else if (key == "color") ok = static_cast<bool>(words >> d.color.r >> d.color.g >> d.color.b >> d.color.a);
+		else if (key == "fade") ok = static_cast<bool>(words >> d.fade.r >> d.fade.g >> d.fade.b >> d.fade.a);
+		else if (key == "shade") ok = static_cast<bool>(words >> d.shade.r >> d.shade.g >> d.shade.b >> d.shade.a);
+		else if (key == "size") ok = static_cast<bool>(words >> d.width >> d.height);
+		else if (key == "texture") ok = static_cast<bool>(words >> d.texture);
+		else if (key == "map") ok = static_cast<bool>(words >> d.map);
+		else if (key == "collide")
+		{
+			static const std::string responses[] = { "pass", "stop", "bounce", "die" };
+			std::string response;
+			ok = static_cast<bool>(words >> response);
+
+			auto it = std::find(std::begin(responses), std::end(responses), response);
+			ok = ok && it != std::end(responses);
+			d.collide = static_cast<Collision>(it - std::begin(responses));
+		}
+		else
+		{
+			std::cout << path << ":" << lineNumber << ": unknown key \"" << key << "\".\n";
+			return false;
+		}
+
+		if (!ok)
+		{
+			std::cout << path << ":" << lineNumber << ": couldn't read the value(s) for \"" << key << "\".\n";
+			return false;
+		}
+	}
+
+	if (definitions.size() > ElementTable::MAX_ELEMENTS)
+	{
+		std::cout << path << ": " << definitions.size() << " elements, but there's only room for " << ElementTable::MAX_ELEMENTS << ".\n";
+		return false;
+	}
+
+	auto textureID = [&](const std::string& name)
+	{
+		if (name.empty())
+		{
+			return 0;
+		}
+
+		auto it = Game::main.textureMap.find(name);
+
+		if (it == Game::main.textureMap.end())
+		{
+			std::cout << path << ": no texture called \"" << name << "\"; using the default.\n";
+			return 0;
+		}
+
+		return static_cast<int>(it->second->ID);
+	};
+
+	ElementTable table;
+	table.count = static_cast<int>(definitions.size());
+	elementNames.clear();
+
+	for (int e = 0; e < table.count; e++)
+	{
+		const Definition& d = definitions[e];
+
+		if (d.right + d.left + d.vertical > 100.0f)
+		{
+			std::cout << path << ": " << d.name << "'s chances add up to more than 100.\n";
+			return false;
+		}
+
+		// A roll over 100 - right goes right, the next left's worth down goes left, and anything under vertical + 1 goes vertically.
+		table.right[e] = 100.0f - d.right;
+		table.left[e] = table.right[e] - d.left;
+		table.vertical[e] = d.vertical + 1.0f;
+		table.step[e] = d.step;
+		table.verticalStep[e] = d.verticalStep;
+		table.rise[e] = d.rise;
+
+		table.color[e] = d.color;
+		table.fade[e] = d.fade.r < 0.0f ? d.color : d.fade;
+		table.shade[e] = d.shade;
+		table.width[e] = d.width;
+		table.height[e] = d.height;
+		table.texture[e] = textureID(d.texture);
+		table.map[e] = textureID(d.map);
+		table.collide[e] = static_cast<int32_t>(d.collide);
+
+		elementNames.push_back(d.name);
+	}
+
+	elements = table;
+	return true;
+}
+
+#pragma endregion
+
+#pragma region Budget
+
+int ParticleEngine::RegisterEmitter()
+{
+	int slot;
+
+	if (!freeEmitters.empty())
+	{
+		slot = freeEmitters.back();
+		freeEmitters.pop_back();
+	}
+	else
+	{
+		slot = static_cast<int>(aliveByEmitter.size());
+		aliveByEmitter.push_back(0);
+		released.push_back(false);
+	}
+
+	aliveByEmitter[slot] = 0;
+	released[slot] = false;
+	return slot;
+}
+
+void ParticleEngine::ReleaseEmitter(int slot)
+{
+	if (slot < 0)
+	{
+		return;
+	}
+
+	// Its particles still point at the slot, so it can't go to anybody else until they're gone.
+	if (aliveByEmitter[slot] == 0)
+	{
+		freeEmitters.push_back(slot);
+	}
+	else
+	{
+		released[slot] = true;
+	}
+}
+
+void ParticleEngine::Kill(int p)
+{
+	const int32_t owner = particles.owner[p];
+
+	if (owner >= 0 && --aliveByEmitter[owner] == 0 && released[owner])
+	{
+		released[owner] = false;
+		freeEmitters.push_back(owner);
+	}
+
+	particles.Kill(p);
+}
+
+void ParticleEngine::MergeSpawns()
+{
+	merged.clear();
+
+	for (std::vector<SpawnRequest>& buffer : spawnBuffers)
+	{
+		merged.insert(merged.end(), buffer.begin(), buffer.end());
+		buffer.clear();
+	}
+
+	if (deterministic)
+	{
+		std::stable_sort(merged.begin(), merged.end(), [](const SpawnRequest& a, const SpawnRequest& b) { return a.order < b.order; });
+	}
+
+	// Highest priority first, so if anybody's going to miss out it's the ones that matter least.
+	std::stable_sort(merged.begin(), merged.end(), [](const SpawnRequest& a, const SpawnRequest& b) { return a.priority > b.priority; });
+
+	// First just the bookkeeping, one request at a time since each one's room depends on everybody before it:
+	// how many it gets (within the budget and what's left of the pool) and where they'll go.
+	const int capacityLeft = particles.Capacity() - particles.count;
+	int total = 0;
+	spawnOffsets.resize(merged.size());
+
+	for (int r = 0; r < merged.size(); r++)
+	{
+		SpawnRequest& request = merged[r];
+		const int priority = std::min(std::max(request.priority, 0), PRIORITIES - 1);
+		int room = static_cast<int>(budget * PRIORITY_SHARE[priority]) - (particles.count + total);
+
+		if (request.owner >= 0 && request.maxAlive > 0)
+		{
+			room = std::min(room, request.maxAlive - aliveByEmitter[request.owner]);
+		}
+
+		const int allowed = std::max(0, std::min(request.number, room));
+		throttled += request.number - allowed;
+
+		// Past the budget is throttling; past the pool's capacity is dropping, and the pool counts that itself.
+		const int number = std::min(allowed, capacityLeft - total);
+		particles.dropped += allowed - number;
+
+		if (request.owner >= 0)
+		{
+			aliveByEmitter[request.owner] += number;
+		}
+
+		request.number = number;
+		spawnOffsets[r] = total;
+		total += number;
+	}
+
+	// Then room for all of them in one go, and filling them in, which is just runs of the same values
+	// (spread over the workers, when there are enough requests to be worth it).
+	const int first = particles.count;
+	particles.Reserve(total);
+
+	ThreadPool::main.ParallelFor(static_cast<int>(merged.size()), 64, [&](int begin, int end, int worker)
+		{
+			for (int r = begin; r < end; r++)
+			{
+				const SpawnRequest& request = merged[r];
+				particles.Fill(first + spawnOffsets[r], request.number, request.x, request.y, request.element, request.lifetime, request.owner);
+			}
+		});
+}
+
+#pragma endregion
+
+#pragma region Update
+
+void ParticleEngine::RebuildOccupancy()
+{
+	occupancy.Resize(ECS::mWidth, ECS::mHeight, ECS::main.nodeSize);
+
+	for (int x = 0; x < ECS::mWidth; x++)
+	{
+		for (int y = 0; y < ECS::mHeight; y++)
+		{
+			const Node* node = ECS::main.nodeMap[x][y];
+			occupancy.Set(x, y, node != nullptr && node->blocked);
+		}
+	}
+
+	occupancyVersion = ECS::main.nodeVersion;
+}
+
+void ParticleEngine::Update(float deltaTime)
+{
+	const int before = particles.count;
+	MergeSpawns();
+
+	ParticlePool& pool = particles;
+	const int32_t* element = reinterpret_cast<const int32_t*>(pool.element.data());
+	const int chunks = (pool.count + CHUNK - 1) / CHUNK;
+	const bool tick = lastTick > tickDelay;
+
+	// Between ticks nothing moves; Submit() just draws everything a bit further along from where it was to where it is.
+	if (!tick)
+	{
+		lastTick += deltaTime;
+		frame++;
+
+		Submit();
+		return;
+	}
+
+	// Work out which chunks are off screen from where their particles were last frame. Chunks that just got
+	// new particles (or that we haven't seen yet) don't count, since we don't know where those are yet.
+	// Like the emitters (see visibility.h), there's half a screen of margin on every side.
+	const float marginX = (Game::main.rightX - Game::main.leftX) / 2.0f;
+	const float marginY = (Game::main.topY - Game::main.bottomY) / 2.0f;
+	const int firstFresh = before / CHUNK;
+
+	if (occupancyVersion != ECS::main.nodeVersion)
+	{
+		RebuildOccupancy();
+	}
+
+	std::vector<int> steps(chunks, 1);
+	chunksSkipped = 0;
+
+	for (int c = 0; c < chunks && c < firstFresh && c < chunkBounds.size(); c++)
+	{
+		const glm::vec4& b = chunkBounds[c];
+		const bool offscreen = b.z < Game::main.leftX - marginX || b.x > Game::main.rightX + marginX ||
+			b.w < Game::main.bottomY - marginY || b.y > Game::main.topY + marginY;
+
+		if (offscreen)
+		{
+			// Staggered, so the off-screen chunks don't all catch up on the same tick.
+			steps[c] = (ticksRun + c) % OFFSCREEN_INTERVAL == 0 ? OFFSCREEN_INTERVAL : 0;
+			chunksSkipped += steps[c] == 0 ? 1 : 0;
+		}
+	}
+
+	// Seeded here, in chunk order, so they come out the same whichever thread ends up with which chunk.
+	chunkRngs.resize(chunks);
+
+	for (int c = 0; c < chunks; c++)
+	{
+		if (steps[c] > 0)
+		{
+			chunkRngs[c].Seed(random);
+		}
+	}
+
+	ThreadPool::main.ParallelFor(chunks, 1, [&](int begin, int end, int worker)
+		{
+			for (int c = begin; c < end; c++)
+			{
+				const int first = c * CHUNK;
+				const int count = std::min(CHUNK, pool.count - first);
+
+				// Where they are now is where they'll be drawn from for the next tick, stepped or not
+				// (otherwise the ones that weren't would slide back and forth over the same tick again).
+				std::copy_n(pool.x.begin() + first, count, pool.prevX.begin() + first);
+				std::copy_n(pool.y.begin() + first, count, pool.prevY.begin() + first);
+				std::copy_n(pool.shade.begin() + first, count, pool.prevShade.begin() + first);
+
+				if (steps[c] > 0)
+				{
+					ParticleKernels::Step(count, pool.x.data() + first, pool.y.data() + first, element + first, pool.ticks.data() + first, pool.shade.data() + first, elements, chunkRngs[c], steps[c]);
+					ParticleKernels::Collide(count, pool.prevX.data() + first, pool.prevY.data() + first, pool.x.data() + first, pool.y.data() + first, element + first, pool.ticks.data() + first, pool.lifetime.data() + first, elements, occupancy);
+				}
+			}
+		});
+
+	lastTick = 0.0f;
+	ticksRun++;
+
+	// Whatever had already reached its lifetime still got moved, but it's done now. No p++ when one dies,
+	// since the last particle moves into its slot and needs checking too.
+	for (int p = 0; p < pool.count;)
+	{
+		if (pool.ticks[p] > pool.lifetime[p])
+		{
+			Kill(p);
+		}
+		else
+		{
+			p++;
+		}
+	}
+
+	frame++;
+
+	Submit();
+}
+
+void ParticleEngine::Submit()
+{
+	ParticlePool& pool = particles;
+	const int32_t* element = reinterpret_cast<const int32_t*>(pool.element.data());
+	const int chunks = (pool.count + CHUNK - 1) / CHUNK;
+
+	// Looked up once a frame, for the elements that don't name textures of their own. The particle renderer
+	// sorts out which texture unit each element's in, once a frame too, so there's nothing to look up per particle.
+	const GLuint blank = Game::main.textureMap["blank"]->ID;
+	const GLuint baseMap = Game::main.textureMap["base_map"]->ID;
+	ParticleRenderer& renderer = Game::main.renderer->particles;
+
+	const float left = Game::main.leftX;
+	const float right = Game::main.rightX;
+	const float bottom = Game::main.bottomY;
+	const float top = Game::main.topY;
+
+	const bool cluster = Game::main.zoom >= CLUSTER_ZOOM;
+	const float cellSize = CLUSTER_PIXELS * Game::main.zoom;
+	const int gridCols = cluster ? static_cast<int>((right - left) / cellSize) + 1 : 1;
+	const int gridRows = cluster ? static_cast<int>((top - bottom) / cellSize) + 1 : 1;
+
+	// Everything's drawn part of the way (blend) from its last tick to its current one: where it is, its shade and its age.
+	const float blend = Blend();
+
+	auto positionOf = [&](int p)
+	{
+		return glm::vec2(pool.prevX[p] + (pool.x[p] - pool.prevX[p]) * blend, pool.prevY[p] + (pool.y[p] - pool.prevY[p]) * blend);
+	};
+
+	auto colorOf = [&](int p)
+	{
+		const float ticks = std::max(static_cast<float>(pool.ticks[p]) - 1.0f + blend, 0.0f);
+		const float age = pool.lifetime[p] > 0 ? std::min(ticks / pool.lifetime[p], 1.0f) : 1.0f;
+		return elements.Color(element[p], pool.prevShade[p] + (pool.shade[p] - pool.prevShade[p]) * blend, age);
+	};
+
+	// First, where everything is: each chunk's bounds (for next frame), and which cell each particle's in, if it's on screen at all.
+	chunkBounds.assign(chunks, glm::vec4(0.0f));
+	cellOf.resize(pool.count);
+	std::vector<int> visibleInChunk(chunks, 0);
+
+	ThreadPool::main.ParallelFor(chunks, 1, [&](int begin, int end, int worker)
+		{
+			for (int c = begin; c < end; c++)
+			{
+				const int first = c * CHUNK;
+				const int last = std::min(first + CHUNK, pool.count);
+				glm::vec4 bounds(pool.x[first], pool.y[first], pool.x[first], pool.y[first]);
+
+				for (int p = first; p < last; p++)
+				{
+					bounds = glm::vec4(std::min(bounds.x, pool.x[p]), std::min(bounds.y, pool.y[p]), std::max(bounds.z, pool.x[p]), std::max(bounds.w, pool.y[p]));
+
+					const glm::vec2 drawn = positionOf(p);
+					const float x = drawn.x;
+					const float y = drawn.y;
+
+					const int e = element[p];
+					const float halfWidth = elements.width[e] / 2.0f;
+					const float halfHeight = elements.height[e] / 2.0f;
+
+					if (x + halfWidth < left || x - halfWidth > right || y + halfHeight < bottom || y - halfHeight > top)
+					{
+						cellOf[p] = -1;
+						continue;
+					}
+
+					visibleInChunk[c]++;
+
+					if (cluster)
+					{
+						const int cx = std::min(std::max(static_cast<int>((x - left) / cellSize), 0), gridCols - 1);
+						const int cy = std::min(std::max(static_cast<int>((y - bottom) / cellSize), 0), gridRows - 1);
+						cellOf[p] = cy * gridCols + cx;
+					}
+					else
+					{
+						cellOf[p] = 0;
+					}
+				}
+
+				chunkBounds[c] = bounds;
+			}
+		});
+
+	visible = 0;
+	for (int n : visibleInChunk)
+	{
+		visible += n;
+	}
+
+	clusters = 0;
+	clustered = 0;
+
+	// How many each chunk draws on their own (everything on screen that isn't in a crowded cell), and so where its instances start.
+	std::vector<int> firstInChunk(chunks + 1, 0);
+
+	if (cluster)
+	{
+		cellCounts.assign(gridCols * gridRows, 0);
+
+		for (int p = 0; p < pool.count; p++)
+		{
+			if (cellOf[p] >= 0)
+			{
+				cellCounts[cellOf[p]]++;
+			}
+		}
+
+		ThreadPool::main.ParallelFor(chunks, 1, [&](int begin, int end, int worker)
+			{
+				for (int c = begin; c < end; c++)
+				{
+					int drawn = 0;
+
+					for (int p = c * CHUNK; p < std::min((c + 1) * CHUNK, pool.count); p++)
+					{
+						drawn += cellOf[p] >= 0 && cellCounts[cellOf[p]] < CLUSTER_MIN ? 1 : 0;
+					}
+
+					visibleInChunk[c] = drawn;
+				}
+			});
+	}
+
+	for (int c = 0; c < chunks; c++)
+	{
+		firstInChunk[c + 1] = firstInChunk[c] + visibleInChunk[c];
+	}
+
+	const int individual = firstInChunk[chunks];
+	const int mostClusters = cluster ? (visible - individual) / CLUSTER_MIN : 0;
+	ParticleInstance* instances = renderer.Begin(elements, blank, baseMap, individual + mostClusters);
+
+	// Then everything that's drawn on its own goes straight into the instance buffer, each chunk into its own stretch of it.
+	ThreadPool::main.ParallelFor(chunks, 1, [&](int begin, int end, int worker)
+		{
+			for (int c = begin; c < end; c++)
+			{
+				ParticleInstance* write = instances + firstInChunk[c];
+
+				for (int p = c * CHUNK; p < std::min((c + 1) * CHUNK, pool.count); p++)
+				{
+					if (cellOf[p] < 0 || (cluster && cellCounts[cellOf[p]] >= CLUSTER_MIN))
+					{
+						continue;
+					}
+
+					const glm::vec2 drawn = positionOf(p);
+					ParticleRenderer::Fill(*write++, renderer.looks[element[p]], drawn.x, drawn.y, colorOf(p));
+				}
+			}
+		});
+
+	if (cluster)
+	{
+		// And the crowded cells become one quad each, at the middle of what's in them, in the average of their colors,
+		// about as big as all of them put side by side (but no bigger than the cell).
+		cellSums.assign(cellCounts.size(), glm::vec4(0.0f));
+		cellColors.assign(cellCounts.size(), glm::vec4(0.0f));
+
+		for (int p = 0; p < pool.count; p++)
+		{
+			const int cell = cellOf[p];
+
+			if (cell >= 0 && cellCounts[cell] >= CLUSTER_MIN)
+			{
+				const int e = element[p];
+				cellSums[cell] += glm::vec4(positionOf(p), elements.width[e] * elements.height[e], 0.0f);
+				cellColors[cell] += colorOf(p);
+			}
+		}
+
+		for (int cell = 0; cell < cellCounts.size(); cell++)
+		{
+			const int n = cellCounts[cell];
+
+			if (n < CLUSTER_MIN)
+			{
+				continue;
+			}
+
+			const glm::vec4 mean = cellSums[cell] / static_cast<float>(n);
+			const float size = std::min(std::sqrt(cellSums[cell].z), cellSize);
+
+			ParticleRenderer::Look look = renderer.plain;
+			look.width = look.height = size;
+			look.widthMod = look.heightMod = Renderer::CalculateModifier(size);
+
+			ParticleRenderer::Fill(instances[individual + clusters], look, mean.x, mean.y, cellColors[cell] / static_cast<float>(n));
+
+			clusters++;
+			clustered += n;
+		}
+	}
+
+	renderer.End(individual + clusters);
+}
+
+#pragma endregion
@@ -2,31 +2,155 @@
 #define PARTICLEENGINE_H
 
 #include <algorithm>
+#include <string>
 #include <vector>
 #include "game.h"
+#include "particle_kernels.h"
+#include "rng.h"
+#include "thread_pool.h"
 #include "texture_2D.h"
 
 // Seeing as particles won't interact much with the other parts of the game, I went ahead and moved much of their logic
 // out of ecs.cpp. I didn't want it getting overly cluttered, not to mention that the particle system doesn't exactly
 // align with the architecture of the rest of the game (perfectly).
+//
+// Particles are the most parallel thing we've got, so the engine steps them in CHUNK-sized pieces spread over
+// the thread pool. Each chunk gets a generator of its own, seeded from the engine's stream (see rng.h) in chunk
+// order before any of them start, so nothing depends on which thread happened to get it. Emitters can spawn from any thread too:
+// Emit() goes into that thread's own buffer, and the buffers get poured into the pool at the top of Update().
+// In deterministic mode they're put back in the order the emitters were gone through first (rather than
+// whichever order the threads finished in), so the same seed gives the same particles however many threads there are.
+//
+// Particles can't see entities, but they do know where the level's walls are: each tick, whatever stepped into
+// a blocked node of ECS::main.nodeMap stops, bounces or dies there, depending on its element (see Collision).
+//
+// Particles only move on ticks (every tickDelay seconds), which is a lot less often than we draw them. Rather than
+// jump once a tick, each one remembers where it was before its last tick, and frames in between draw it partway there.
 
-enum class Element { aether, fire, necrotic, dust };
-struct Particle
+// Each element is a row in the engine's ElementTable (see particle_kernels.h), so it's kept as a plain 32-bit index.
+// These are just the first four in assets/particles/elements.txt; the rest are found by name (FindElement()) and cast to Element.
+enum class Element : int32_t { aether, fire, necrotic, dust };
+
+// All the live particles, kept as separate arrays (one per field) rather than one array of structs, since
+// the update goes through every particle's position and age each tick and hardly ever needs the rest.
+// The arrays are allocated once, up front, and never grow: when a particle dies the last one is moved
+// into its place, so the live ones are always the first count of them and spawning is just writing at the end.
+// Anything spawned while the pool is full is dropped (and counted), rather than going to the heap for more room.
+class ParticlePool
 {
-	float x;
-	float y;
-	Element element;
-	int ticks;
-	int lifetime;
+public:
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<Element> element;
+	std::vector<int> ticks;
+	std::vector<int> lifetime;
+
+	// The shade each one rolled for its color on its last tick; see ElementTable::Color().
+	std::vector<float> shade;
+
+	// Where each one was, and the shade it had, before its last tick. Ticks come a lot less often than frames,
+	// so the engine draws them somewhere between the two rather than jumping (and flickering) once a tick.
+	std::vector<float> prevX;
+	std::vector<float> prevY;
+	std::vector<float> prevShade;
+
+	// Which emitter's budget it counts against (see ParticleEngine::RegisterEmitter()), or -1 for none.
+	std::vector<int32_t> owner;
+
+	int count = 0;
+
+	// A new particle's first shade comes from this and how many particles came before it, so each one
+	// gets its own, and the same ones every run with the same seed.
+	uint64_t seed = 0;
+	uint64_t spawned = 0;
+
+private:
+	// Where the last Reserve()d run starts, and how many particles had been spawned before it.
+	int reservedAt = 0;
+	uint64_t reservedSerial = 0;
+
+public:
+	// Just so we can see what it's doing.
+	int peak = 0;
+	unsigned long long dropped = 0;
+
+	int Capacity() const { return static_cast<int>(x.size()); }
+
+	void Allocate(int capacity)
+	{
+		x.assign(capacity, 0.0f);
+		y.assign(capacity, 0.0f);
+		element.assign(capacity, Element::aether);
+		ticks.assign(capacity, 0);
+		lifetime.assign(capacity, 0);
+		shade.assign(capacity, 0.0f);
+		prevX.assign(capacity, 0.0f);
+		prevY.assign(capacity, 0.0f);
+		prevShade.assign(capacity, 0.0f);
+		owner.assign(capacity, -1);
+		count = 0;
+	}
+
+	// Makes room for number more at the end of the live ones (or as many as there's room for) and returns how many that was;
+	// they start at whatever count was before. Fill() them in before anything reads them.
+	int Reserve(int number)
+	{
+		const int fits = std::max(0, std::min(number, Capacity() - count));
+		dropped += number - fits;
+
+		reservedAt = count;
+		reservedSerial = spawned;
+		spawned += fits;
 
-	Particle(float x, float y, Element element, int lifetime)
+		count += fits;
+		peak = std::max(peak, count);
+		return fits;
+	}
+
+	// Sets up number particles starting at first, which has to be in the last run Reserve()d. Different runs can be
+	// filled from different threads.
+	void Fill(int first, int number, float x, float y, Element element, int lifetime, int32_t owner)
 	{
-		this->x = x;
-		this->y = y;
-		this->element = element;
-		this->lifetime = lifetime;
+		std::fill_n(this->x.begin() + first, number, x);
+		std::fill_n(this->y.begin() + first, number, y);
+		std::fill_n(this->element.begin() + first, number, element);
+		std::fill_n(this->ticks.begin() + first, number, 0);
+		std::fill_n(this->lifetime.begin() + first, number, lifetime);
+		std::fill_n(prevX.begin() + first, number, x);
+		std::fill_n(prevY.begin() + first, number, y);
+		std::fill_n(this->owner.begin() + first, number, owner);
+
+		const uint64_t serial = reservedSerial + static_cast<uint64_t>(first - reservedAt);
 
-		ticks = 0;
+		for (int i = 0; i < number; i++)
+		{
+			shade[first + i] = prevShade[first + i] = static_cast<float>(RngService::Mix(seed ^ (serial + i)) >> 40) * (1.0f / 16777216.0f);
+		}
+	}
+
+	// Returns how many actually fit.
+	int Spawn(int number, float x, float y, Element element, int lifetime, int32_t owner = -1)
+	{
+		const int first = count;
+		const int fits = Reserve(number);
+		Fill(first, fits, x, y, element, lifetime, owner);
+		return fits;
+	}
+
+	// Whatever was last takes its place, so don't step past i after calling this.
+	void Kill(int i)
+	{
+		count--;
+		x[i] = x[count];
+		y[i] = y[count];
+		element[i] = element[count];
+		ticks[i] = ticks[count];
+		lifetime[i] = lifetime[count];
+		shade[i] = shade[count];
+		prevX[i] = prevX[count];
+		prevY[i] = prevY[count];
+		prevShade[i] = prevShade[count];
+		owner[i] = owner[count];
 	}
 };
 
@@ -34,160 +158,164 @@ class ParticleEngine
 {
 public:
 	static ParticleEngine main;
+
+	// Plenty for even the busiest fire-filled room.
+	static constexpr int DEFAULT_CAPACITY = 1 << 16;
+
+	// How many particles each job steps. A multiple of ParticleKernels::LANES, so every chunk starts on lane 0.
+	static constexpr int CHUNK = 4096;
+
+	// Particles in a chunk that's entirely off screen (plus a margin) only get stepped every this many ticks,
+	// a few ticks' worth at a time.
+	static constexpr int OFFSCREEN_INTERVAL = 4;
+
+	// Once we're zoomed out at least this far, cells of the screen this many pixels across with at least CLUSTER_MIN
+	// particles in them get drawn as one bigger quad instead.
+	static constexpr float CLUSTER_ZOOM = 1.5f;
+	static constexpr float CLUSTER_PIXELS = 8.0f;
+	static constexpr int CLUSTER_MIN = 4;
+
+	// Emitters can spawn as long as the pool's under this fraction of the budget, by priority (0 is the lowest).
+	// So when things get busy the little stuff stops first and the big spell still goes off.
+	static constexpr int PRIORITIES = 4;
+	static constexpr float PRIORITY_SHARE[PRIORITIES] = { 0.5f, 0.75f, 0.9f, 1.0f };
+
+	struct SpawnRequest
+	{
+		// Where the emitter came in the order they were gone through; see Emit().
+		uint32_t order;
+
+		// The emitter's budget slot (or -1), and its priority and cap (0 for no cap); see ParticleComponent.
+		int32_t owner;
+		int priority;
+		int maxAlive;
+
+		int number;
+		float x;
+		float y;
+		Element element;
+		int lifetime;
+	};
+
 	float lastTick;
 	float tickDelay;
-	std::vector<Particle*> particles;
+	ParticlePool particles;
+	ElementTable elements;
+	std::vector<std::string> elementNames;
+
+	// How many particles emitters can have alive between them; the pool's capacity is the hard limit on top of that.
+	int budget = DEFAULT_CAPACITY / 2;
+
+	bool deterministic = false;
+
+	// The chunks' generators are seeded from this, one after another on the main thread. The seed that
+	// Roll() and new particles' shades hash with is the first thing drawn from it.
+	RandomStream random;
+	uint64_t seed = 0;
+
+	// Counts calls to Update(), for seeding.
+	uint64_t frame = 0;
 
-	void Init(float tickDelay)
+	// Just so we can see what it's doing. These are all for the last frame except throttled, which keeps counting.
+	int visible = 0;
+	int clusters = 0;
+	int clustered = 0;
+	int chunksSkipped = 0;
+	unsigned long long throttled = 0;
+
+	// One per worker in the thread pool.
+	std::vector<std::vector<SpawnRequest>> spawnBuffers;
+
+	void Init(float tickDelay, int capacity = DEFAULT_CAPACITY)
 	{
-		// Do absolutely fucking nothing.
 		lastTick = 0.0f;
 		this->tickDelay = tickDelay;
+		particles.Allocate(capacity);
+		budget = std::min(budget, capacity);
+		spawnBuffers.assign(ThreadPool::main.WorkerCount(), {});
+		random = RngService::main.Stream(RngService::Key("particles"));
+		seed = random.Next();
+		particles.seed = seed;
+	}
+
+	// Reads the element definitions (see assets/particles/elements.txt) into the table, replacing whatever was there.
+	// Textures are looked up by name in Game::main.textureMap, so load them first. Returns false (and leaves the table alone) if it can't.
+	bool LoadElements(const std::string& path);
+
+	// An element's ID, for ones the Element enum doesn't name, or -1 if there's no such element.
+	int FindElement(const std::string& name) const
+	{
+		auto it = std::find(elementNames.begin(), elementNames.end(), name);
+		return it != elementNames.end() ? static_cast<int>(it - elementNames.begin()) : -1;
 	}
 
+	// These skip the budget; they're for one-offs, not emitters.
 	void AddParticle(float x, float y, Element element, int lifetime)
 	{
-		Particle* p = new Particle(x, y, element, lifetime);
-		particles.push_back(p);
+		particles.Spawn(1, x, y, element, lifetime);
 	}
 
 	void AddParticles(int number, float x, float y, Element element, int lifetime)
 	{
-		for (int i = 0; i < number; i++)
-		{
-			Particle* p = new Particle(x, y, element, lifetime);
-			particles.push_back(p);
-		}
+		particles.Spawn(number, x, y, element, lifetime);
 	}
 
-	void RemoveParticle(Particle* p)
+	// Like AddParticles(), but safe from inside a thread pool job, and within the budget. The particles show up at the next Update().
+	// Order should be the same from run to run for the same emitter (its place in the list being gone through, say).
+	void Emit(const SpawnRequest& request)
 	{
-		particles.erase(std::remove(particles.begin(), particles.end(), p), particles.end());
-		delete p;
+		spawnBuffers[ThreadPool::CurrentWorker()].push_back(request);
 	}
 
-	void Update(float deltaTime)
+	// Every emitter with a cap of its own gets a slot, which counts how many of its particles are alive.
+	// Releasing one just lets the slot go once the last of its particles has died.
+	int RegisterEmitter();
+	void ReleaseEmitter(int slot);
+
+	// A number in [0, 1) that depends only on the seed, the frame and order, so it's safe from any thread.
+	float Roll(uint32_t order) const
 	{
-		if (lastTick > tickDelay)
-		{
-			lastTick = 0.0f;
-
-			for (int p = 0; p < particles.size(); p++)
-			{
-				Particle* particle = particles[p];
-				Texture2D* s = Game::main.textureMap["blank"];
-				glm::vec4 color;
-
-				int r = rand() % 100 + 1;
-				float cr = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-
-				if (particle->element == Element::fire ||
-					particle->element == Element::necrotic)
-				{
-					particle->y += 2.0f;
-
-					if (r > 75)
-					{
-						particle->x += 2.0f;
-					}
-					else if (r > 50)
-					{
-						particle->x -= 2.0f;
-					}
-					else if (r < 10)
-					{
-						particle->y -= 2.0f;
-					}
-
-					if (particle->element == Element::fire)
-					{
-						color = glm::vec4(1.0f, cr, 0.0f, 1.0f);
-					}
-					else
-					{
-						color = glm::vec4(0.5f, cr, 0.5f, 1.0f);
-					}
-				}
-				else if (particle->element == Element::aether)
-				{
-					color = glm::vec4(0.0f, 0.8f, cr, 1.0f);
-
-					if (r > 70)
-					{
-						particle->x += 2.0f;
-					}
-					else if (r > 40)
-					{
-						particle->x -= 2.0f;
-					}
-					else if (r < 20)
-					{
-						particle->y += 2.0f;
-					}
-				}
-				else if (particle->element == Element::dust)
-				{
-					color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
-
-					if (r > 95)
-					{
-						particle->x += 2.0f;
-					}
-					else if (r > 90)
-					{
-						particle->x -= 2.0f;
-					}
-					else if (r < 70)
-					{
-						particle->y += 2.0f;
-					}
-				}
-
-				if (particle->ticks < particle->lifetime)
-				{
-					particle->ticks += 1;
-					// Game::main.renderer->prepareQuad(glm::vec2(particle->x, particle->y), 1.0f, 1.0f, color, s->ID);
-					Game::main.renderer->prepareQuad(glm::vec2(particle->x, particle->y), s->width / 4.0f, s->height / 4.0f, 1.0f, 1.0f, color, s->ID, Game::main.textureMap["base_map"]->ID);
-				}
-				else
-				{
-					RemoveParticle(particle);
-				}
-			}
-		}
-		else
-		{
-			lastTick += deltaTime;
-
-			for (int p = 0; p < particles.size(); p++)
-			{
-				Particle* particle = particles[p];
-				Texture2D* s = Game::main.textureMap["blank"];
-				glm::vec4 color;
-
-				float cr = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-
-				if (particle->element == Element::fire)
-				{
-					color = glm::vec4(1.0f, cr, 0.0f, 1.0f);
-				}
-				else if (particle->element == Element::aether)
-				{
-					color = glm::vec4(0.0f, 0.8f, cr, 1.0f);
-				}
-				else if (particle->element == Element::dust)
-				{
-					color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
-				}
-				else
-				{
-					color = glm::vec4(0.5f, cr, 0.5f, 1.0f);
-				}
-
-				Game::main.renderer->prepareQuad(glm::vec2(particle->x, particle->y), s->width / 4.0f, s->height / 4.0f, 1.0f, 1.0f, color, s->ID, Game::main.textureMap["base_map"]->ID);
-			}
-		}
+		const uint64_t bits = RngService::Mix(seed ^ RngService::Mix(frame << 32 | order));
+		return static_cast<float>(bits >> 40) * (1.0f / 16777216.0f);
 	}
+
+	void Update(float deltaTime);
+
+	// How far it is from the last tick to the next one, from 0 to 1; particles are drawn that far from where they were to where they are.
+	float Blend() const { return tickDelay > 0.0f ? std::min(lastTick / tickDelay, 1.0f) : 1.0f; }
+
+private:
+	std::vector<SpawnRequest> merged;
+
+	// Per merged request, where its particles go in the run MergeSpawns() reserves.
+	std::vector<int> spawnOffsets;
+
+	// Per budget slot.
+	std::vector<int> aliveByEmitter;
+	std::vector<bool> released;
+	std::vector<int> freeEmitters;
+
+	// The level's walls, rebuilt from ECS::main.nodeMap whenever its nodeVersion moves on.
+	OccupancyGrid occupancy;
+	int occupancyVersion = -1;
+
+	// Per chunk, where its particles were as of the last frame (min x, min y, max x, max y).
+	std::vector<glm::vec4> chunkBounds;
+	int ticksRun = 0;
+
+	// Per chunk, the generator it's stepped with this tick.
+	std::vector<ParticleKernels::Rng> chunkRngs;
+
+	// Per particle, which cluster cell it's in (or -1 if it's off screen); per cell, how many are in it and what they add up to.
+	std::vector<int32_t> cellOf;
+	std::vector<int> cellCounts;
+	std::vector<glm::vec4> cellSums;
+	std::vector<glm::vec4> cellColors;
+
+	void MergeSpawns();
+	void RebuildOccupancy();
+	void Kill(int p);
+	void Submit();
 };
 
 
@@ -0,0 +1,131 @@
+#include "program_cache.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "gl_extensions.h"
+
+// Every file starts with this header, and anything that doesn't match is ignored (and overwritten later).
+struct ProgramCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+static constexpr uint32_t CACHE_VERSION = 1;
+
+std::string ProgramCache::directory = "shader_cache";
+
+// FNV-1a; nothing fancy, we just need different inputs to (almost certainly) give different names.
+static uint64_t Hash(uint64_t hash, const char* data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+static uint64_t Hash(uint64_t hash, const GLubyte* string)
+{
+    const char* s = string != nullptr ? reinterpret_cast<const char*>(string) : "";
+    return Hash(hash, s, std::char_traits<char>::length(s) + 1);
+}
+
+uint64_t ProgramCache::Key(const std::string& vertexSource, const std::string& fragmentSource)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = Hash(hash, vertexSource.c_str(), vertexSource.size() + 1);
+    hash = Hash(hash, fragmentSource.c_str(), fragmentSource.size() + 1);
+    hash = Hash(hash, glGetString(GL_VENDOR));
+    hash = Hash(hash, glGetString(GL_RENDERER));
+    hash = Hash(hash, glGetString(GL_VERSION));
+    return hash;
+}
+
+std::string ProgramCache::PathFor(uint64_t key)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return directory + "/" + name;
+}
+
+bool ProgramCache::Load(GLuint program, uint64_t key)
+{
+    if (!GLExtensions::programBinary)
+    {
+        return false;
+    }
+
+    std::ifstream file(PathFor(key), std::ios::binary);
+
+    if (!file)
+    {
+        return false;
+    }
+
+    ProgramCacheHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!file || std::string(header.magic, 4) != "ASPB" || header.version != CACHE_VERSION || header.key != key || header.length == 0)
+    {
+        return false;
+    }
+
+    std::vector<char> binary(header.length);
+    file.read(binary.data(), header.length);
+
+    if (!file)
+    {
+        return false;
+    }
+
+    GLExtensions::glProgramBinary(program, header.format, binary.data(), header.length);
+
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success != 0;
+}
+
+void ProgramCache::Save(GLuint program, uint64_t key)
+{
+    if (!GLExtensions::programBinary)
+    {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (length <= 0)
+    {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    GLExtensions::glGetProgramBinary(program, length, &written, &format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    std::ofstream file(PathFor(key), std::ios::binary | std::ios::trunc);
+
+    if (!file)
+    {
+        std::cout << "ERROR::PROGRAM_CACHE::COULD_NOT_WRITE " << PathFor(key) << '\n';
+        return;
+    }
+
+    ProgramCacheHeader header = { { 'A', 'S', 'P', 'B' }, CACHE_VERSION, key, format, static_cast<uint32_t>(written) };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(binary.data(), written);
+}
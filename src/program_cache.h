@@ -0,0 +1,30 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+// The program cache keeps linked shader programs on disk (in shader_cache/, next to the assets)
+// so that the next launch can hand the driver the finished binary instead of compiling from source.
+// Each program's file is named after a hash of its sources along with the driver's vendor, renderer
+// and version strings, since a binary's only good for the exact driver that made it. If the
+// driver turns one down anyway (after an update, say), Shader just compiles it the normal way
+// and the cache gets the new binary.
+
+#include <cstdint>
+#include <string>
+#include <glad/glad.h>
+
+class ProgramCache
+{
+public:
+    static std::string directory;
+
+    static uint64_t Key(const std::string& vertexSource, const std::string& fragmentSource);
+
+    // Load() returns false (leaving the program unlinked) if there's nothing usable cached.
+    static bool Load(GLuint program, uint64_t key);
+    static void Save(GLuint program, uint64_t key);
+
+private:
+    static std::string PathFor(uint64_t key);
+};
+
+#endif
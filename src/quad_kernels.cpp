@@ -0,0 +1,170 @@
+#include "quad_kernels.h"
+
+#include <cmath>
+
+#if QUAD_KERNELS_SSE
+#include <emmintrin.h>
+#endif
+
+// See quad_kernels.h. Rotating (x, y) by an angle with cosine c and sine s gives
+// (x * c - y * s, x * s + y * c), and since the corners are just (+-halfWidth, +-halfHeight),
+// all four of them can be built out of the same four products:
+//
+//     a = halfWidth * c    b = halfHeight * s    d = halfWidth * s    e = halfHeight * c
+//
+//     top right:    (cx + a - b, cy + d + e)
+//     bottom right: (cx + a + b, cy + d - e)
+//     bottom left:  (cx - a + b, cy - d - e)
+//     top left:     (cx - a - b, cy - d + e)
+
+static constexpr float DEGREES_TO_RADIANS = 3.14159265358979323846f / 180.0f;
+
+void QuadKernels::Corners(int count, const float* centerX, const float* centerY, const float* halfWidth, const float* halfHeight, const float* rotation, glm::vec2* corners)
+{
+    if (sse)
+    {
+        CornersSSE(count, centerX, centerY, halfWidth, halfHeight, rotation, corners);
+    }
+    else
+    {
+        CornersScalar(count, centerX, centerY, halfWidth, halfHeight, rotation, corners);
+    }
+}
+
+void QuadKernels::CornersScalar(int count, const float* centerX, const float* centerY, const float* halfWidth, const float* halfHeight, const float* rotation, glm::vec2* corners)
+{
+    for (int i = 0; i < count; i++)
+    {
+        float c = 1.0f;
+        float s = 0.0f;
+
+        if (rotation[i] != 0.0f)
+        {
+            const float radians = rotation[i] * DEGREES_TO_RADIANS;
+            c = std::cos(radians);
+            s = std::sin(radians);
+        }
+
+        const float a = halfWidth[i] * c;
+        const float b = halfHeight[i] * s;
+        const float d = halfWidth[i] * s;
+        const float e = halfHeight[i] * c;
+        const float cx = centerX[i];
+        const float cy = centerY[i];
+
+        glm::vec2* out = corners + 4 * i;
+        out[0] = glm::vec2(cx + a - b, cy + d + e);
+        out[1] = glm::vec2(cx + a + b, cy + d - e);
+        out[2] = glm::vec2(cx - a + b, cy - d - e);
+        out[3] = glm::vec2(cx - a - b, cy - d + e);
+    }
+}
+
+#if QUAD_KERNELS_SSE
+
+// There's no SSE sine or cosine, so this is the usual Cephes approach done four at a time: knock the angle
+// down into [-pi/4, pi/4] by taking off the nearest multiple of pi/2 (in three pieces, so we don't lose
+// precision doing it), run both polynomials on what's left, then swap and negate according to which
+// quarter-turn we took off. It's good to within a couple of ulps, which is plenty for vertex positions.
+static inline void SinCos(__m128 x, __m128& sine, __m128& cosine)
+{
+    const __m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.63661977236758134308f)));
+    const __m128 q = _mm_cvtepi32_ps(quadrant);
+
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(1.5703125f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(4.837512969970703125e-4f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(7.54978995489188216e-8f)));
+    const __m128 r2 = _mm_mul_ps(r, r);
+
+    __m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), r2), _mm_set1_ps(8.3321608736e-3f));
+    s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(-1.6666654611e-1f));
+    s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, r2), r), r);
+
+    __m128 c = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), r2), _mm_set1_ps(-1.388731625493765e-3f));
+    c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(4.166664568298827e-2f));
+    c = _mm_mul_ps(_mm_mul_ps(c, r2), r2);
+    c = _mm_add_ps(_mm_sub_ps(c, _mm_mul_ps(r2, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+    // Odd quadrants swap sine and cosine; sine flips sign in quadrants 2 and 3, cosine in 1 and 2.
+    const __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    const __m128 sineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+    const __m128 cosineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+
+    sine = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), sineSign);
+    cosine = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), cosineSign);
+}
+
+void QuadKernels::CornersSSE(int count, const float* centerX, const float* centerY, const float* halfWidth, const float* halfHeight, const float* rotation, glm::vec2* corners)
+{
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 hw = _mm_loadu_ps(halfWidth + i);
+        const __m128 hh = _mm_loadu_ps(halfHeight + i);
+        const __m128 cx = _mm_loadu_ps(centerX + i);
+        const __m128 cy = _mm_loadu_ps(centerY + i);
+
+        __m128 a, b, d, e;
+        const __m128 r = _mm_loadu_ps(rotation + i);
+
+        if (_mm_movemask_ps(_mm_cmpneq_ps(r, _mm_setzero_ps())) == 0)
+        {
+            // None of the four are rotated, so the corners are just the center plus or minus the half extents.
+            a = hw;
+            e = hh;
+            b = d = _mm_setzero_ps();
+        }
+        else
+        {
+            __m128 s, c;
+            SinCos(_mm_mul_ps(r, _mm_set1_ps(DEGREES_TO_RADIANS)), s, c);
+
+            a = _mm_mul_ps(hw, c);
+            b = _mm_mul_ps(hh, s);
+            d = _mm_mul_ps(hw, s);
+            e = _mm_mul_ps(hh, c);
+        }
+
+        const __m128 xPlusA = _mm_add_ps(cx, a);
+        const __m128 xMinusA = _mm_sub_ps(cx, a);
+        const __m128 yPlusD = _mm_add_ps(cy, d);
+        const __m128 yMinusD = _mm_sub_ps(cy, d);
+
+        // Each of these holds one coordinate of one corner for all four sprites...
+        __m128 trX = _mm_sub_ps(xPlusA, b);
+        __m128 trY = _mm_add_ps(yPlusD, e);
+        __m128 brX = _mm_add_ps(xPlusA, b);
+        __m128 brY = _mm_sub_ps(yPlusD, e);
+        __m128 blX = _mm_add_ps(xMinusA, b);
+        __m128 blY = _mm_sub_ps(yMinusD, e);
+        __m128 tlX = _mm_sub_ps(xMinusA, b);
+        __m128 tlY = _mm_add_ps(yMinusD, e);
+
+        // ...so flip them around to get each sprite's corners next to each other.
+        _MM_TRANSPOSE4_PS(trX, trY, brX, brY);
+        _MM_TRANSPOSE4_PS(blX, blY, tlX, tlY);
+
+        float* out = reinterpret_cast<float*>(corners + 4 * i);
+        _mm_storeu_ps(out + 0, trX);
+        _mm_storeu_ps(out + 4, blX);
+        _mm_storeu_ps(out + 8, trY);
+        _mm_storeu_ps(out + 12, blY);
+        _mm_storeu_ps(out + 16, brX);
+        _mm_storeu_ps(out + 20, tlX);
+        _mm_storeu_ps(out + 24, brY);
+        _mm_storeu_ps(out + 28, tlY);
+    }
+
+    // Whatever doesn't fill a group of four.
+    CornersScalar(count - i, centerX + i, centerY + i, halfWidth + i, halfHeight + i, rotation + i, corners + 4 * i);
+}
+
+#else
+
+void QuadKernels::CornersSSE(int count, const float* centerX, const float* centerY, const float* halfWidth, const float* halfHeight, const float* rotation, glm::vec2* corners)
+{
+    CornersScalar(count, centerX, centerY, halfWidth, halfHeight, rotation, corners);
+}
+
+#endif
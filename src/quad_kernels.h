@@ -0,0 +1,35 @@
+#ifndef QUAD_KERNELS_H
+#define QUAD_KERNELS_H
+
+// Number-crunching that the renderer does for lots of quads at once.
+// Right now that's just working out where the corners of a (possibly rotated) quad end up,
+// which used to take four separate GlobalPositionComponent::Rotate() calls (and so eight
+// trig calls) per sprite. Corners() does a whole array of them, four at a time with SSE
+// where we have it (sine and cosine included), taking the sine and cosine once per sprite
+// and not at all when a group of four aren't rotated, which is most of them.
+// "asciismos --bench corners" races the two against the old way.
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QUAD_KERNELS_SSE 1
+#else
+#define QUAD_KERNELS_SSE 0
+#endif
+
+class QuadKernels
+{
+public:
+    // Whether Corners() is using the SSE version.
+    static constexpr bool sse = QUAD_KERNELS_SSE;
+
+    // For each of count quads, writes four corners (top right, bottom right, bottom left, top left,
+    // in that order) to corners[4 * i] onwards. Rotations are in degrees, same as everywhere else.
+    static void Corners(int count, const float* centerX, const float* centerY, const float* halfWidth, const float* halfHeight, const float* rotation, glm::vec2* corners);
+
+    // The two versions Corners() picks between; they're only public so the benchmark can race them.
+    static void CornersScalar(int count, const float* centerX, const float* centerY, const float* halfWidth, const float* halfHeight, const float* rotation, glm::vec2* corners);
+    static void CornersSSE(int count, const float* centerX, const float* centerY, const float* halfWidth, const float* halfHeight, const float* rotation, glm::vec2* corners);
+};
+
+#endif
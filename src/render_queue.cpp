@@ -0,0 +1,222 @@
+#include "render_queue.h"
+
+#include <algorithm>
+#include <cstring>
+
+// See render_queue.h for the key layout.
+
+#pragma region Draw Commands
+
+DrawCommand DrawCommand::Sprite(float x, float y, float rotation, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, int textureID, int mapID, bool tiled, bool flippedX, bool flippedY)
+{
+    DrawCommand c = {};
+    c.type = Type::sprite;
+    c.x = x;
+    c.y = y;
+    c.rotation = rotation;
+    c.width = width;
+    c.height = height;
+    c.scaleX = scaleX;
+    c.scaleY = scaleY;
+    c.rgb = rgb;
+    c.textureID = textureID;
+    c.mapID = mapID;
+    c.tiled = tiled;
+    c.flippedX = flippedX;
+    c.flippedY = flippedY;
+    return c;
+}
+
+DrawCommand DrawCommand::Cell(float x, float y, float rotation, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, int animID, int mapID, int cellX, int cellY, int cols, int rows, bool flippedX, bool flippedY)
+{
+    DrawCommand c = {};
+    c.type = Type::cell;
+    c.x = x;
+    c.y = y;
+    c.rotation = rotation;
+    c.width = width;
+    c.height = height;
+    c.scaleX = scaleX;
+    c.scaleY = scaleY;
+    c.rgb = rgb;
+    c.textureID = animID;
+    c.mapID = mapID;
+    c.cellX = cellX;
+    c.cellY = cellY;
+    c.cols = cols;
+    c.rows = rows;
+    c.flippedX = flippedX;
+    c.flippedY = flippedY;
+    return c;
+}
+
+DrawCommand DrawCommand::Point(float x, float y, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, int textureID, int mapID)
+{
+    DrawCommand c = {};
+    c.type = Type::point;
+    c.x = x;
+    c.y = y;
+    c.width = width;
+    c.height = height;
+    c.scaleX = scaleX;
+    c.scaleY = scaleY;
+    c.rgb = rgb;
+    c.textureID = textureID;
+    c.mapID = mapID;
+    return c;
+}
+
+#pragma endregion
+
+#pragma region Render Queue
+
+uint64_t RenderQueue::MakeKey(RenderLayer layer, float z, int textureID, int mapID, uint32_t order)
+{
+    // Flip the float's bits around so that comparing them as unsigned ints gives the same order as comparing
+    // the floats (negatives have all their bits flipped, positives just get the sign bit set), then keep the top 24.
+    uint32_t bits;
+    std::memcpy(&bits, &z, sizeof(bits));
+    bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    const uint64_t depth = bits >> 8;
+
+    return (static_cast<uint64_t>(layer) & 0xF) << 60 |
+        depth << 36 |
+        (static_cast<uint64_t>(textureID) & 0xFFF) << 24 |
+        (static_cast<uint64_t>(mapID) & 0xFFF) << 12 |
+        (static_cast<uint64_t>(order) & 0xFFF);
+}
+
+uint64_t RenderQueue::MakeOpaqueKey(float z, int textureID, int mapID, uint32_t order)
+{
+    // Layer 0 goes before any of the real layers, and flipping the depth puts the nearest (highest z) first.
+    const uint64_t key = MakeKey(RenderLayer::world, z, textureID, mapID, order);
+    const uint64_t depth = (~key >> 36) & 0xFFFFFF;
+
+    return depth << 36 | (key & 0xFFFFFFFFFull);
+}
+
+bool RenderQueue::IsOpaque(RenderLayer layer, const DrawCommand& command)
+{
+    return layer == RenderLayer::world && !command.translucent && command.rgb.a >= 1.0f;
+}
+
+void RenderQueue::Submit(RenderLayer layer, float z, const DrawCommand& command, uint32_t order)
+{
+    Place(Reserve(1), layer, z, command, order);
+}
+
+int RenderQueue::Reserve(int count)
+{
+    const int first = static_cast<int>(items.size());
+    items.resize(first + count, { 0, EMPTY });
+    commands.resize(first + count);
+    return first;
+}
+
+void RenderQueue::Place(int slot, RenderLayer layer, float z, const DrawCommand& command, uint32_t order)
+{
+    const uint64_t key = IsOpaque(layer, command) ? MakeOpaqueKey(z, command.textureID, command.mapID, order) : MakeKey(layer, z, command.textureID, command.mapID, order);
+    items[slot] = { key, static_cast<uint32_t>(slot) };
+    commands[slot] = command;
+    commands[slot].z = z;
+}
+
+void RenderQueue::Prepare()
+{
+    items.erase(std::remove_if(items.begin(), items.end(), [](const Item& item) { return item.command == EMPTY; }), items.end());
+    Sort();
+
+    materialChanges = 0;
+    opaqueCount = 0;
+    worldCount = 0;
+    effectsCount = 0;
+    int lastTexture = -1;
+    int lastMap = -1;
+
+    for (const Item& item : items)
+    {
+        const uint64_t layer = item.key >> 60;
+        opaqueCount += layer == 0 ? 1 : 0;
+        worldCount += layer <= static_cast<uint64_t>(RenderLayer::world) ? 1 : 0;
+        effectsCount += layer <= static_cast<uint64_t>(RenderLayer::effects) ? 1 : 0;
+
+        const DrawCommand& command = commands[item.command];
+
+        if (command.textureID != lastTexture || command.mapID != lastMap)
+        {
+            materialChanges++;
+            lastTexture = command.textureID;
+            lastMap = command.mapID;
+        }
+    }
+}
+
+void RenderQueue::Sort()
+{
+    // Least-significant-byte-first radix sort. We count every byte's histogram in one pass,
+    // and then skip any pass where every key has the same byte (which, what with the layer
+    // and order usually being the same for everything, is a fair few of them).
+    const size_t n = items.size();
+
+    if (n < 2)
+    {
+        return;
+    }
+
+    static uint32_t counts[8][256];
+    std::memset(counts, 0, sizeof(counts));
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const uint64_t key = items[i].key;
+
+        for (int pass = 0; pass < 8; pass++)
+        {
+            counts[pass][(key >> (pass * 8)) & 0xFF]++;
+        }
+    }
+
+    scratch.resize(n);
+    Item* from = items.data();
+    Item* to = scratch.data();
+
+    for (int pass = 0; pass < 8; pass++)
+    {
+        uint32_t* count = counts[pass];
+
+        if (count[(from[0].key >> (pass * 8)) & 0xFF] == n)
+        {
+            continue;
+        }
+
+        uint32_t offsets[256];
+        uint32_t total = 0;
+
+        for (int b = 0; b < 256; b++)
+        {
+            offsets[b] = total;
+            total += count[b];
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            const int b = (from[i].key >> (pass * 8)) & 0xFF;
+            to[offsets[b]++] = from[i];
+        }
+
+        std::swap(from, to);
+    }
+
+    if (from != items.data())
+    {
+        std::memcpy(items.data(), from, n * sizeof(Item));
+    }
+}
+
+void RenderQueue::Clear()
+{
+    commands.clear();
+    items.clear();
+}
+
+#pragma endregion
@@ -0,0 +1,129 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+// The render queue is where everything that wants drawing this frame goes first.
+// Systems don't sort anything themselves anymore; they just submit a DrawCommand along with
+// the layer and z it should be drawn at, and at the end of the frame the renderer sorts the
+// whole lot in one go and only then turns them into quads. Each command gets a 64-bit key:
+//
+//     [ layer : 4 ][ depth : 24 ][ texture : 12 ][ map : 12 ][ order : 12 ]
+//
+// Sorting on that puts things back to front across every system at once and, within the same depth,
+// groups quads with the same textures together so they end up sharing batches. The sort is a
+// (stable) radix sort, so ties come out in the order they were submitted.
+//
+// The exception is opaque world sprites (anything in the world layer that isn't translucent or tinted see-through),
+// which the depth buffer sorts out for us. They get layer 0, so they come before everything else,
+// and have their depth bits flipped, so they come out front to back; that way the depth test
+// throws away whatever's hidden behind them before it's shaded. See Renderer::sendToGL().
+//
+// Systems that want to fill the queue from the thread pool Reserve() a run of slots first (one per
+// component, say) and then Place() into them from whichever worker; slots nobody placed into are
+// dropped in Prepare(). Since the slots are handed out in order, the result doesn't depend on which
+// worker got which piece, so ties still come out the same way every frame.
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Layers are drawn in this order, whatever the z's inside them.
+enum class RenderLayer : uint8_t { world = 1, effects = 2, overlay = 3 };
+
+// Everything the renderer needs to build one quad, copied out of whatever components asked for it.
+struct DrawCommand
+{
+    // sprite: a whole texture, possibly rotated, tiled or flipped.
+    // cell: one cell of an animation sheet.
+    // point: an axis-aligned quad, like a particle.
+    enum class Type : uint8_t { sprite, cell, point };
+
+    Type type;
+
+    // Set this for anything in the world layer with soft (half-transparent) edges, so it gets drawn
+    // in the sorted pass instead of the depth-tested one. Tinting with an alpha under 1 does the same.
+    bool translucent;
+
+    bool tiled;
+    bool flippedX;
+    bool flippedY;
+
+    float x;
+    float y;
+    float rotation;
+
+    // Filled in by Place() from the z it was given.
+    float z;
+
+    float width;
+    float height;
+    float scaleX;
+    float scaleY;
+    glm::vec4 rgb;
+
+    int textureID;
+    int mapID;
+
+    int cellX;
+    int cellY;
+    int cols;
+    int rows;
+
+    static DrawCommand Sprite(float x, float y, float rotation, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, int textureID, int mapID, bool tiled, bool flippedX, bool flippedY);
+    static DrawCommand Cell(float x, float y, float rotation, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, int animID, int mapID, int cellX, int cellY, int cols, int rows, bool flippedX, bool flippedY);
+    static DrawCommand Point(float x, float y, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, int textureID, int mapID);
+};
+
+class RenderQueue
+{
+public:
+    // How many times this frame consecutive quads wanted different textures.
+    int materialChanges = 0;
+
+    // Order is just a tie-breaker for things at the same depth that need a particular order among themselves.
+    void Submit(RenderLayer layer, float z, const DrawCommand& command, uint32_t order = 0);
+
+    // Reserve() has to be called from the main thread; Place() is safe from anywhere, as long as no two
+    // threads place into the same slot. Returns the first slot of the run.
+    int Reserve(int count);
+    void Place(int slot, RenderLayer layer, float z, const DrawCommand& command, uint32_t order = 0);
+
+    // Drops the empty slots and sorts what's left. After this, the i'th command in
+    // draw order is Command(i).
+    void Prepare();
+    void Sort();
+    void Clear();
+
+    int Size() const { return static_cast<int>(items.size()); }
+
+    // After Prepare(), the opaque commands are the first OpaqueCount() and everything else up to WorldCount() is in the
+    // world layer; the effects layer runs up to EffectsCount() and the rest is the overlay.
+    int OpaqueCount() const { return opaqueCount; }
+    int WorldCount() const { return worldCount; }
+    int EffectsCount() const { return effectsCount; }
+    const DrawCommand& Command(int i) const { return commands[items[i].command]; }
+
+    static uint64_t MakeKey(RenderLayer layer, float z, int textureID, int mapID, uint32_t order);
+    static uint64_t MakeOpaqueKey(float z, int textureID, int mapID, uint32_t order);
+    static bool IsOpaque(RenderLayer layer, const DrawCommand& command);
+
+private:
+    friend class FrameCapture;
+
+    static constexpr uint32_t EMPTY = 0xFFFFFFFFu;
+
+    struct Item
+    {
+        uint64_t key;
+        uint32_t command;
+    };
+
+    int opaqueCount = 0;
+    int worldCount = 0;
+    int effectsCount = 0;
+
+    std::vector<DrawCommand> commands;
+    std::vector<Item> items;
+    std::vector<Item> scratch;
+};
+
+#endif
@@ -5,18 +5,27 @@
 #include <cstring>
 #include <cmath>
 #include <algorithm>
+#include <climits>
 #include "check_error.h"
 #include "game.h"
 #include "component.h"
+#include "static_layer.h"
+#include "palette_cache.h"
+#include "frame_capture.h"
+#include "quad_kernels.h"
+#include "thread_pool.h"
 
 // This holds all the functions we use to send rendering info to OpenGL.
-// In short, one calls some variation on prepareQuad() from outside (like in ecs.cpp)
-// and then this handles the rest. It takes that quad and determines which batch
-// the textures are in, ensuring that the texture and its map aren't accidentally placed
-// in separate batches. Then, it calculates the modifier that is sent to the fragment shader
-// which is necessary to get texture sampling to work correctly. At the end of each frame,
-// Main calls sendToGL() which in turn flushes out however many batches we need
-// and then Main calls resetBuffers() to prepare for the next frame.
+// In short, one submits a DrawCommand to the render queue (or, for odds and ends, calls
+// some variation on prepareQuad() directly) from outside (like in ecs.cpp) and then this
+// handles the rest. At the top of sendToGL(), the queue gets sorted and each command is
+// turned into a quad (on as many threads as we've got; see uploadFrame()).
+// For each quad it determines which batch the textures are in, ensuring
+// that the texture and its map aren't accidentally placed in separate batches. Then, it
+// calculates the modifier that is sent to the fragment shader which is necessary to get
+// texture sampling to work correctly. At the end of each frame, Main calls sendToGL()
+// which in turn flushes out however many batches we need and then Main calls resetBuffers()
+// to prepare for the next frame.
 
 float Renderer::CalculateModifier(float i)
 {
@@ -25,170 +34,152 @@ float Renderer::CalculateModifier(float i)
 
 void Renderer::CloseOffBatch()
 {
-    int diff = texturesUsed.size() % MAX_TEXTURES_PER_BATCH + 1;
-
-    for (int i = 0; i < diff; i++)
+    // Pad out the rest of the current batch's texture slots so the next texture lands in a new batch.
+    while (texturesUsed.size() % MAX_TEXTURES_PER_BATCH != 0)
     {
         texturesUsed.push_back(0);
     }
 }
 
+int Renderer::StartNewBatch()
+{
+    // CloseOffBatch() alone isn't quite enough, since a texture that's already in the old batch would
+    // still be found there. Putting the white texture in the new batch's first slot (like batch 0 has) moves us on for good.
+    CloseOffBatch();
+    texturesUsed.push_back(whiteTextureID);
+
+    lastTextureID = -1;
+    lastMapID = -1;
+
+    const int batch = static_cast<int>(texturesUsed.size() - 1) / MAX_TEXTURES_PER_BATCH;
+    batchAt(batch);
+    return batch;
+}
+
 Bundle Renderer::DetermineBatch(int textureID, int mapID)
 {
-    auto result = std::find(texturesUsed.rbegin(), texturesUsed.rend(), textureID);
-    int location;
-    if (result != texturesUsed.rend())
+    // The render queue hands us quads sorted by texture within each depth, so it's very common
+    // to be asked about the same pair twice in a row; nothing's changed since then, so neither has the answer.
+    if (textureID == lastTextureID && mapID == lastMapID)
     {
-        // The texture has been used.
-        location = texturesUsed.rend() - result;
-    }
-    else
-    {
-        // The texture has not yet been used.
-        location = -1;
+        return lastBundle;
     }
 
+    lastTextureID = textureID;
+    lastMapID = mapID;
+    lastBundle = FindSlots(textureID, mapID);
+    return lastBundle;
+}
+
+Bundle Renderer::FindSlots(int textureID, int mapID)
+{
+    // Texture slots are handed out in order, so the slot for texturesUsed[i] is i % MAX_TEXTURES_PER_BATCH
+    // in batch i / MAX_TEXTURES_PER_BATCH. We only ever look in the batch we're currently filling:
+    // going back to an earlier one would draw this quad underneath things that were sorted before it.
+    auto result = std::find(texturesUsed.rbegin(), texturesUsed.rend(), textureID);
+    int location = (result != texturesUsed.rend()) ? static_cast<int>(texturesUsed.rend() - result) - 1 : -1;
+
     auto resultMap = std::find(texturesUsed.rbegin(), texturesUsed.rend(), mapID);
-    int locationMap;
-    if (resultMap != texturesUsed.rend())
+    int locationMap = (resultMap != texturesUsed.rend()) ? static_cast<int>(texturesUsed.rend() - resultMap) - 1 : -1;
+
+    // Whatever we can't reuse from the batch we're currently filling has to be added to it.
+    int currentBatch = static_cast<int>(texturesUsed.size() - 1) / MAX_TEXTURES_PER_BATCH;
+
+    if (location / MAX_TEXTURES_PER_BATCH != currentBatch)
     {
-        // The map has been used.
-        locationMap = texturesUsed.rend() - resultMap;
+        location = -1;
     }
-    else
+
+    if (locationMap / MAX_TEXTURES_PER_BATCH != currentBatch)
     {
-        // The map has not yet been used.
         locationMap = -1;
     }
 
-    int textureBatch = floor(location / MAX_TEXTURES_PER_BATCH);
-    int mapBatch = floor(locationMap / MAX_TEXTURES_PER_BATCH);
+    const int needed = (location == -1 ? 1 : 0) + (locationMap == -1 && mapID != textureID ? 1 : 0);
+    const int freeSlots = (currentBatch + 1) * MAX_TEXTURES_PER_BATCH - static_cast<int>(texturesUsed.size());
 
-    Bundle bundle;
-    int currentBatch = floor(texturesUsed.size() / MAX_TEXTURES_PER_BATCH);
-    // std::cout << std::to_string(currentBatch) + "\n";
-
-    if (textureBatch == mapBatch && location != -1 && locationMap != -1)
+    if (needed > freeSlots)
     {
-        // They're both already used and in the same batch.
-        return bundle = { textureBatch, (float)(static_cast<int>(location - 1) % MAX_TEXTURES_PER_BATCH), (float)(static_cast<int>(locationMap - 1) % MAX_TEXTURES_PER_BATCH) };
+        // The current batch lacks space for them, so they both go into a fresh one.
+        CloseOffBatch();
+        currentBatch++;
+        location = -1;
+        locationMap = -1;
     }
-    else if (textureBatch != mapBatch && location != -1 && locationMap != -1)
+
+    if (location == -1)
     {
-        // They're both already used and in different batches.
+        texturesUsed.push_back(textureID);
+        location = static_cast<int>(texturesUsed.size()) - 1;
+    }
 
-        if (texturesUsed.size() % MAX_TEXTURES_PER_BATCH > MAX_TEXTURES_PER_BATCH - 2)
+    if (locationMap == -1)
+    {
+        if (mapID == textureID)
         {
-            // They're both already used and in different batches and the current batch lacks space for them.
-            CloseOffBatch();
-            int newBatch = floor(texturesUsed.size() / MAX_TEXTURES_PER_BATCH);
-            texturesUsed.push_back(textureID);
-            texturesUsed.push_back(mapID);
-            return bundle = { newBatch, 0, 1 };
+            locationMap = location;
         }
         else
         {
-            // They're both already used and in different batches and the current batch has space for them.
-            texturesUsed.push_back(textureID);
             texturesUsed.push_back(mapID);
-            return bundle = { currentBatch, static_cast<float>(texturesUsed.size()) - 2 % MAX_TEXTURES_PER_BATCH, static_cast<float>(texturesUsed.size()) - 1 % MAX_TEXTURES_PER_BATCH };
-
+            locationMap = static_cast<int>(texturesUsed.size()) - 1;
         }
     }
-    else if (textureBatch != mapBatch && locationMap == -1 && textureBatch == currentBatch)
+
+    return { currentBatch, static_cast<float>(location % MAX_TEXTURES_PER_BATCH), static_cast<float>(locationMap % MAX_TEXTURES_PER_BATCH) };
+}
+
+Batch& Renderer::batchAt(int index)
+{
+    // DetermineBatch() will happily open as many batches as there are textures to fill them,
+    // so we grow to match rather than assuming there's only ever the one.
+    if (index >= static_cast<int>(batches.size()))
     {
-        // Only the texture has already been used.
-        if (texturesUsed.size() % MAX_TEXTURES_PER_BATCH != 0)
-        {
-            // Only the texture has already been used in the current batch and it has space for the map.
-            texturesUsed.push_back(mapID);
-            return bundle = { currentBatch, static_cast<float>(location) - 1, static_cast<float>(texturesUsed.size()) - 1 };
-        }
-        else
-        {
-            // Only the texture has already been used in the current batch and it lacks space for the map.
-            CloseOffBatch();
-            int newBatch = floor(texturesUsed.size() / MAX_TEXTURES_PER_BATCH);
-            texturesUsed.push_back(textureID);
-            texturesUsed.push_back(mapID);
-            return bundle = { newBatch, 0, 1 };
-        }
+        batches.resize(index + 1);
     }
-    else if (textureBatch != mapBatch && location == -1 && mapBatch == currentBatch)
+
+    return batches[index];
+}
+
+Quad& Renderer::nextQuad(int batchIndex)
+{
+    Batch& batch = batchAt(batchIndex);
+
+    if (batch.chunks.empty() || batch.chunks.back()->count == QuadChunk::CAPACITY)
     {
-        // Only the map has already been used.
-        if (texturesUsed.size() % MAX_TEXTURES_PER_BATCH != 0)
+        // Out of room, so grab another chunk (preferably one left over from a previous frame).
+        QuadChunk* chunk;
+
+        if (!spareChunks.empty())
         {
-            // Only the map has already been used in the current batch and it has space for the texture.
-            texturesUsed.push_back(textureID);
-            return bundle = { currentBatch, static_cast<float>(texturesUsed.size()) - 1, static_cast<float>(locationMap) - 1 };
+            chunk = spareChunks.back();
+            spareChunks.pop_back();
         }
         else
         {
-            // Only the map has already been used in the current batch and it lacks space for the texture.
-            CloseOffBatch();
-            int newBatch = floor(texturesUsed.size() / MAX_TEXTURES_PER_BATCH);
-            texturesUsed.push_back(textureID);
-            texturesUsed.push_back(mapID);
-            return bundle = { newBatch, 0, 1 };
+            chunk = new QuadChunk();
         }
+
+        chunk->count = 0;
+        batch.chunks.push_back(chunk);
     }
-    else if (textureBatch == mapBatch && location == -1)
-    {
-        // Neither have been used and the current batch has space for both.
-        texturesUsed.push_back(textureID);
-        texturesUsed.push_back(mapID);
-        return bundle = { currentBatch, (float)((static_cast<int>(texturesUsed.size()) - 2) % MAX_TEXTURES_PER_BATCH), (float)((static_cast<int>(texturesUsed.size() - 1)) % MAX_TEXTURES_PER_BATCH) };
-    }
-    else
-    {
-        // Neither have been used and the current batch lacks space for both.
-        // Or some other mixture which needs fixing.
-        CloseOffBatch();
-        int newBatch = floor(texturesUsed.size() / MAX_TEXTURES_PER_BATCH);
-        texturesUsed.push_back(textureID);
-        texturesUsed.push_back(mapID);
-        return bundle = { newBatch, 0, 1 };
-    }
+
+    QuadChunk* chunk = batch.chunks.back();
+    batch.quadCount++;
+    return chunk->quads[chunk->count++];
 }
 
-Renderer::Renderer(GLuint whiteTexture) : batches(1), shader("assets/shaders/quad.vert", "assets/shaders/quad.frag"), whiteTextureID(whiteTexture)
+Renderer::Renderer(GLuint whiteTexture) : stream(MAX_QUADS_PER_DRAW * sizeof(Quad)), whiteTextureID(whiteTexture), shader("assets/shaders/quad.vert", "assets/shaders/quad.frag", true), frameData(sizeof(FrameData), FrameData::BINDING), batches(1)
 {
-    GLuint quadIBO;
-
     glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
 
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glGenBuffers(1, &quadIBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIBO);
-
-    glCheckError();
-
-    glBufferData(GL_ARRAY_BUFFER, Batch::MAX_QUADS * sizeof(Quad), nullptr, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &IBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
 
     glCheckError();
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, xCoord));
-    glEnableVertexAttribArray(0);
-    // rgba values for color
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, rColor));
-    glEnableVertexAttribArray(1);
-    // s and t coordinates for texture
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, sCoord));
-    glEnableVertexAttribArray(2);
-    // Texture Index
-    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, textureIndex));
-    glEnableVertexAttribArray(3);
-    // Map Index
-    glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, mapIndex));
-    glEnableVertexAttribArray(4);
-    // Dimensions Mod = 256 * (1 / [height or width])
-    glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, widthMod));
-    glEnableVertexAttribArray(5);
-    glCheckError();
+    setupVertexAttributes();
 
     // unsigned int quadVertices[] = {
     //     0, 1, 3,
@@ -196,8 +187,8 @@ Renderer::Renderer(GLuint whiteTexture) : batches(1), shader("assets/shaders/qua
     //     4, 5, 7,
     //     5, 6, 7
     // };
-    unsigned int quadIndices[Batch::MAX_QUADS * 6];
-    for (int i = 0; i < Batch::MAX_QUADS; i++)
+    unsigned int quadIndices[MAX_QUADS_PER_DRAW * 6];
+    for (int i = 0; i < MAX_QUADS_PER_DRAW; i++)
     {
         const int rightOffset = 4 * i;
         const int leftOffset = 6 * i;
@@ -216,8 +207,13 @@ Renderer::Renderer(GLuint whiteTexture) : batches(1), shader("assets/shaders/qua
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
+    // Anything else that was waiting to be built gets done along with ours.
+    Shader::BuildPending();
+    shader.BindBlock("FrameData", FrameData::BINDING);
+    particles.Setup();
+
     glUseProgram(shader.ID);
-    GLint location = glGetUniformLocation(shader.ID, "batchQuadTextures");
+    GLint location = shader.Uniform("batchQuadTextures");
     int samplers[MAX_TEXTURES_PER_BATCH];
     for (int i = 0; i < MAX_TEXTURES_PER_BATCH; i++)
     {
@@ -225,6 +221,10 @@ Renderer::Renderer(GLuint whiteTexture) : batches(1), shader("assets/shaders/qua
     }
     glUniform1iv(location, MAX_TEXTURES_PER_BATCH, samplers);
 
+    // Less-or-equal, so that of two quads at the same z the one drawn later still wins, like it did before there was a depth test.
+    alphaCutoffLocation = shader.Uniform("alphaCutoff");
+    glDepthFunc(GL_LEQUAL);
+
     // Use white texture as the first texture
     // -----------------------------------------
     this->textureIDs.push_back(whiteTexture);
@@ -232,19 +232,53 @@ Renderer::Renderer(GLuint whiteTexture) : batches(1), shader("assets/shaders/qua
     whiteTextureIndex = 0.0f;
 }
 
+void Renderer::setupVertexAttributes()
+{
+    // This has to be redone whenever the stream buffer gets recreated,
+    // since the VAO remembers which buffer each attribute came from.
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, stream.ID);
+
+    describeVertexLayout();
+}
+
+void Renderer::describeVertexLayout()
+{
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, xCoord));
+    glEnableVertexAttribArray(0);
+    // rgba values for color
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, rColor));
+    glEnableVertexAttribArray(1);
+    // s and t coordinates for texture
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, sCoord));
+    glEnableVertexAttribArray(2);
+    // Texture Index
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, textureIndex));
+    glEnableVertexAttribArray(3);
+    // Map Index
+    glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, mapIndex));
+    glEnableVertexAttribArray(4);
+    // Dimensions Mod = 256 * (1 / [height or width])
+    glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, widthMod));
+    glEnableVertexAttribArray(5);
+    glCheckError();
+}
+
 void Renderer::prepareQuad(glm::vec2 position, float width, float height, float scaleX, float scaleY,
     glm::vec4 rgb, int textureID, int mapID)
 {
     // Figure out which batch should be written to
     // -------------------------------------------
     Bundle bundle = DetermineBatch(textureID, mapID);
-    Batch& batch = batches[bundle.batch];
 
+    buildPointQuad(nextQuad(bundle.batch), position, 0.0f, width, height, scaleX, scaleY, rgb, bundle.textureLocation, bundle.mapLocation);
+}
+
+void Renderer::buildPointQuad(Quad& quad, glm::vec2 position, float z, float width, float height, float scaleX, float scaleY,
+    glm::vec4 rgb, float textureSlot, float mapSlot)
+{
     // Initialize the data for the quad
     // --------------------------------
-    Quad& quad = batch.quadBuffer[batch.quadIndex];
-    batch.quadIndex++;
-
     const float rightX = position.x + ((width * scaleX) / 2.0f);
     const float leftX = position.x - ((width * scaleX) / 2.0f);
     const float topY = position.y + ((height * scaleY) / 2.0f);
@@ -255,10 +289,10 @@ void Renderer::prepareQuad(glm::vec2 position, float width, float height, float
     const float b = rgb.b;
     const float a = rgb.a;
 
-    quad.topRight = { rightX, topY,      r, g, b, a,   1.0, 1.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-    quad.bottomRight = { rightX, bottomY,   r, g, b, a,   1.0, 0.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-    quad.bottomLeft = { leftX,  bottomY,   r, g, b, a,   0.0, 0.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-    quad.topLeft = { leftX,  topY,      r, g, b, a,   0.0, 1.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
+    quad.topRight = { rightX, topY, z,      r, g, b, a,   1.0, 1.0,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
+    quad.bottomRight = { rightX, bottomY, z,   r, g, b, a,   1.0, 0.0,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
+    quad.bottomLeft = { leftX,  bottomY, z,   r, g, b, a,   0.0, 0.0,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
+    quad.topLeft = { leftX,  topY, z,      r, g, b, a,   0.0, 1.0,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
 }
 
 void Renderer::prepareQuad(GlobalPositionComponent* pos, float width, float height, float scaleX, float scaleY,
@@ -267,8 +301,26 @@ void Renderer::prepareQuad(GlobalPositionComponent* pos, float width, float heig
     // Figure out which batch should be written to
     // -------------------------------------------
     Bundle bundle = DetermineBatch(textureID, mapID);
-    Batch& batch = batches[bundle.batch];
 
+    buildSpriteQuad(nextQuad(bundle.batch), glm::vec2(pos->x, pos->y), pos->z, pos->rotation, width, height, scaleX, scaleY, rgb, bundle.textureLocation, bundle.mapLocation, tiled, flippedX, flippedY);
+}
+
+void Renderer::buildSpriteQuad(Quad& quad, glm::vec2 center, float z, float rotation, float width, float height, float scaleX, float scaleY,
+    glm::vec4 rgb, float textureSlot, float mapSlot, bool tiled, bool flippedX, bool flippedY)
+{
+    // Initialize the data for the quad
+    // --------------------------------
+    const float halfWidth = (width * scaleX) / 2.0f;
+    const float halfHeight = (height * scaleY) / 2.0f;
+
+    glm::vec2 corners[4];
+    QuadKernels::CornersScalar(1, &center.x, &center.y, &halfWidth, &halfHeight, &rotation, corners);
+
+    fillSpriteQuad(quad, corners, z, width, height, rgb, textureSlot, mapSlot, tiled, flippedX, flippedY);
+}
+
+void Renderer::fillSpriteQuad(Quad& quad, const glm::vec2* corners, float z, float width, float height, glm::vec4 rgb, float textureSlot, float mapSlot, bool tiled, bool flippedX, bool flippedY)
+{
     float xL = 0.0f;
     float yL = 0.0f;
     float xR = 1.0f;
@@ -286,13 +338,10 @@ void Renderer::prepareQuad(GlobalPositionComponent* pos, float width, float heig
         yR = 0.0f;
     }
 
-    // Initialize the data for the quad
-    // --------------------------------
-
-    const glm::vec2 topRight = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(((width * scaleX) / 2.0f), ((height * scaleY) / 2.0f)));
-    const glm::vec2 bottomRight = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(((width * scaleX) / 2.0f), -((height * scaleY) / 2.0f)));
-    const glm::vec2 bottomLeft = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(-((width * scaleX) / 2.0f), -((height * scaleY) / 2.0f)));
-    const glm::vec2 topLeft = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(-((width * scaleX) / 2.0f), ((height * scaleY) / 2.0f)));
+    const glm::vec2 topRight = corners[0];
+    const glm::vec2 bottomRight = corners[1];
+    const glm::vec2 bottomLeft = corners[2];
+    const glm::vec2 topLeft = corners[3];
 
     const float r = rgb.r;
     const float g = rgb.g;
@@ -301,39 +350,49 @@ void Renderer::prepareQuad(GlobalPositionComponent* pos, float width, float heig
 
     if (tiled)
     {
-        Quad& quad = batch.quadBuffer[batch.quadIndex];
-        batch.quadIndex++;
-
         const float xMod = fmod(width, width); // tWidth);
         const float yMod = fmod(height, height); // tHeight);
 
-        quad.topRight = { topRight.x, topRight.y,      r, g, b, a,   xMod, yMod,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-        quad.bottomRight = { bottomRight.x, bottomRight.y,   r, g, b, a,   xMod, 0.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-        quad.bottomLeft = { bottomLeft.x,  bottomLeft.y,   r, g, b, a,   0.0, 0.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-        quad.topLeft = { topLeft.x,  topLeft.y,      r, g, b, a,   0.0, yMod,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
+        quad.topRight = { topRight.x, topRight.y, z,      r, g, b, a,   xMod, yMod,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
+        quad.bottomRight = { bottomRight.x, bottomRight.y, z,   r, g, b, a,   xMod, 0.0,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
+        quad.bottomLeft = { bottomLeft.x,  bottomLeft.y, z,   r, g, b, a,   0.0, 0.0,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
+        quad.topLeft = { topLeft.x,  topLeft.y, z,      r, g, b, a,   0.0, yMod,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
     }
     else
     {
-        Quad& quad = batch.quadBuffer[batch.quadIndex];
-        batch.quadIndex++;
-
-        quad.topRight = { topRight.x, topRight.y,      r, g, b, a,   xR, yR,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-        quad.bottomRight = { bottomRight.x, bottomRight.y,   r, g, b, a,   xR, yL,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-        quad.bottomLeft = { bottomLeft.x,  bottomLeft.y,   r, g, b, a,   xL, yL,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-        quad.topLeft = { topLeft.x,  topLeft.y,      r, g, b, a,   xL, yR,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
+        quad.topRight = { topRight.x, topRight.y, z,      r, g, b, a,   xR, yR,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
+        quad.bottomRight = { bottomRight.x, bottomRight.y, z,   r, g, b, a,   xR, yL,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
+        quad.bottomLeft = { bottomLeft.x,  bottomLeft.y, z,   r, g, b, a,   xL, yL,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
+        quad.topLeft = { topLeft.x,  topLeft.y, z,      r, g, b, a,   xL, yR,    textureSlot, mapSlot, CalculateModifier(width), CalculateModifier(height) };
     }
 }
 
-
 void Renderer::prepareQuad(GlobalPositionComponent* pos, float width, float height, float scaleX, float scaleY,
     glm::vec4 rgb, int animID, int mapID, int cellX, int cellY, int cols, int rows, bool flippedX, bool flippedY)
 {
     // Figure out which batch should be written to
     // -------------------------------------------
     Bundle bundle = DetermineBatch(animID, mapID);
-    Batch& batch = batches[bundle.batch];
 
-    
+    buildCellQuad(nextQuad(bundle.batch), glm::vec2(pos->x, pos->y), pos->z, pos->rotation, width, height, scaleX, scaleY, rgb, bundle.textureLocation, bundle.mapLocation, cellX, cellY, cols, rows, flippedX, flippedY);
+}
+
+void Renderer::buildCellQuad(Quad& quad, glm::vec2 center, float z, float rotation, float width, float height, float scaleX, float scaleY,
+    glm::vec4 rgb, float textureSlot, float mapSlot, int cellX, int cellY, int cols, int rows, bool flippedX, bool flippedY)
+{
+    // Initialize the data for the quad
+    // --------------------------------
+    const float halfWidth = (width * scaleX) / (float)cols;
+    const float halfHeight = (height * scaleY) / (float)rows;
+
+    glm::vec2 corners[4];
+    QuadKernels::CornersScalar(1, &center.x, &center.y, &halfWidth, &halfHeight, &rotation, corners);
+
+    fillCellQuad(quad, corners, z, width, height, rgb, textureSlot, mapSlot, cellX, cellY, cols, rows, flippedX, flippedY);
+}
+
+void Renderer::fillCellQuad(Quad& quad, const glm::vec2* corners, float z, float width, float height, glm::vec4 rgb, float textureSlot, float mapSlot, int cellX, int cellY, int cols, int rows, bool flippedX, bool flippedY)
+{
     // Figure out how cells should be handled.
     // ---------------------------------------
     float cellXMod = 1.0f / cols;
@@ -360,18 +419,10 @@ void Renderer::prepareQuad(GlobalPositionComponent* pos, float width, float heig
         uvY1 = tempY0;
     }
 
-    /*std::cout << std::to_string(uvX0) + "/" + std::to_string(uvY0) + "\n";
-    std::cout << std::to_string(uvX1) + "/" + std::to_string(uvY1) + "\n";*/
-
-    // Initialize the data for the quad
-    // --------------------------------
-    Quad& quad = batch.quadBuffer[batch.quadIndex];
-    batch.quadIndex++;
-
-    const glm::vec2 topRight = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(((width * scaleX) / (float)cols), ((height * scaleY) / (float)rows)));
-    const glm::vec2 bottomRight = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(((width * scaleX) / (float)cols), -((height * scaleY) / (float)rows)));
-    const glm::vec2 bottomLeft = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(-((width * scaleX) / (float)cols), -((height * scaleY) / (float)rows)));
-    const glm::vec2 topLeft = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(-((width * scaleX) / (float)cols), ((height * scaleY) / (float)rows)));
+    const glm::vec2 topRight = corners[0];
+    const glm::vec2 bottomRight = corners[1];
+    const glm::vec2 bottomLeft = corners[2];
+    const glm::vec2 topLeft = corners[3];
 
     const float r = rgb.r;
     const float g = rgb.g;
@@ -381,40 +432,20 @@ void Renderer::prepareQuad(GlobalPositionComponent* pos, float width, float heig
     float w = width / cols;
     float h = height / rows;
 
-    quad.topRight = { topRight.x, topRight.y,      r, g, b, a,   uvX1, uvY1,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(w), CalculateModifier(h) };
-    quad.bottomRight = { bottomRight.x, bottomRight.y,   r, g, b, a,   uvX1, uvY0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(w), CalculateModifier(h) };
-    quad.bottomLeft = { bottomLeft.x,  bottomLeft.y,   r, g, b, a,   uvX0, uvY0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(w), CalculateModifier(h) };
-    quad.topLeft = { topLeft.x,  topLeft.y,      r, g, b, a,   uvX0, uvY1,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(w), CalculateModifier(h) };
+    quad.topRight = { topRight.x, topRight.y, z,      r, g, b, a,   uvX1, uvY1,    textureSlot, mapSlot, CalculateModifier(w), CalculateModifier(h) };
+    quad.bottomRight = { bottomRight.x, bottomRight.y, z,   r, g, b, a,   uvX1, uvY0,    textureSlot, mapSlot, CalculateModifier(w), CalculateModifier(h) };
+    quad.bottomLeft = { bottomLeft.x,  bottomLeft.y, z,   r, g, b, a,   uvX0, uvY0,    textureSlot, mapSlot, CalculateModifier(w), CalculateModifier(h) };
+    quad.topLeft = { topLeft.x,  topLeft.y, z,      r, g, b, a,   uvX0, uvY1,    textureSlot, mapSlot, CalculateModifier(w), CalculateModifier(h) };
 }
 
-
 void Renderer::prepareQuad(GlobalPositionComponent* pos, ColliderComponent* col, float width, float height, float scaleX, float scaleY,
     glm::vec4 rgb, int textureID, int mapID)
 {
     // Figure out which batch should be written to
     // -------------------------------------------
     Bundle bundle = DetermineBatch(textureID, mapID);
-    Batch& batch = batches[bundle.batch];
 
-    // Initialize the data for the quad
-    // --------------------------------
-    Quad& quad = batch.quadBuffer[batch.quadIndex];
-    batch.quadIndex++;
-
-    const glm::vec2 topRight = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(((width * scaleX) / 2.0f), ((height * scaleY) / 2.0f)));
-    const glm::vec2 bottomRight = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(((width * scaleX) / 2.0f), -((height * scaleY) / 2.0f)));
-    const glm::vec2 bottomLeft = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(-((width * scaleX) / 2.0f), -((height * scaleY) / 2.0f)));
-    const glm::vec2 topLeft = glm::vec2(pos->x, pos->y) + pos->Rotate(glm::vec2(-((width * scaleX) / 2.0f), ((height * scaleY) / 2.0f)));
-
-    const float r = rgb.r;
-    const float g = rgb.g;
-    const float b = rgb.b;
-    const float a = rgb.a;
-
-    quad.topRight = { topRight.x, topRight.y,      r, g, b, a,   1.0, 1.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-    quad.bottomRight = { bottomRight.x, bottomRight.y,   r, g, b, a,   1.0, 0.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-    quad.bottomLeft = { bottomLeft.x,  bottomLeft.y,   r, g, b, a,   0.0, 0.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-    quad.topLeft = { topLeft.x,  topLeft.y,      r, g, b, a,   0.0, 1.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
+    buildSpriteQuad(nextQuad(bundle.batch), glm::vec2(pos->x, pos->y), pos->z, pos->rotation, width, height, scaleX, scaleY, rgb, bundle.textureLocation, bundle.mapLocation, false, false, false);
 }
 
 void Renderer::prepareQuad(glm::vec2 topRight, glm::vec2 bottomRight, glm::vec2 bottomLeft, glm::vec2 topLeft,
@@ -423,12 +454,10 @@ void Renderer::prepareQuad(glm::vec2 topRight, glm::vec2 bottomRight, glm::vec2
     // Figure out which batch should be written to
     // -------------------------------------------
     Bundle bundle = DetermineBatch(textureID, mapID);
-    Batch& batch = batches[bundle.batch];
 
     // Initialize the data for the quad
     // --------------------------------
-    Quad& quad = batch.quadBuffer[batch.quadIndex];
-    batch.quadIndex++;
+    Quad& quad = nextQuad(bundle.batch);
 
     const float r = rgb.r;
     const float g = rgb.g;
@@ -437,36 +466,69 @@ void Renderer::prepareQuad(glm::vec2 topRight, glm::vec2 bottomRight, glm::vec2
 
     float width = topRight.x - topLeft.x;
     float height = topRight.y - bottomRight.y;
+    const float z = 0.0f;
 
-    quad.topRight = { topRight.x * scaleX, topRight.y * scaleY,      r, g, b, a,   1.0, 1.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-    quad.bottomRight = { bottomRight.x * scaleX, bottomRight.y * scaleY,   r, g, b, a,   1.0, 0.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-    quad.bottomLeft = { bottomLeft.x * scaleX,  bottomLeft.y * scaleY,   r, g, b, a,   0.0, 0.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
-    quad.topLeft = { topLeft.x * scaleX,  topLeft.y * scaleY,      r, g, b, a,   0.0, 1.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
+    quad.topRight = { topRight.x * scaleX, topRight.y * scaleY, z,      r, g, b, a,   1.0, 1.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
+    quad.bottomRight = { bottomRight.x * scaleX, bottomRight.y * scaleY, z,   r, g, b, a,   1.0, 0.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
+    quad.bottomLeft = { bottomLeft.x * scaleX,  bottomLeft.y * scaleY, z,   r, g, b, a,   0.0, 0.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
+    quad.topLeft = { topLeft.x * scaleX,  topLeft.y * scaleY, z,      r, g, b, a,   0.0, 1.0,    bundle.textureLocation, bundle.mapLocation, CalculateModifier(width), CalculateModifier(height) };
 }
 
 void Renderer::prepareQuad(int batchIndex, Quad& input)
 {
-    Batch& batch = batches[batchIndex];
-    batch.quadBuffer[batch.quadIndex] = input;
-    batch.quadIndex++;
+    nextQuad(batchIndex) = input;
 }
 
 void Renderer::sendToGL()
 {
+    if (capture != nullptr)
+    {
+        capture->Record(*this);
+    }
+
+    drawCalls = 0;
+
+    FrameData frame;
+    frame.MVP = Game::main.projection * Game::main.view;
+    frameData.Update(&frame);
+
     shader.use();
-    shader.setMatrix("MVP", Game::main.projection * Game::main.view);
+
+    // Everything the systems queued up this frame gets sorted and turned into quads here.
+    uploadFrame();
+
+    // Retained stuff (level geometry and the like) is all hard-edged, so it goes in with the opaque pass.
+    setPassState(0);
+
+    for (const RetainedMesh* mesh : retainedMeshes)
+    {
+        mesh->Draw();
+        drawCalls++;
+    }
 
     int currentBatch = 0;
     int texUnit = 0;
 
     for (int i = 0; i < texturesUsed.size(); i++)
     {
-        glActiveTexture(GL_TEXTURE0 + texUnit);
-        glBindTexture(GL_TEXTURE_2D, textureIDs[texturesUsed[i] - 1]);
+        // The particles take over the texture units for a bit, so they have to go in before this batch binds its own.
+        if (texUnit == 0 && currentBatch == particleBatch)
+        {
+            drawParticles();
+        }
+
+        // Zeros are just padding left by CloseOffBatch(). Everything else is a texture's GL name,
+        // which (now that the palette cache makes textures of its own) isn't necessarily in textureIDs.
+        if (texturesUsed[i] != 0)
+        {
+            glActiveTexture(GL_TEXTURE0 + texUnit);
+            glBindTexture(GL_TEXTURE_2D, texturesUsed[i]);
+        }
 
         if (texUnit >= MAX_TEXTURES_PER_BATCH - 1)
         {
-            flush(batches[currentBatch]);
+            setPassState(currentBatch);
+            flush(batchAt(currentBatch));
 
             currentBatch++;
             texUnit = 0;
@@ -477,47 +539,294 @@ void Renderer::sendToGL()
         }
     }
 
-    flush(batches[currentBatch]);
+    setPassState(currentBatch);
+    flush(batchAt(currentBatch));
+
+    if (particleBatch > currentBatch)
+    {
+        drawParticles();
+    }
+
+    // Back to how everything else (the UI and so on) expects to find things.
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+    glUniform1f(alphaCutoffLocation, 0.0f);
+
+    // Nothing after this point reads from this frame's region, so the next time
+    // we come back around to it we just have to wait for this fence.
+    stream.Fence();
+}
+
+void Renderer::uploadFrame()
+{
+    queue.Prepare();
+    queuedQuads = queue.Size();
+    PaletteCache::main.BeginFrame();
+
+    // First, a quick pass on this thread to hand out texture slots. This is the only part that has to
+    // happen in order (a texture's slot depends on everything that came before it), and thanks to the
+    // sort and DetermineBatch()'s cache it's mostly just comparing two ints.
+    queuedBundles.resize(queuedQuads);
+    queuedPlaces.resize(queuedQuads);
+    std::fill(queuedPerBatch.begin(), queuedPerBatch.end(), 0);
+
+    // The translucent world sprites and the layers above the world each start a batch of their own,
+    // since sendToGL() draws them with different depth settings.
+    // The particles get drawn between the effects layer and the overlay, so the overlay starts another one if there's anything in it.
+    translucentBatch = INT_MAX;
+    overlayBatch = INT_MAX;
+    particleBatch = INT_MAX;
+
+    for (int i = 0; i < queuedQuads; i++)
+    {
+        if (i == queue.OpaqueCount() && i < queue.WorldCount())
+        {
+            translucentBatch = StartNewBatch();
+        }
+
+        if (i == queue.WorldCount())
+        {
+            overlayBatch = StartNewBatch();
+        }
+
+        if (i == queue.EffectsCount())
+        {
+            particleBatch = i > queue.WorldCount() ? StartNewBatch() : overlayBatch;
+        }
+
+        const DrawCommand& command = queue.Command(i);
+
+        // If the palette cache has (or now makes) a baked copy of this pair, that's the only texture we need.
+        const float cols = command.type == DrawCommand::Type::cell ? (float)command.cols : 1.0f;
+        const float rows = command.type == DrawCommand::Type::cell ? (float)command.rows : 1.0f;
+        const GLuint baked = PaletteCache::main.Resolve(command.textureID, command.mapID, CalculateModifier(command.width / cols), CalculateModifier(command.height / rows));
+
+        if (baked != 0)
+        {
+            queuedBundles[i] = DetermineBatch(baked, baked);
+            queuedBundles[i].mapLocation = -1.0f;
+        }
+        else
+        {
+            queuedBundles[i] = DetermineBatch(command.textureID, command.mapID);
+        }
+
+        const int b = queuedBundles[i].batch;
+        batchAt(b);
+
+        if (b >= static_cast<int>(queuedPerBatch.size()))
+        {
+            queuedPerBatch.resize(b + 1, 0);
+        }
+
+        queuedPlaces[i] = queuedPerBatch[b]++;
+    }
+
+    queuedPerBatch.resize(batches.size(), 0);
+    queuedStarts.resize(batches.size());
+
+    // Now that we know how big every batch is, give each one a contiguous block of this frame's region:
+    // whatever was prepared directly goes at the front, and the queued quads get built in right behind it.
+    GLsizeiptr frameBytes = 0;
+    for (int b = 0; b < batches.size(); b++)
+    {
+        frameBytes += (batches[b].quadCount + queuedPerBatch[b]) * sizeof(Quad);
+    }
+
+    if (stream.Reserve(frameBytes))
+    {
+        setupVertexAttributes();
+    }
+
+    stream.Begin();
+
+    for (int b = 0; b < batches.size(); b++)
+    {
+        Batch& batch = batches[b];
+        const int total = batch.quadCount + queuedPerBatch[b];
+
+        GLintptr offset;
+        Quad* block = static_cast<Quad*>(stream.Allocate(total * sizeof(Quad), offset));
+        batch.baseVertex = (GLint)(offset / sizeof(Vertex));
+
+        Quad* write = block;
+        for (const QuadChunk* chunk : batch.chunks)
+        {
+            std::memcpy(write, &chunk->quads[0], chunk->count * sizeof(Quad));
+            write += chunk->count;
+        }
+
+        queuedStarts[b] = write;
+        batch.quadCount = total;
+    }
+
+    // And then the actual quad building, which doesn't depend on anything but its own command,
+    // gets split up between however many threads we have, each writing straight into the buffer.
+    ThreadPool::main.ParallelFor(queuedQuads, 512, [this](int begin, int end, int worker)
+        {
+            buildQueuedQuads(begin, end);
+        });
+
+    stream.End();
+}
+
+void Renderer::buildQueuedQuads(int begin, int end)
+{
+    // The corners for a whole run of commands get worked out in one go (see quad_kernels.h),
+    // and then each quad's filled in around them.
+    constexpr int RUN = 256;
+    float centerX[RUN];
+    float centerY[RUN];
+    float halfWidth[RUN];
+    float halfHeight[RUN];
+    float rotation[RUN];
+    glm::vec2 corners[RUN * 4];
+
+    for (int runStart = begin; runStart < end; runStart += RUN)
+    {
+        const int count = std::min(RUN, end - runStart);
+
+        for (int k = 0; k < count; k++)
+        {
+            const DrawCommand& command = queue.Command(runStart + k);
+            centerX[k] = command.x;
+            centerY[k] = command.y;
+
+            if (command.type == DrawCommand::Type::cell)
+            {
+                halfWidth[k] = (command.width * command.scaleX) / (float)command.cols;
+                halfHeight[k] = (command.height * command.scaleY) / (float)command.rows;
+            }
+            else
+            {
+                halfWidth[k] = (command.width * command.scaleX) / 2.0f;
+                halfHeight[k] = (command.height * command.scaleY) / 2.0f;
+            }
+
+            rotation[k] = command.type == DrawCommand::Type::point ? 0.0f : command.rotation;
+        }
+
+        QuadKernels::Corners(count, centerX, centerY, halfWidth, halfHeight, rotation, corners);
+
+        for (int k = 0; k < count; k++)
+        {
+            const int i = runStart + k;
+            const DrawCommand& command = queue.Command(i);
+            const Bundle& bundle = queuedBundles[i];
+            Quad& quad = queuedStarts[bundle.batch][queuedPlaces[i]];
+
+            if (command.type == DrawCommand::Type::cell)
+            {
+                fillCellQuad(quad, corners + 4 * k, command.z, command.width, command.height, command.rgb, bundle.textureLocation, bundle.mapLocation, command.cellX, command.cellY, command.cols, command.rows, command.flippedX, command.flippedY);
+            }
+            else
+            {
+                // Points are just sprites that don't rotate, flip or tile.
+                const bool sprite = command.type == DrawCommand::Type::sprite;
+                fillSpriteQuad(quad, corners + 4 * k, command.z, command.width, command.height, command.rgb, bundle.textureLocation, bundle.mapLocation, sprite && command.tiled, sprite && command.flippedX, sprite && command.flippedY);
+            }
+        }
+    }
 }
 
 void Renderer::prepareDownLine(float x, float y, float height)
 {
     constexpr float halfWidth = 0.5f;
+    constexpr float z = 0.0f;
     Quad quad;
-    quad.topRight = { x + halfWidth, y,            1.0f, 1.0f, 1.0f, 1.0f,   1.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
-    quad.bottomRight = { x + halfWidth, y - height,   1.0f, 1.0f, 1.0f, 1.0f,   1.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
-    quad.bottomLeft = { x - halfWidth, y - height,   1.0f, 1.0f, 1.0f, 1.0f,   0.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
-    quad.topLeft = { x - halfWidth, y,            1.0f, 1.0f, 1.0f, 1.0f,   0.0f, 1.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
+    quad.topRight = { x + halfWidth, y, z,            1.0f, 1.0f, 1.0f, 1.0f,   1.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
+    quad.bottomRight = { x + halfWidth, y - height, z,   1.0f, 1.0f, 1.0f, 1.0f,   1.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
+    quad.bottomLeft = { x - halfWidth, y - height, z,   1.0f, 1.0f, 1.0f, 1.0f,   0.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
+    quad.topLeft = { x - halfWidth, y, z,            1.0f, 1.0f, 1.0f, 1.0f,   0.0f, 1.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
     prepareQuad(0, quad);
 }
 
 void Renderer::prepareRightLine(float x, float y, float width)
 {
     constexpr float halfHeight = 0.5f;
+    constexpr float z = 0.0f;
     Quad quad;
-    quad.topRight = { x + width, y + halfHeight, 1.0f, 1.0f, 1.0f, 1.0f,   1.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
-    quad.bottomRight = { x + width, y - halfHeight, 1.0f, 1.0f, 1.0f, 1.0f,   1.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
-    quad.bottomLeft = { x        , y - halfHeight, 1.0f, 1.0f, 1.0f, 1.0f,   0.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
-    quad.topLeft = { x        , y + halfHeight, 1.0f, 1.0f, 1.0f, 1.0f,   0.0f, 1.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
+    quad.topRight = { x + width, y + halfHeight, z, 1.0f, 1.0f, 1.0f, 1.0f,   1.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
+    quad.bottomRight = { x + width, y - halfHeight, z, 1.0f, 1.0f, 1.0f, 1.0f,   1.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
+    quad.bottomLeft = { x        , y - halfHeight, z, 1.0f, 1.0f, 1.0f, 1.0f,   0.0f, 0.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
+    quad.topLeft = { x        , y + halfHeight, z, 1.0f, 1.0f, 1.0f, 1.0f,   0.0f, 1.0f,    whiteTextureIndex, whiteTextureIndex, 8, 8 };
     prepareQuad(0, quad);
 }
 
 void Renderer::flush(const Batch& batch)
 {
+    // The data's already sitting in the stream buffer; we just have to point the draw at it.
+    // Anything past what the index buffer covers spills over into another draw call.
     glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO); // Must bind VBO before glBufferSubData
-    // glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIBO);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, batch.quadIndex * sizeof(Quad), &batch.quadBuffer[0]);
-    glDrawElements(GL_TRIANGLES, batch.quadIndex * 6, GL_UNSIGNED_INT, nullptr);
+
+    for (int first = 0; first < batch.quadCount; first += MAX_QUADS_PER_DRAW)
+    {
+        const int count = std::min(batch.quadCount - first, MAX_QUADS_PER_DRAW);
+        glDrawElementsBaseVertex(GL_TRIANGLES, count * 6, GL_UNSIGNED_INT, nullptr, batch.baseVertex + first * 4);
+        drawCalls++;
+    }
+}
+
+void Renderer::setPassState(int batch)
+{
+    // Opaque quads (drawn front to back) test and write depth, and throw away their see-through pixels
+    // rather than blending them. Translucent world quads (back to front) still test against that depth,
+    // so anything opaque in front of them hides them, but don't write it, since they have to blend.
+    // The layers above the world don't look at depth at all; they're drawn in order over the top of it.
+    if (batch >= overlayBatch)
+    {
+        glDisable(GL_DEPTH_TEST);
+        glDepthMask(GL_FALSE);
+        glUniform1f(alphaCutoffLocation, 0.0f);
+    }
+    else if (batch >= translucentBatch)
+    {
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_FALSE);
+        glUniform1f(alphaCutoffLocation, 0.0f);
+    }
+    else
+    {
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glUniform1f(alphaCutoffLocation, 0.5f);
+    }
+}
+
+void Renderer::drawParticles()
+{
+    drawCalls += particles.Draw();
+
+    // And back to the batches' shader (the pass state gets set again before the next flush).
+    shader.use();
+}
+
+void Renderer::submitRetained(const RetainedMesh* mesh)
+{
+    retainedMeshes.push_back(mesh);
+}
+
+void Renderer::withdrawRetained(const RetainedMesh* mesh)
+{
+    retainedMeshes.erase(std::remove(retainedMeshes.begin(), retainedMeshes.end(), mesh), retainedMeshes.end());
 }
 
 void Renderer::resetBuffers()
 {
+    retainedMeshes.clear();
+    queue.Clear();
+
+    lastTextureID = -1;
+    lastMapID = -1;
+
     texturesUsed.clear();
     texturesUsed.push_back(whiteTextureID);
 
+    // Hang on to the chunks for next frame rather than freeing them.
     for (Batch& batch : batches)
     {
-        batch.quadIndex = 0;
+        spareChunks.insert(spareChunks.end(), batch.chunks.begin(), batch.chunks.end());
+        batch.chunks.clear();
+        batch.quadCount = 0;
     }
 }
@@ -2,26 +2,36 @@
 #define RENDERER_H
 
 // Renderer.h just contains all the data we're gonna need for renderer.cpp to do its job.
-// There might be a bug in here right now, having to do with max quad count, but we'll
-// fix that at some point in the future (if it is, in fact, a problem, which it may well not be).
+// There used to be a hard cap on how many quads a batch could hold (and nothing stopping us
+// from writing past it); batches are now made of chunks that grow as needed, see QuadChunk.
 
 #include <array>
+#include <climits>
 #include <vector>
 #include <glm/glm.hpp>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "shader.h"
+#include "stream_buffer.h"
+#include "render_queue.h"
+#include "particle_renderer.h"
+#include "uniform_buffer.h"
 // #include "texture_2D.h"
 #include "animation_2D.h"
 
 class GlobalPositionComponent;
 class ColliderComponent;
+class RetainedMesh;
+class FrameCapture;
 
 struct Vertex
 {
     float xCoord;
     float yCoord;
 
+    // World z, which is what the depth test goes by (see sendToGL()).
+    float zCoord;
+
     float rColor;
     float gColor;
     float bColor;
@@ -53,15 +63,26 @@ public:
     float mapLocation;
 };
 
+// A fixed-size block of quads. Batches are built out of as many of these as they
+// need over the course of a frame, and once the frame's been drawn the renderer
+// holds on to them for the next one instead of freeing them.
+struct QuadChunk
+{
+    static constexpr int CAPACITY = 1024;
+
+    std::array<Quad, CAPACITY> quads;
+    int count = 0;
+};
+
 // Store the quads before a draw call
 class Batch
 {
 public:
-    static constexpr int MAX_QUADS = 10000;
+    std::vector<QuadChunk*> chunks;
+    int quadCount = 0;
 
-    // TODO: Look into decoupling # of quads that can be rendered with # of textures that can be rendered in one batch
-    std::array<Quad, MAX_QUADS> quadBuffer;
-    int quadIndex = 0;
+    // Where this batch's vertices start in the stream buffer this frame.
+    GLint baseVertex = 0;
 };
 
 // A batch renderer for quads with a color and sprite
@@ -73,18 +94,27 @@ public:
     // NOTE: Fragment shader also has hard-coded value that must match this.
     static constexpr int MAX_TEXTURES_PER_BATCH = 32;
 
+    // How many quads the index buffer covers, and so how many we can draw in one call.
+    // Batches bigger than this just get split into several draws.
+    static constexpr int MAX_QUADS_PER_DRAW = 10000;
+
     std::vector<GLuint> textureIDs;
     std::vector<GLuint> texturesUsed;
     float whiteTextureIndex;
 
     GLuint VAO;
-    GLuint VBO;
+
+    // All the vertex data goes through here now; see stream_buffer.h.
+    StreamBuffer stream;
 
     GLuint whiteTextureID;
 
     Renderer(GLuint whiteTexture);
-    float CalculateModifier(float i);
+    static float CalculateModifier(float i);
     void CloseOffBatch();
+
+    // Closes off the current batch and makes sure nothing more goes into it. Returns the new batch's index.
+    int StartNewBatch();
     Bundle DetermineBatch(int textureID, int mapID);
     void prepareQuad(GlobalPositionComponent* pos, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, int textureID, int mapID, bool tiled, bool flippedX, bool flippedY);
     void prepareQuad(GlobalPositionComponent* pos, ColliderComponent* col, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, int textureID, int mapID);
@@ -98,10 +128,89 @@ public:
     void sendToGL();
     void resetBuffers();
 
+    // Where systems put what they want drawn; see render_queue.h.
+    RenderQueue queue;
+
+    // Particles skip the queue (and the batches) altogether; see particle_renderer.h.
+    ParticleRenderer particles;
+
+    // How many quads the queue had this frame (they're built straight into the stream buffer, so they
+    // never show up in a batch's chunks).
+    int queuedQuads = 0;
+
+    // How many draw calls the last sendToGL() made, retained meshes included.
+    int drawCalls = 0;
+
+    // If set, every frame gets recorded into it at the top of sendToGL(); see frame_capture.h.
+    FrameCapture* capture = nullptr;
+
+    // These fill in a quad without touching any batch; the texture and map slots are whatever the
+    // caller has arranged for them to be. prepareQuad(), the queue and the retained meshes all use them.
+    static void buildSpriteQuad(Quad& quad, glm::vec2 center, float z, float rotation, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, float textureSlot, float mapSlot, bool tiled, bool flippedX, bool flippedY);
+    static void buildCellQuad(Quad& quad, glm::vec2 center, float z, float rotation, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, float textureSlot, float mapSlot, int cellX, int cellY, int cols, int rows, bool flippedX, bool flippedY);
+    static void buildPointQuad(Quad& quad, glm::vec2 position, float z, float width, float height, float scaleX, float scaleY, glm::vec4 rgb, float textureSlot, float mapSlot);
+
+    // Retained meshes (see static_layer.h) already live on the GPU; submitting one
+    // just means it gets drawn this frame, before the batches and along with the opaque pass.
+    void submitRetained(const RetainedMesh* mesh);
+
+    // Takes a mesh back off this frame's list, for whoever's about to delete one they've already submitted.
+    void withdrawRetained(const RetainedMesh* mesh);
+
+    // Points the currently bound VAO's attributes at the currently bound VBO, laid out as Vertex.
+    static void describeVertexLayout();
+
+    // The shared index buffer (six indices per quad, MAX_QUADS_PER_DRAW quads' worth).
+    GLuint IBO;
+    Shader shader;
+
+    // Per-frame uniforms shared by every shader; see uniform_buffer.h.
+    UniformBuffer frameData;
+
 private:
+    // The capture reads the frame straight out of the batches, and the replay puts it back in.
+    friend class FrameCapture;
+
     std::vector<Batch> batches;
-    Shader shader;
+    std::vector<QuadChunk*> spareChunks;
+    std::vector<const RetainedMesh*> retainedMeshes;
+
+    // The last answer DetermineBatch() gave, since it's very often asked the same question twice in a row.
+    int lastTextureID = -1;
+    int lastMapID = -1;
+    Bundle lastBundle;
+
+    Bundle FindSlots(int textureID, int mapID);
+
+    // Per queued command (in draw order): which batch and slots it got, and which of that batch's queued quads it is.
+    std::vector<Bundle> queuedBundles;
+    std::vector<int> queuedPlaces;
+
+    // Per batch: how many queued quads it got, and where in the stream buffer they start.
+    std::vector<int> queuedPerBatch;
+    std::vector<Quad*> queuedStarts;
+
+    // The first batch of the translucent pass and of the layers above the world (INT_MAX if there aren't any);
+    // see setPassState().
+    int translucentBatch = INT_MAX;
+    int overlayBatch = INT_MAX;
+
+    // The particles go in just before this batch (after all of them, if it's INT_MAX).
+    int particleBatch = INT_MAX;
+    GLint alphaCutoffLocation = -1;
+
+    void uploadFrame();
+    void setPassState(int batch);
+    void drawParticles();
+    void buildQueuedQuads(int begin, int end);
+
+    // The builders above, minus working out where the corners go.
+    static void fillSpriteQuad(Quad& quad, const glm::vec2* corners, float z, float width, float height, glm::vec4 rgb, float textureSlot, float mapSlot, bool tiled, bool flippedX, bool flippedY);
+    static void fillCellQuad(Quad& quad, const glm::vec2* corners, float z, float width, float height, glm::vec4 rgb, float textureSlot, float mapSlot, int cellX, int cellY, int cols, int rows, bool flippedX, bool flippedY);
 
+    Batch& batchAt(int index);
+    Quad& nextQuad(int batchIndex);
+    void setupVertexAttributes();
     void flush(const Batch& batch);
 };
 
@@ -0,0 +1,75 @@
+#include "rng.h"
+
+#include <chrono>
+
+// See rng.h.
+
+#pragma region Random Stream
+
+void RandomStream::Seed(uint64_t seed)
+{
+    // Four splitmix64 outputs in a row; xoshiro can't start from all zeroes, and this never gives that.
+    uint64_t z = seed;
+
+    for (uint64_t& word : state)
+    {
+        z += 0x9E3779B97F4A7C15ull;
+        word = RngService::Mix(z);
+    }
+}
+
+int RandomStream::Range(int low, int high)
+{
+    // The top 32 bits scaled into the range with a multiply rather than a %, which is faster and (for ranges
+    // as small as ours) just as even.
+    const uint64_t span = static_cast<uint64_t>(static_cast<int64_t>(high) - low + 1);
+    return low + static_cast<int>(((Next() >> 32) * span) >> 32);
+}
+
+void RandomStream::Fill(uint32_t* out, int count)
+{
+    int i = 0;
+
+    // Each number is good for two.
+    for (; i + 2 <= count; i += 2)
+    {
+        const uint64_t bits = Next();
+        out[i] = static_cast<uint32_t>(bits >> 32);
+        out[i + 1] = static_cast<uint32_t>(bits);
+    }
+
+    if (i < count)
+    {
+        out[i] = static_cast<uint32_t>(Next() >> 32);
+    }
+}
+
+#pragma endregion
+
+#pragma region Service
+
+uint64_t RngService::Mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+uint64_t RngService::Key(const char* name)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (const char* c = name; *c != '\0'; c++)
+    {
+        hash = (hash ^ static_cast<unsigned char>(*c)) * 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+uint64_t RngService::ClockSeed()
+{
+    return static_cast<uint64_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+}
+
+#pragma endregion
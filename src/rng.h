@@ -0,0 +1,76 @@
+#ifndef RNG_H
+#define RNG_H
+
+// Where everything random comes from, instead of srand()/rand(), which are slow, shared between every thread
+// (so they fight over them) and can't be replayed. There's one run seed (from "--seed <n>", or the clock, and
+// printed at startup either way), and everything else is derived from it:
+//
+//  - Derive(key) turns it into a seed for whoever asks by that key (Key("particles"), say), so each system
+//    gets numbers of its own that don't change when some other system starts using more of them.
+//  - Stream(key) is a generator seeded that way, for a system to keep and draw from (the particle engine
+//    seeds its chunks' generators from one, say).
+//
+// The generators are xoshiro256** (seeded through splitmix64, like its authors suggest): a few shifts and
+// a multiply per number, and good enough for anything we're doing. Run the same seed with the same
+// settings (and "--deterministic", if threads are involved) and you get the same run.
+
+#include <cstdint>
+
+class RandomStream
+{
+public:
+    RandomStream() { Seed(0); }
+    explicit RandomStream(uint64_t seed) { Seed(seed); }
+
+    void Seed(uint64_t seed);
+
+    uint64_t Next()
+    {
+        const uint64_t result = Rotate(state[1] * 5, 7) * 9;
+        const uint64_t t = state[1] << 17;
+
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = Rotate(state[3], 45);
+
+        return result;
+    }
+
+    // From low to high, inclusive of both.
+    int Range(int low, int high);
+
+    // count numbers at once, for things that want a whole array's worth (like the particle kernels' lanes).
+    void Fill(uint32_t* out, int count);
+
+private:
+    uint64_t state[4];
+
+    static uint64_t Rotate(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+class RngService
+{
+public:
+    static RngService main;
+
+    uint64_t seed = 0;
+
+    void Seed(uint64_t runSeed) { seed = runSeed; }
+
+    // Splitmix64's finalizer: scrambles every bit of x into every bit of the result.
+    static uint64_t Mix(uint64_t x);
+
+    // A key for a name (FNV-1a), for Derive() and Stream().
+    static uint64_t Key(const char* name);
+
+    uint64_t Derive(uint64_t key) const { return Mix(seed ^ Mix(key)); }
+    RandomStream Stream(uint64_t key) const { return RandomStream(Derive(key)); }
+
+    // A seed from the clock, for when nobody asked for a particular one.
+    static uint64_t ClockSeed();
+};
+
+#endif
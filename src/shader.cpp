@@ -1,15 +1,22 @@
 #include "shader.h"
+#include <algorithm>
 #include <glm/gtc/type_ptr.hpp>
+#include "gl_extensions.h"
+#include "program_cache.h"
 
 // This is where we create shaders.
 // We only use two shader files right now,
 // but if we ever add more it may get more complicated.
+// Uniform locations are looked up once, right after linking, rather than on every set*() call,
+// and anything that every shader wants each frame (like the camera) lives in a uniform buffer instead.
+// Linked programs get saved by the program cache (see program_cache.h), so usually nothing
+// actually gets compiled at all after the first launch.
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath)
+std::vector<Shader*> Shader::pending;
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, bool deferred) : vertexPath(vertexPath), fragmentPath(fragmentPath)
 {
     // 1. Retrieve the vertex/fragment source code from filePath
-    std::string vertexCode;
-    std::string fragmentCode;
     std::ifstream vShaderFile;
     std::ifstream fShaderFile;
 
@@ -36,55 +43,189 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath)
     {
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ in " << vertexPath << " or " << fragmentPath << '\n';
     }
+
+    if (deferred)
+    {
+        pending.push_back(this);
+    }
+    else
+    {
+        StartBuild();
+        FinishBuild();
+    }
+}
+
+Shader::~Shader()
+{
+    pending.erase(std::remove(pending.begin(), pending.end(), this), pending.end());
+}
+
+void Shader::BuildPending()
+{
+    // Asking whether a compile or link worked makes the driver finish it then and there, so we
+    // start every one of them before asking about any. That way a driver that compiles in the
+    // background (see GLExtensions::parallelShaderCompile) gets to do them all at once.
+    for (Shader* shader : pending)
+    {
+        shader->StartBuild();
+    }
+
+    for (Shader* shader : pending)
+    {
+        shader->FinishBuild();
+    }
+
+    pending.clear();
+}
+
+void Shader::StartBuild()
+{
+    // 2. See if we've already got this program lying around from last time
+    cacheKey = ProgramCache::Key(vertexCode, fragmentCode);
+    ID = glCreateProgram();
+
+    if (ProgramCache::Load(ID, cacheKey))
+    {
+        fromCache = true;
+        return;
+    }
+
+    // It's no good to us, so start over with a fresh program.
+    glDeleteProgram(ID);
+    ID = glCreateProgram();
+
+    // 3. Compile shaders (we'll check how that went in FinishBuild())
     const char* vShaderCode = vertexCode.c_str();
     const char* fShaderCode = fragmentCode.c_str();
 
-    // 2. Compile shaders
-    GLuint vertex;
-    GLuint fragment;
-    int success;
-    char infoLog[512];
-
     // Vertex shader
     vertex = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vertex, 1, &vShaderCode, NULL);
     glCompileShader(vertex);
-    // Print compile errors if any
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED in " << vertexPath << "\n" << infoLog << '\n';
-    }
 
     // Fragment shader
     fragment = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fragment, 1, &fShaderCode, NULL);
     glCompileShader(fragment);
-    // Print compile errors if any
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-    if (!success)
+
+    // Shader program
+    if (GLExtensions::programBinary)
     {
-        glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED in " << fragmentPath << "\n" << infoLog << '\n';
+        GLExtensions::glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     }
 
-    // Shader program
-    ID = glCreateProgram();
     glAttachShader(ID, vertex);
     glAttachShader(ID, fragment);
     glLinkProgram(ID);
-    // Print linking errors if any
-    glGetProgramiv(ID, GL_LINK_STATUS, &success);
-    if (!success)
+}
+
+void Shader::FinishBuild()
+{
+    if (!fromCache)
     {
-        glGetProgramInfoLog(ID, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << '\n';
+        int success;
+        char infoLog[512];
+
+        // Print compile errors if any
+        glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(vertex, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED in " << vertexPath << "\n" << infoLog << '\n';
+        }
+
+        glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(fragment, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED in " << fragmentPath << "\n" << infoLog << '\n';
+        }
+
+        // Print linking errors if any
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(ID, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << '\n';
+        }
+        else
+        {
+            ProgramCache::Save(ID, cacheKey);
+        }
+
+        // Delete the shaders as they're linked into our program now and no longer necessary
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+    }
+
+    // We won't be needing the sources again.
+    vertexCode.clear();
+    vertexCode.shrink_to_fit();
+    fragmentCode.clear();
+    fragmentCode.shrink_to_fit();
+
+    ReflectUniforms();
+}
+
+void Shader::ReflectUniforms()
+{
+    // Ask the program what uniforms it actually ended up with (the compiler throws out any
+    // that aren't used) and remember where each one lives, so nobody has to ask by name again.
+    GLint count = 0;
+    GLint maxLength = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+    std::string name(maxLength > 0 ? maxLength : 1, '\0');
+
+    for (GLint i = 0; i < count; i++)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(ID, i, maxLength, &length, &size, &type, &name[0]);
+
+        const std::string uniformName = name.substr(0, length);
+        const GLint location = glGetUniformLocation(ID, uniformName.c_str());
+
+        // Members of uniform blocks don't have locations; they're set through the block's buffer instead.
+        if (location == -1)
+        {
+            continue;
+        }
+
+        uniforms[uniformName] = location;
+
+        // Arrays come back as "name[0]", but it's nicer to be able to ask for just "name". The rest of the
+        // elements don't come back at all, and needn't be laid out one after another, so ask after each of them.
+        if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+        {
+            const std::string arrayName = uniformName.substr(0, uniformName.size() - 3);
+            uniforms[arrayName] = location;
+
+            for (GLint element = 1; element < size; element++)
+            {
+                const std::string elementName = arrayName + "[" + std::to_string(element) + "]";
+                uniforms[elementName] = glGetUniformLocation(ID, elementName.c_str());
+            }
+        }
     }
+}
 
-    // Delete the shaders as they're linked into our program now and no longer necessary
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+GLint Shader::Uniform(const std::string& name) const
+{
+    auto found = uniforms.find(name);
+    return found != uniforms.end() ? found->second : -1;
+}
+
+void Shader::BindBlock(const char* blockName, GLuint bindingPoint) const
+{
+    const GLuint index = glGetUniformBlockIndex(ID, blockName);
+
+    if (index != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding(ID, index, bindingPoint);
+    }
 }
 
 
@@ -95,25 +236,50 @@ void Shader::use()
 
 void Shader::setBool(const std::string& name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    setBool(Uniform(name), value);
 }
 
 void Shader::setInt(const std::string& name, int value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    setInt(Uniform(name), value);
 }
 
 void Shader::setFloat(const std::string& name, float value) const
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    setFloat(Uniform(name), value);
 }
 
 void Shader::setMatrix(const std::string& name, const glm::mat4& value) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+    setMatrix(Uniform(name), value);
 }
 
 void Shader::setVector3f(const std::string& name, const glm::vec3& value) const
 {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+    setVector3f(Uniform(name), value);
+}
+
+void Shader::setBool(GLint location, bool value) const
+{
+    glUniform1i(location, (int)value);
+}
+
+void Shader::setInt(GLint location, int value) const
+{
+    glUniform1i(location, value);
+}
+
+void Shader::setFloat(GLint location, float value) const
+{
+    glUniform1f(location, value);
+}
+
+void Shader::setMatrix(GLint location, const glm::mat4& value) const
+{
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::setVector3f(GLint location, const glm::vec3& value) const
+{
+    glUniform3fv(location, 1, glm::value_ptr(value));
 }
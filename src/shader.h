@@ -6,10 +6,13 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <cstdint>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 
 class Shader
 {
@@ -17,16 +20,59 @@ public:
     // The program ID
     GLuint ID;
 
-    // Constructor reads and builds the shader
-    Shader(const char* vertexPath, const char* fragmentPath);
+    // Constructor reads and builds the shader. A deferred shader only reads its sources and
+    // waits for BuildPending(), which builds every deferred shader at once; it mustn't be used before then.
+    Shader(const char* vertexPath, const char* fragmentPath, bool deferred = false);
+    ~Shader();
+
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
+
+    static void BuildPending();
     // Use/activate the shader
     void use();
+
+    // Every active uniform's location, looked up once when the program's linked. Arrays can be asked
+    // for by element ("name[3]"), and "name" on its own is the same as "name[0]".
+    // Returns -1 (which glUniform* quietly ignores) for anything the program doesn't have.
+    // Hang on to the result if you're setting something every frame.
+    GLint Uniform(const std::string& name) const;
+
+    // Points one of the program's uniform blocks at a binding point; see uniform_buffer.h.
+    void BindBlock(const char* blockName, GLuint bindingPoint) const;
+
     // Utility uniform functions
     void setBool(const std::string& name, bool value) const;
     void setInt(const std::string& name, int value) const;
     void setFloat(const std::string& name, float value) const;
     void setMatrix(const std::string& name, const glm::mat4& value) const;
     void setVector3f(const std::string& name, const glm::vec3& value) const;
+
+    // The same again, for locations you've already got from Uniform().
+    void setBool(GLint location, bool value) const;
+    void setInt(GLint location, int value) const;
+    void setFloat(GLint location, float value) const;
+    void setMatrix(GLint location, const glm::mat4& value) const;
+    void setVector3f(GLint location, const glm::vec3& value) const;
+
+private:
+    static std::vector<Shader*> pending;
+
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string vertexCode;
+    std::string fragmentCode;
+
+    uint64_t cacheKey = 0;
+    bool fromCache = false;
+    GLuint vertex = 0;
+    GLuint fragment = 0;
+
+    std::unordered_map<std::string, GLint> uniforms;
+
+    void StartBuild();
+    void FinishBuild();
+    void ReflectUniforms();
 };
 
 #endif
@@ -0,0 +1,294 @@
+#include "static_layer.h"
+
+#include <algorithm>
+#include <cmath>
+#include "check_error.h"
+#include "component.h"
+#include "entity.h"
+#include "game.h"
+#include "palette_cache.h"
+
+// See static_layer.h for the what and why.
+
+#pragma region Retained Mesh
+
+static void SetSlots(Quad& quad, float textureSlot, float mapSlot)
+{
+    quad.topRight.textureIndex = quad.bottomRight.textureIndex = quad.bottomLeft.textureIndex = quad.topLeft.textureIndex = textureSlot;
+    quad.topRight.mapIndex = quad.bottomRight.mapIndex = quad.bottomLeft.mapIndex = quad.topLeft.mapIndex = mapSlot;
+}
+
+static float SlotFor(std::vector<GLuint>& textures, GLuint texture)
+{
+    auto found = std::find(textures.begin(), textures.end(), texture);
+
+    if (found != textures.end())
+    {
+        return static_cast<float>(found - textures.begin());
+    }
+
+    textures.push_back(texture);
+    return static_cast<float>(textures.size() - 1);
+}
+
+RetainedMesh::~RetainedMesh()
+{
+    ReleaseBaked();
+
+    if (VAO != 0)
+    {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+    }
+}
+
+void RetainedMesh::ReleaseBaked()
+{
+    for (GLuint texture : baked)
+    {
+        PaletteCache::main.Release(texture);
+    }
+
+    baked.clear();
+}
+
+void RetainedMesh::Build(const std::vector<RetainedQuad>& input)
+{
+    pages.clear();
+    staging.clear();
+    staging.reserve(input.size());
+
+    // Hang on to the old bakes until we've asked for the new ones, since they'll mostly be the same.
+    std::vector<GLuint> previous;
+    previous.swap(baked);
+
+    for (RetainedQuad q : input)
+    {
+        // Static geometry's the best case for the palette cache: the same pairs, drawn at the same size, forever.
+        const GLuint palette = PaletteCache::main.Acquire(q.texture, q.map, q.quad.topRight.widthMod, q.quad.topRight.heightMod);
+
+        if (palette != 0)
+        {
+            baked.push_back(palette);
+            q.texture = palette;
+            q.map = palette;
+        }
+
+        if (pages.empty())
+        {
+            pages.push_back({ {}, 0, 0 });
+        }
+
+        Page* page = &pages.back();
+
+        const bool hasTexture = std::find(page->textures.begin(), page->textures.end(), q.texture) != page->textures.end();
+        const bool hasMap = std::find(page->textures.begin(), page->textures.end(), q.map) != page->textures.end();
+        const int needed = (hasTexture ? 0 : 1) + (hasMap || q.map == q.texture ? 0 : 1);
+
+        if (page->textures.size() + needed > Renderer::MAX_TEXTURES_PER_BATCH)
+        {
+            pages.push_back({ {}, static_cast<int>(staging.size()), 0 });
+            page = &pages.back();
+        }
+
+        staging.push_back(q.quad);
+        const float textureSlot = SlotFor(page->textures, q.texture);
+        const float mapSlot = SlotFor(page->textures, q.map);
+        SetSlots(staging.back(), textureSlot, palette != 0 ? -1.0f : mapSlot);
+        page->quadCount++;
+    }
+
+    for (GLuint texture : previous)
+    {
+        PaletteCache::main.Release(texture);
+    }
+
+    quadCount = static_cast<int>(staging.size());
+
+    if (VAO == 0)
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Game::main.renderer->IBO);
+        Renderer::describeVertexLayout();
+    }
+
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, staging.size() * sizeof(Quad), staging.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    glCheckError();
+}
+
+void RetainedMesh::Draw() const
+{
+    if (quadCount == 0)
+    {
+        return;
+    }
+
+    glBindVertexArray(VAO);
+
+    for (const Page& page : pages)
+    {
+        for (int t = 0; t < page.textures.size(); t++)
+        {
+            glActiveTexture(GL_TEXTURE0 + t);
+            glBindTexture(GL_TEXTURE_2D, page.textures[t]);
+        }
+
+        for (int first = 0; first < page.quadCount; first += Renderer::MAX_QUADS_PER_DRAW)
+        {
+            const int count = std::min(page.quadCount - first, Renderer::MAX_QUADS_PER_DRAW);
+            glDrawElementsBaseVertex(GL_TRIANGLES, count * 6, GL_UNSIGNED_INT, nullptr, (page.firstQuad + first) * 4);
+        }
+    }
+}
+
+#pragma endregion
+
+#pragma region Static Layer
+
+StaticLayer::Chunk* StaticLayer::ChunkFor(StaticSpriteComponent* sprite)
+{
+    const int scene = sprite->entity->Get_Scene();
+    const int cx = static_cast<int>(std::floor(sprite->pos->x / CHUNK_SIZE));
+    const int cy = static_cast<int>(std::floor(sprite->pos->y / CHUNK_SIZE));
+
+    Chunk*& chunk = chunks[std::make_tuple(scene, cx, cy)];
+
+    if (chunk == nullptr)
+    {
+        chunk = new Chunk();
+        chunk->scene = scene;
+    }
+
+    return chunk;
+}
+
+void StaticLayer::Add(StaticSpriteComponent* sprite)
+{
+    Chunk* chunk = ChunkFor(sprite);
+    chunk->sprites.push_back(sprite);
+    chunk->dirty = true;
+    owners[sprite] = chunk;
+}
+
+void StaticLayer::Remove(StaticSpriteComponent* sprite)
+{
+    auto owner = owners.find(sprite);
+
+    if (owner == owners.end())
+    {
+        return;
+    }
+
+    Chunk* chunk = owner->second;
+    chunk->sprites.erase(std::remove(chunk->sprites.begin(), chunk->sprites.end(), sprite), chunk->sprites.end());
+    chunk->dirty = true;
+    owners.erase(owner);
+}
+
+void StaticLayer::Invalidate(StaticSpriteComponent* sprite)
+{
+    // It may well have moved into a different chunk, so just take it out and put it back.
+    Remove(sprite);
+    Add(sprite);
+}
+
+// Whether a sprite goes in its chunk's mesh at all.
+static bool Drawn(const StaticSpriteComponent* s)
+{
+    return s->active && s->pos->z < Game::main.camZ;
+}
+
+void StaticLayer::Rebuild(Chunk* chunk)
+{
+    chunk->dirty = false;
+    rebuiltChunks++;
+
+    chunk->baked.resize(chunk->sprites.size());
+
+    for (int i = 0; i < chunk->sprites.size(); i++)
+    {
+        chunk->baked[i] = Drawn(chunk->sprites[i]);
+    }
+
+    // Sorting happens once here rather than every frame.
+    std::vector<StaticSpriteComponent*> sorted = chunk->sprites;
+    std::stable_sort(sorted.begin(), sorted.end(), [](StaticSpriteComponent* a, StaticSpriteComponent* b)
+        {
+            return a->pos->z < b->pos->z;
+        });
+
+    buildQuads.clear();
+
+    chunk->leftX = INFINITY;
+    chunk->rightX = -INFINITY;
+    chunk->bottomY = INFINITY;
+    chunk->topY = -INFINITY;
+
+    for (StaticSpriteComponent* s : sorted)
+    {
+        if (!Drawn(s))
+        {
+            continue;
+        }
+
+        RetainedQuad q;
+        q.texture = s->sprite->ID;
+        q.map = s->mapTex->ID;
+        Renderer::buildSpriteQuad(q.quad, glm::vec2(s->pos->x, s->pos->y), s->pos->z, s->pos->rotation, s->width, s->height, s->scaleX, s->scaleY, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), 0.0f, 0.0f, s->tiled, s->flippedX, s->flippedY);
+        buildQuads.push_back(q);
+
+        for (const Vertex* v : { &q.quad.topRight, &q.quad.bottomRight, &q.quad.bottomLeft, &q.quad.topLeft })
+        {
+            chunk->leftX = std::min(chunk->leftX, v->xCoord);
+            chunk->rightX = std::max(chunk->rightX, v->xCoord);
+            chunk->bottomY = std::min(chunk->bottomY, v->yCoord);
+            chunk->topY = std::max(chunk->topY, v->yCoord);
+        }
+    }
+
+    chunk->mesh.Build(buildQuads);
+}
+
+void StaticLayer::Update(int activeScene)
+{
+    visibleChunks = 0;
+
+    for (auto& entry : chunks)
+    {
+        Chunk* chunk = entry.second;
+
+        if (chunk->scene != activeScene && chunk->scene != 0)
+        {
+            continue;
+        }
+
+        // Nobody tells us when a sprite's turned on or off (or the camera's moved past it), so see if any of them have.
+        for (int i = 0; i < chunk->sprites.size() && !chunk->dirty; i++)
+        {
+            chunk->dirty = Drawn(chunk->sprites[i]) != chunk->baked[i];
+        }
+
+        if (chunk->dirty)
+        {
+            Rebuild(chunk);
+        }
+
+        if (chunk->mesh.quadCount > 0 &&
+            chunk->rightX > Game::main.leftX && chunk->leftX < Game::main.rightX &&
+            chunk->topY > Game::main.bottomY && chunk->bottomY < Game::main.topY)
+        {
+            visibleChunks++;
+            Game::main.renderer->submitRetained(&chunk->mesh);
+        }
+    }
+}
+
+#pragma endregion
@@ -0,0 +1,110 @@
+#ifndef STATIC_LAYER_H
+#define STATIC_LAYER_H
+
+// Most of what we draw in a level never moves, so there's not much point in rebuilding it every frame.
+// A RetainedMesh is a set of quads that gets uploaded to its own buffer once and then just redrawn,
+// and the StaticLayer is what keeps all the static sprites (those whose position component is marked
+// stat, unless they're translucent) baked into such meshes, one per chunk of the world. Chunks only get rebuilt when something
+// in them changes, and we only test whole chunks against the camera rather than every sprite.
+//
+// The catch is that the layer can't tell when a static sprite has been changed, so anything
+// that moves, resizes or re-textures one needs to call StaticLayer::main.Invalidate(). The exception is
+// whether it's drawn at all (it's active and below the camera): that's just a bool per sprite, so it's
+// checked against what was baked every frame, and turning one on or off rebuilds its chunk by itself.
+
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "renderer.h"
+
+class StaticSpriteComponent;
+
+// A quad along with the textures it wants; RetainedMesh::Build() sorts out the slots.
+struct RetainedQuad
+{
+    Quad quad;
+    GLuint texture;
+    GLuint map;
+};
+
+class RetainedMesh
+{
+public:
+    int quadCount = 0;
+
+    RetainedMesh() = default;
+    ~RetainedMesh();
+    RetainedMesh(const RetainedMesh&) = delete;
+    RetainedMesh& operator=(const RetainedMesh&) = delete;
+
+    // Replaces whatever was in the mesh. Quads are drawn in the order they're given.
+    void Build(const std::vector<RetainedQuad>& quads);
+    void Draw() const;
+
+private:
+    // Each page is a run of quads that fits in one set of texture units.
+    struct Page
+    {
+        std::vector<GLuint> textures;
+        int firstQuad;
+        int quadCount;
+    };
+
+    GLuint VAO = 0;
+    GLuint VBO = 0;
+    std::vector<Page> pages;
+    std::vector<Quad> staging;
+
+    // Baked textures (see palette_cache.h) we're holding onto for as long as the mesh uses them.
+    std::vector<GLuint> baked;
+
+    void ReleaseBaked();
+};
+
+class StaticLayer
+{
+public:
+    static StaticLayer main;
+
+    // World units per side of a chunk.
+    static constexpr float CHUNK_SIZE = 512.0f;
+
+    // Just so we can see what it's doing.
+    int visibleChunks = 0;
+    int rebuiltChunks = 0;
+
+    void Add(StaticSpriteComponent* sprite);
+    void Remove(StaticSpriteComponent* sprite);
+    void Invalidate(StaticSpriteComponent* sprite);
+
+    // Rebuilds whatever's dirty and hands the chunks the camera can see to the renderer.
+    void Update(int activeScene);
+
+private:
+    struct Chunk
+    {
+        int scene;
+        std::vector<StaticSpriteComponent*> sprites;
+        RetainedMesh mesh;
+        bool dirty = true;
+
+        // Per sprite, whether it was drawn as of the last rebuild.
+        std::vector<bool> baked;
+
+        // The bounds of what was actually baked, which can spill past the chunk's own square.
+        float leftX = 0.0f;
+        float rightX = 0.0f;
+        float bottomY = 0.0f;
+        float topY = 0.0f;
+    };
+
+    std::map<std::tuple<int, int, int>, Chunk*> chunks;
+    std::unordered_map<StaticSpriteComponent*, Chunk*> owners;
+    std::vector<RetainedQuad> buildQuads;
+
+    Chunk* ChunkFor(StaticSpriteComponent* sprite);
+    void Rebuild(Chunk* chunk);
+};
+
+#endif
@@ -0,0 +1,223 @@
+#include "stream_buffer.h"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include "check_error.h"
+#include "gl_extensions.h"
+
+// See stream_buffer.h for the general idea. The only real subtlety here is that
+// the non-persistent path maps with GL_MAP_UNSYNCHRONIZED_BIT, which is only safe
+// because we've already waited on the fence for the region we're about to write.
+
+StreamBuffer::StreamBuffer(GLsizeiptr regionSize) : regionSize(regionSize)
+{
+    persistent = GLExtensions::bufferStorage;
+    Create();
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    Destroy();
+}
+
+void StreamBuffer::Create()
+{
+    glGenBuffers(1, &ID);
+    glBindBuffer(GL_ARRAY_BUFFER, ID);
+
+    const GLsizeiptr totalSize = regionSize * REGION_COUNT;
+
+    if (persistent)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLExtensions::glBufferStorage(GL_ARRAY_BUFFER, totalSize, nullptr, flags);
+        persistentPointer = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, totalSize, flags);
+
+        if (persistentPointer == nullptr)
+        {
+            // Shouldn't happen if the extension says it's there, but if it does, just start over the old way.
+            std::cout << "ERROR::STREAM_BUFFER::PERSISTENT_MAP_FAILED, falling back to unsynchronized mapping\n";
+            glDeleteBuffers(1, &ID);
+            persistent = false;
+            Create();
+            return;
+        }
+    }
+    else
+    {
+        glBufferData(GL_ARRAY_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+    }
+
+    glCheckError();
+}
+
+void StreamBuffer::Destroy()
+{
+    for (int r = 0; r < REGION_COUNT; r++)
+    {
+        if (fences[r] != nullptr)
+        {
+            glDeleteSync(fences[r]);
+            fences[r] = nullptr;
+        }
+    }
+
+    if (persistentPointer != nullptr)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, ID);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        persistentPointer = nullptr;
+    }
+
+    glDeleteBuffers(1, &ID);
+}
+
+bool StreamBuffer::Reserve(GLsizeiptr bytes)
+{
+    if (bytes <= regionSize)
+    {
+        return false;
+    }
+
+    // We're about to throw away the old buffer, so everything that's still reading from it has to finish.
+    for (int r = 0; r < REGION_COUNT; r++)
+    {
+        WaitForRegion(r);
+    }
+
+    Destroy();
+
+    while (regionSize < bytes)
+    {
+        regionSize *= 2;
+    }
+
+    region = 0;
+    Create();
+    return true;
+}
+
+void StreamBuffer::WaitForRegion(int r)
+{
+    if (fences[r] == nullptr)
+    {
+        return;
+    }
+
+    GLenum status = glClientWaitSync(fences[r], 0, 0);
+
+    if (status == GL_TIMEOUT_EXPIRED)
+    {
+        // The GPU hasn't caught up with the frame that last used this region, so we actually have to wait.
+        stalls++;
+        windowStalls++;
+
+        while (status == GL_TIMEOUT_EXPIRED)
+        {
+            status = glClientWaitSync(fences[r], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        }
+    }
+
+    glDeleteSync(fences[r]);
+    fences[r] = nullptr;
+}
+
+void StreamBuffer::Begin()
+{
+    region = (region + 1) % REGION_COUNT;
+    regionUsed = 0;
+    overflow.clear();
+
+    WaitForRegion(region);
+
+    glBindBuffer(GL_ARRAY_BUFFER, ID);
+
+    if (persistent)
+    {
+        mapped = persistentPointer + region * regionSize;
+    }
+    else
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        mapped = (char*)glMapBufferRange(GL_ARRAY_BUFFER, region * regionSize, regionSize, flags);
+
+        if (mapped == nullptr)
+        {
+            std::cout << "ERROR::STREAM_BUFFER::MAP_FAILED\n";
+            glCheckError();
+        }
+    }
+}
+
+GLintptr StreamBuffer::Write(const void* data, GLsizeiptr bytes)
+{
+    GLintptr offset;
+    void* destination = Allocate(bytes, offset);
+    std::memcpy(destination, data, bytes);
+    return offset;
+}
+
+void* StreamBuffer::Allocate(GLsizeiptr bytes, GLintptr& offset)
+{
+    // Callers are expected to have Reserve()'d enough room for the whole frame before calling Begin().
+    assert(regionUsed + bytes <= regionSize);
+
+    if (regionUsed + bytes > regionSize)
+    {
+        std::cout << "ERROR::STREAM_BUFFER::OVERFLOW\n";
+        offset = region * regionSize;
+        overflow.emplace_back(bytes);
+        return overflow.back().data();
+    }
+
+    offset = region * regionSize + regionUsed;
+    char* destination;
+
+    if (mapped != nullptr)
+    {
+        destination = mapped + regionUsed;
+    }
+    else
+    {
+        if (fallback.size() < regionSize)
+        {
+            fallback.resize(regionSize);
+        }
+
+        destination = fallback.data() + regionUsed;
+    }
+
+    regionUsed += bytes;
+    bytesUploaded += bytes;
+    windowBytes += bytes;
+
+    return destination;
+}
+
+void StreamBuffer::End()
+{
+    if (!persistent && mapped != nullptr)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, ID);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    else if (mapped == nullptr && regionUsed > 0)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, ID);
+        glBufferSubData(GL_ARRAY_BUFFER, region * regionSize, regionUsed, fallback.data());
+    }
+
+    mapped = nullptr;
+}
+
+void StreamBuffer::Fence()
+{
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void StreamBuffer::ResetCounters()
+{
+    windowBytes = 0;
+    windowStalls = 0;
+}
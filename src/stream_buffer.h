@@ -0,0 +1,75 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+// The stream buffer is where the renderer puts each frame's vertices on their way to the GPU.
+// Rather than writing over the same VBO every batch (which makes the driver wait for the last
+// draw that used it to finish), we split one big buffer into a few regions and rotate through them,
+// one region per frame. Each region gets a fence once we've drawn from it, so we only ever wait
+// if the GPU is more than REGION_COUNT frames behind us (and we count it when that happens).
+
+#include <vector>
+#include <glad/glad.h>
+
+class StreamBuffer
+{
+public:
+    static constexpr int REGION_COUNT = 3;
+
+    GLuint ID;
+
+    // Whether we got a persistent, coherent mapping (GL 4.4 / ARB_buffer_storage)
+    // or have to fall back to mapping each region unsynchronized every frame.
+    bool persistent;
+
+    // Running totals, for the stats printout.
+    unsigned long long bytesUploaded = 0;
+    unsigned long long stalls = 0;
+
+    // The same numbers for the last full second (or however often someone calls ResetCounters()).
+    unsigned long long windowBytes = 0;
+    unsigned long long windowStalls = 0;
+
+    StreamBuffer(GLsizeiptr regionSize);
+    ~StreamBuffer();
+
+    // Makes sure a region can hold at least this many bytes. Returns true if the buffer had to be
+    // recreated, in which case whoever owns the VAO needs to point its attributes at the new one.
+    bool Reserve(GLsizeiptr bytes);
+
+    // Begin() waits (if it has to) for the next region to come free and maps it. Write() then copies
+    // data in and hands back the byte offset (from the start of the whole buffer) where it landed.
+    // End() unmaps before any draws, and Fence() should be called right after the last draw
+    // that reads from this region.
+    void Begin();
+    GLintptr Write(const void* data, GLsizeiptr bytes);
+
+    // Like Write(), but hands back somewhere to write the data instead of copying it in.
+    // The pointer's only good until End(), but it's fine to fill it in from other threads.
+    void* Allocate(GLsizeiptr bytes, GLintptr& offset);
+    void End();
+    void Fence();
+
+    void ResetCounters();
+
+private:
+    GLsizeiptr regionSize;
+    int region = 0;
+    GLsizeiptr regionUsed = 0;
+    GLsync fences[REGION_COUNT] = {};
+
+    char* persistentPointer = nullptr;
+    char* mapped = nullptr;
+
+    // If mapping ever fails we write here instead and upload it the old-fashioned way in End().
+    std::vector<char> fallback;
+
+    // Anything that didn't fit in the region (because somebody forgot to Reserve()) gets written here
+    // and thrown away at the next Begin(), rather than over whatever comes after the region.
+    std::vector<std::vector<char>> overflow;
+
+    void Create();
+    void Destroy();
+    void WaitForRegion(int r);
+};
+
+#endif
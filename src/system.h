@@ -26,6 +26,7 @@ class PlayerAnimationControllerComponent;
 class ParticleComponent;
 class AIComponent;
 class ImageComponent;
+class TilemapComponent;
 class Entity;
 
 class System
@@ -39,8 +40,12 @@ public:
 class StaticRenderingSystem : public System
 {
 public:
+	// Sprites that can move, which we have to redo every frame.
 	vector<StaticSpriteComponent*> sprites;
 
+	// Sprites on static positions, which live in the static layer instead.
+	vector<StaticSpriteComponent*> bakedSprites;
+
 	void Update(int activeScene, float deltaTime);
 
 	void AddComponent(Component* component);
@@ -103,11 +108,17 @@ class ParticleSystem : public System
 public:
 	vector<ParticleComponent*> particles;
 
+	// Emitters whose entity didn't have a position yet; they aren't registered with Visibility until it does.
+	vector<ParticleComponent*> waiting;
+
 	void Update(int activeScene, float deltaTime);
 
 	void AddComponent(Component* component);
 
 	void PurgeEntity(Entity* e);
+
+	// Looks the emitter's position up again; false if its entity still hasn't got one.
+	static bool FindPosition(ParticleComponent* p);
 };
 
 class AISystem : public System
@@ -133,4 +144,29 @@ public:
 
 	void PurgeEntity(Entity* e);
 };
+
+class TilemapSystem : public System
+{
+public:
+	// Chunks that have been off screen for this long give up their meshes; a 1000x1000 floor
+	// baked all at once would be a couple hundred megabytes of vertices, most of which nobody's looking at.
+	static constexpr int EVICT_FRAMES = 600;
+
+	vector<TilemapComponent*> tilemaps;
+
+	int frame = 0;
+
+	// Just so we can see what it's doing.
+	int visibleChunks = 0;
+	int rebuiltChunks = 0;
+
+	void Update(int activeScene, float deltaTime);
+
+	void AddComponent(Component* component);
+
+	void PurgeEntity(Entity* e);
+
+private:
+	void Rebuild(TilemapComponent* t, int chunkX, int chunkY);
+};
 #endif
@@ -0,0 +1,124 @@
+#include "thread_pool.h"
+
+// See thread_pool.h. Each ParallelFor() bumps the generation, which is what the
+// worker threads are waiting on; they grab pieces off a shared atomic counter
+// until it runs past the end and then report back.
+
+static thread_local int workerIndex = 0;
+
+ThreadPool::~ThreadPool()
+{
+    Stop();
+}
+
+void ThreadPool::Start(int extraThreads)
+{
+    for (int i = 0; i < extraThreads; i++)
+    {
+        threads.emplace_back(&ThreadPool::WorkerLoop, this, i + 1);
+    }
+}
+
+void ThreadPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& t : threads)
+    {
+        t.join();
+    }
+
+    threads.clear();
+    stopping = false;
+}
+
+int ThreadPool::CurrentWorker()
+{
+    return workerIndex;
+}
+
+void ThreadPool::ParallelFor(int count, int grain, const std::function<void(int, int, int)>& job)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    if (grain < 1)
+    {
+        grain = 1;
+    }
+
+    // Not worth waking anybody up for.
+    if (threads.empty() || count <= grain)
+    {
+        job(0, count, CurrentWorker());
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->job = &job;
+        this->count = count;
+        this->grain = grain;
+        next = 0;
+        busy = static_cast<int>(threads.size());
+        generation++;
+    }
+    wake.notify_all();
+
+    RunPieces(CurrentWorker());
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return busy == 0; });
+    this->job = nullptr;
+}
+
+void ThreadPool::RunPieces(int worker)
+{
+    while (true)
+    {
+        const int begin = next.fetch_add(grain);
+
+        if (begin >= count)
+        {
+            return;
+        }
+
+        const int end = begin + grain < count ? begin + grain : count;
+        (*job)(begin, end, worker);
+    }
+}
+
+void ThreadPool::WorkerLoop(int index)
+{
+    workerIndex = index;
+    unsigned long long seen = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+
+            if (stopping)
+            {
+                return;
+            }
+
+            seen = generation;
+        }
+
+        RunPieces(index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy--;
+        }
+        done.notify_one();
+    }
+}
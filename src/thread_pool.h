@@ -0,0 +1,54 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// A very small thread pool for the few bits of a frame that split up nicely (like building quads).
+// It only does one thing: ParallelFor() cuts a range into pieces and has every worker (including
+// whichever thread called it) chew through pieces until there are none left, then returns.
+// Don't call ParallelFor() from inside a job; the pool isn't built for nesting.
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    static ThreadPool main;
+
+    ~ThreadPool();
+
+    // Spins up this many extra threads; the thread calling ParallelFor() always pitches in as well.
+    void Start(int extraThreads);
+    void Stop();
+
+    // Including the calling thread, so this is always at least 1.
+    int WorkerCount() const { return static_cast<int>(threads.size()) + 1; }
+
+    // 0 for the main thread (or anything else outside the pool), 1 and up for the pool's own threads.
+    static int CurrentWorker();
+
+    // Calls job(begin, end, worker) over [0, count) in pieces of (at most) grain.
+    void ParallelFor(int count, int grain, const std::function<void(int, int, int)>& job);
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(int, int, int)>* job = nullptr;
+    std::atomic<int> next{ 0 };
+    int count = 0;
+    int grain = 1;
+    int busy = 0;
+    unsigned long long generation = 0;
+    bool stopping = false;
+
+    void WorkerLoop(int index);
+    void RunPieces(int worker);
+};
+
+#endif
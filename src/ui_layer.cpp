@@ -0,0 +1,222 @@
+#include "ui_layer.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include <glm/gtc/matrix_transform.hpp>
+#include "check_error.h"
+#include "component.h"
+#include "entity.h"
+#include "game.h"
+#include "shader.h"
+#include "uniform_buffer.h"
+
+// See ui_layer.h. UI coordinates are like world coordinates with the camera fixed at (0, 0):
+// the middle of the screen is the origin, and Game::main.uiZoom does for the UI what zoom does for the world.
+
+void UILayer::Add(ImageComponent* image)
+{
+    images.push_back(image);
+    dirty = true;
+}
+
+void UILayer::Remove(ImageComponent* image)
+{
+    images.erase(std::remove(images.begin(), images.end(), image), images.end());
+    dirty = true;
+}
+
+void UILayer::Invalidate()
+{
+    dirty = true;
+}
+
+void UILayer::SetScene(int activeScene)
+{
+    if (activeScene != scene)
+    {
+        scene = activeScene;
+        dirty = true;
+    }
+}
+
+void UILayer::Initialize()
+{
+    initialized = true;
+
+    glGenFramebuffers(1, &framebuffer);
+    glGenTextures(1, &colorTexture);
+    glGenVertexArrays(1, &emptyVAO);
+    mesh = new RetainedMesh();
+
+    compositeShader = new Shader("assets/shaders/composite.vert", "assets/shaders/composite.frag");
+    textureLocation = compositeShader->Uniform("uiTexture");
+}
+
+void UILayer::Resize(int newPixelWidth, int newPixelHeight)
+{
+    pixelWidth = newPixelWidth;
+    pixelHeight = newPixelHeight;
+
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, pixelWidth, pixelHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cout << "ERROR::UI_LAYER::FRAMEBUFFER_INCOMPLETE\n";
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glCheckError();
+}
+
+void UILayer::Redraw()
+{
+    dirty = false;
+    redraws++;
+
+    const float halfWidth = width * zoom * 0.5f;
+    const float halfHeight = height * zoom * 0.5f;
+
+    // Same order as everything else: lowest z first. Images without a sprite (yet) have nothing to draw.
+    // (find() rather than [], which would put a null in the entity's map that RegisterComponent() couldn't replace.)
+    std::vector<std::pair<ImageComponent*, StaticSpriteComponent*>> sorted;
+
+    for (ImageComponent* img : images)
+    {
+        if (img->active && (img->entity->Get_Scene() == scene || img->entity->Get_Scene() == 0))
+        {
+            auto found = img->entity->componentIDMap.find(spriteComponentID);
+
+            if (found != img->entity->componentIDMap.end() && ((StaticSpriteComponent*)found->second)->active)
+            {
+                sorted.push_back({ img, (StaticSpriteComponent*)found->second });
+            }
+        }
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<ImageComponent*, StaticSpriteComponent*>& a, const std::pair<ImageComponent*, StaticSpriteComponent*>& b)
+        {
+            return a.second->pos->z < b.second->pos->z;
+        });
+
+    buildQuads.clear();
+
+    for (const auto& entry : sorted)
+    {
+        ImageComponent* img = entry.first;
+        StaticSpriteComponent* sprite = entry.second;
+
+        glm::vec2 anchorPos;
+
+        if (img->anchor == Anchor::topLeft)
+        {
+            anchorPos = glm::vec2(-halfWidth, halfHeight) - glm::vec2(-sprite->sprite->width, sprite->sprite->height);
+        }
+        else if (img->anchor == Anchor::topRight)
+        {
+            anchorPos = glm::vec2(halfWidth, halfHeight) - glm::vec2(sprite->sprite->width, sprite->sprite->height);
+        }
+        else if (img->anchor == Anchor::bottomLeft)
+        {
+            anchorPos = glm::vec2(-halfWidth, -halfHeight) + glm::vec2(sprite->sprite->width, sprite->sprite->height);
+        }
+        else // if (img->anchor == Anchor::bottomRight)
+        {
+            anchorPos = glm::vec2(halfWidth, -halfHeight) + glm::vec2(-sprite->sprite->width, sprite->sprite->height);
+        }
+
+        RetainedQuad q;
+        q.texture = sprite->sprite->ID;
+        q.map = sprite->mapTex->ID;
+        Renderer::buildSpriteQuad(q.quad, anchorPos + glm::vec2(img->x, img->y), 0.0f, sprite->pos->rotation, sprite->width, sprite->height, sprite->scaleX, sprite->scaleY, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f), 0.0f, 0.0f, sprite->tiled, sprite->flippedX, sprite->flippedY);
+        buildQuads.push_back(q);
+    }
+
+    mesh->Build(buildQuads);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, pixelWidth, pixelHeight);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Blending like this leaves the texture premultiplied (and its alpha right), which is what Composite() expects.
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    FrameData frame;
+    frame.MVP = glm::ortho(-halfWidth, halfWidth, -halfHeight, halfHeight, -1.0f, 1.0f);
+    Game::main.renderer->frameData.Update(&frame);
+
+    Game::main.renderer->shader.use();
+    mesh->Draw();
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    glCheckError();
+}
+
+void UILayer::Composite()
+{
+    if (!initialized)
+    {
+        Initialize();
+    }
+
+    int newPixelWidth, newPixelHeight;
+    glfwGetFramebufferSize(Game::main.window, &newPixelWidth, &newPixelHeight);
+
+    if (newPixelWidth <= 0 || newPixelHeight <= 0)
+    {
+        // Minimized.
+        return;
+    }
+
+    if (newPixelWidth != pixelWidth || newPixelHeight != pixelHeight)
+    {
+        Resize(newPixelWidth, newPixelHeight);
+        dirty = true;
+    }
+
+    if (Game::main.windowWidth != width || Game::main.windowHeight != height || Game::main.uiZoom != zoom)
+    {
+        width = Game::main.windowWidth;
+        height = Game::main.windowHeight;
+        zoom = Game::main.uiZoom;
+        dirty = true;
+    }
+
+    if (dirty)
+    {
+        Redraw();
+    }
+
+    if (mesh->quadCount == 0)
+    {
+        return;
+    }
+
+    // One big triangle that covers the screen (the vertex shader makes it up from gl_VertexID).
+    compositeShader->use();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    compositeShader->setInt(textureLocation, 0);
+
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glBindVertexArray(emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
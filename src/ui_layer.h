@@ -0,0 +1,65 @@
+#ifndef UI_LAYER_H
+#define UI_LAYER_H
+
+// The UI doesn't change very often, so rather than sending every UI sprite through the render queue
+// each frame (and re-anchoring them all to the camera while we're at it), the UI layer draws them all
+// into a texture of their own, in screen space, and then just pastes that texture over the world.
+// It only redraws when something about the UI has changed: an image added or removed, the window
+// resized, Game::main.uiZoom changed or the scene switched.
+//
+// Like the static layer, it can't tell when an image or its sprite has been changed in place,
+// so anything that does that needs to call UILayer::main.Invalidate().
+
+#include <vector>
+#include <glad/glad.h>
+#include "static_layer.h"
+
+class ImageComponent;
+class Shader;
+
+class UILayer
+{
+public:
+    static UILayer main;
+
+    // Just so we can see what it's doing.
+    int redraws = 0;
+
+    void Add(ImageComponent* image);
+    void Remove(ImageComponent* image);
+    void Invalidate();
+    void SetScene(int activeScene);
+
+    // Redraws the UI if it needs to and then draws it over whatever's already on screen.
+    // Call this after the world's been drawn.
+    void Composite();
+
+private:
+    std::vector<ImageComponent*> images;
+    bool dirty = true;
+    int scene = 0;
+
+    // These can't be made until there's a GL context, so Composite() does it the first time around.
+    bool initialized = false;
+    GLuint framebuffer = 0;
+    GLuint colorTexture = 0;
+    GLuint emptyVAO = 0;
+    Shader* compositeShader = nullptr;
+    GLint textureLocation = -1;
+
+    // What the texture was last drawn at, to tell when we have to redraw.
+    int width = 0;
+    int height = 0;
+    int pixelWidth = 0;
+    int pixelHeight = 0;
+    float zoom = 0.0f;
+
+    RetainedMesh* mesh = nullptr;
+    std::vector<RetainedQuad> buildQuads;
+
+    void Initialize();
+    void Resize(int newPixelWidth, int newPixelHeight);
+    void Redraw();
+};
+
+#endif
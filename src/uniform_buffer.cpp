@@ -0,0 +1,28 @@
+#include "uniform_buffer.h"
+
+#include "check_error.h"
+
+UniformBuffer::UniformBuffer(GLsizeiptr size, GLuint binding) : binding(binding), size(size)
+{
+    glGenBuffers(1, &ID);
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glCheckError();
+}
+
+UniformBuffer::~UniformBuffer()
+{
+    glDeleteBuffers(1, &ID);
+}
+
+void UniformBuffer::Update(const void* data)
+{
+    // Orphaning the old storage first means we don't have to wait for last frame's draws to finish with it.
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
@@ -0,0 +1,38 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+// A uniform buffer holds uniforms that more than one shader wants, so they only have to be set once
+// (per frame, say) rather than once per program. Each one sits on a binding point, and any shader
+// with a matching block just needs Shader::BindBlock() calling once to start reading from it.
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Everything that changes once a frame and that (nearly) every shader needs.
+// This has to match the FrameData block in the shaders, which uses the std140 layout;
+// stick to mat4s and vec4s (or pad things out to 16 bytes) and the two will line up.
+struct FrameData
+{
+    static constexpr GLuint BINDING = 0;
+
+    glm::mat4 MVP;
+};
+
+class UniformBuffer
+{
+public:
+    GLuint ID;
+    GLuint binding;
+    GLsizeiptr size;
+
+    UniformBuffer(GLsizeiptr size, GLuint binding);
+    ~UniformBuffer();
+
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    // Replaces the whole buffer's contents.
+    void Update(const void* data);
+};
+
+#endif
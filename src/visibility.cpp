@@ -0,0 +1,308 @@
+#include "visibility.h"
+
+#include <algorithm>
+#include <cmath>
+#include "component.h"
+#include "entity.h"
+#include "game.h"
+
+// See visibility.h.
+
+#pragma region Entries
+
+uint64_t Visibility::CellKey(int cx, int cy)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+}
+
+void Visibility::Add(StaticSpriteComponent* sprite)
+{
+    Add(Kind::sprite, sprite, sprite->pos);
+}
+
+void Visibility::Add(AnimationComponent* animation)
+{
+    Add(Kind::animation, animation, animation->pos);
+}
+
+void Visibility::Add(ParticleComponent* emitter)
+{
+    // The particle system only hands it over once it's looked its position up (see ParticleSystem::AddComponent()).
+    Add(Kind::emitter, emitter, emitter->pos);
+}
+
+void Visibility::Add(Kind kind, Component* component, GlobalPositionComponent* pos)
+{
+    if (pos == nullptr || lookup.count(component) != 0)
+    {
+        return;
+    }
+
+    int id;
+
+    if (!freeEntries.empty())
+    {
+        id = freeEntries.back();
+        freeEntries.pop_back();
+    }
+    else
+    {
+        id = static_cast<int>(entries.size());
+        entries.emplace_back();
+    }
+
+    Entry& e = entries[id];
+    e.kind = kind;
+    e.component = component;
+    e.pos = pos;
+    e.sequence = nextSequence++;
+
+    lookup[component] = id;
+    entryCount++;
+
+    if (!pos->stat || kind != Kind::emitter)
+    {
+        watched.push_back(id);
+    }
+
+    Place(id);
+}
+
+void Visibility::Remove(Component* component)
+{
+    auto it = lookup.find(component);
+
+    if (it == lookup.end())
+    {
+        return;
+    }
+
+    const int id = it->second;
+    lookup.erase(it);
+
+    Unplace(id);
+    watched.erase(std::remove(watched.begin(), watched.end(), id), watched.end());
+
+    entries[id].component = nullptr;
+    entries[id].pos = nullptr;
+    freeEntries.push_back(id);
+    entryCount--;
+}
+
+void Visibility::Bounds(const Entry& e, float& x, float& y, float& halfWidth, float& halfHeight) const
+{
+    x = e.pos->x;
+    y = e.pos->y;
+    halfWidth = 0.0f;
+    halfHeight = 0.0f;
+
+    if (e.kind == Kind::sprite)
+    {
+        const StaticSpriteComponent* s = (const StaticSpriteComponent*)e.component;
+        halfWidth = std::abs(s->width * s->scaleX) / 2.0f;
+        halfHeight = std::abs(s->height * s->scaleY) / 2.0f;
+    }
+    else if (e.kind == Kind::animation)
+    {
+        const AnimationComponent* a = (const AnimationComponent*)e.component;
+        auto it = a->animations.find(a->activeAnimation);
+
+        if (it != a->animations.end())
+        {
+            // Same sizes buildCellQuad() uses.
+            const Animation2D* animation = it->second;
+            halfWidth = std::abs(animation->width * a->scaleX) / animation->columns;
+            halfHeight = std::abs(animation->height * a->scaleY) / animation->rows;
+        }
+    }
+    else // if (e.kind == Kind::emitter)
+    {
+        const ParticleComponent* p = (const ParticleComponent*)e.component;
+        x += p->xOffset;
+        y += p->yOffset;
+    }
+
+    if (e.pos->rotation != 0.0f)
+    {
+        // Whichever way it's turned, it stays inside this.
+        halfWidth = halfHeight = std::sqrt(halfWidth * halfWidth + halfHeight * halfHeight);
+    }
+}
+
+void Visibility::Place(int id)
+{
+    Entry& e = entries[id];
+    e.x = e.pos->x;
+    e.y = e.pos->y;
+
+    float x, y, halfWidth, halfHeight;
+    Bounds(e, x, y, halfWidth, halfHeight);
+
+    e.oversized = halfWidth > CELL_SIZE || halfHeight > CELL_SIZE;
+
+    if (e.oversized)
+    {
+        oversized.push_back(id);
+    }
+    else
+    {
+        e.cell = CellKey(static_cast<int>(std::floor(x / CELL_SIZE)), static_cast<int>(std::floor(y / CELL_SIZE)));
+        cells[e.cell].push_back(id);
+    }
+}
+
+void Visibility::Unplace(int id)
+{
+    Entry& e = entries[id];
+    std::vector<int>& list = e.oversized ? oversized : cells[e.cell];
+
+    auto it = std::find(list.begin(), list.end(), id);
+
+    if (it != list.end())
+    {
+        // Order within a cell doesn't matter; the visible lists get sorted anyway.
+        *it = list.back();
+        list.pop_back();
+    }
+
+    if (!e.oversized && list.empty())
+    {
+        cells.erase(e.cell);
+    }
+}
+
+#pragma endregion
+
+#pragma region Queries
+
+void Visibility::Update()
+{
+    // Move whatever's moved, and whatever's changed size enough to go on (or come off) the oversized list.
+    for (int id : watched)
+    {
+        const Entry& e = entries[id];
+
+        float x, y, halfWidth, halfHeight;
+        Bounds(e, x, y, halfWidth, halfHeight);
+        const bool oversizedNow = halfWidth > CELL_SIZE || halfHeight > CELL_SIZE;
+
+        if (e.pos->x != e.x || e.pos->y != e.y || oversizedNow != e.oversized)
+        {
+            Unplace(id);
+            Place(id);
+        }
+    }
+
+    const float left = Game::main.leftX;
+    const float right = Game::main.rightX;
+    const float bottom = Game::main.bottomY;
+    const float top = Game::main.topY;
+
+    const float marginX = (right - left) / 2.0f;
+    const float marginY = (top - bottom) / 2.0f;
+
+    for (std::vector<int>& list : found)
+    {
+        list.clear();
+    }
+
+    cellsVisited = 0;
+    candidatesTested = 0;
+
+    auto test = [&](int id)
+    {
+        const Entry& e = entries[id];
+
+        float x, y, halfWidth, halfHeight;
+        Bounds(e, x, y, halfWidth, halfHeight);
+        candidatesTested++;
+
+        const float mx = e.kind == Kind::emitter ? marginX : 0.0f;
+        const float my = e.kind == Kind::emitter ? marginY : 0.0f;
+
+        if (x + halfWidth > left - mx && x - halfWidth < right + mx &&
+            y + halfHeight > bottom - my && y - halfHeight < top + my)
+        {
+            found[static_cast<int>(e.kind)].push_back(id);
+        }
+    };
+
+    // The widest anything can reach is the emitters' margin, plus a cell for the looseness.
+    const int cx0 = static_cast<int>(std::floor((left - marginX) / CELL_SIZE)) - 1;
+    const int cx1 = static_cast<int>(std::floor((right + marginX) / CELL_SIZE)) + 1;
+    const int cy0 = static_cast<int>(std::floor((bottom - marginY) / CELL_SIZE)) - 1;
+    const int cy1 = static_cast<int>(std::floor((top + marginY) / CELL_SIZE)) + 1;
+
+    if (static_cast<size_t>(cx1 - cx0 + 1) * static_cast<size_t>(cy1 - cy0 + 1) <= cells.size())
+    {
+        for (int cy = cy0; cy <= cy1; cy++)
+        {
+            for (int cx = cx0; cx <= cx1; cx++)
+            {
+                auto it = cells.find(CellKey(cx, cy));
+
+                if (it != cells.end())
+                {
+                    cellsVisited++;
+
+                    for (int id : it->second)
+                    {
+                        test(id);
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        // Zoomed so far out that there are fewer cells in use than there are in view, so just go through those.
+        for (auto& cell : cells)
+        {
+            const int cx = static_cast<int32_t>(cell.first >> 32);
+            const int cy = static_cast<int32_t>(cell.first & 0xFFFFFFFFu);
+
+            if (cx < cx0 || cx > cx1 || cy < cy0 || cy > cy1)
+            {
+                continue;
+            }
+
+            cellsVisited++;
+
+            for (int id : cell.second)
+            {
+                test(id);
+            }
+        }
+    }
+
+    for (int id : oversized)
+    {
+        test(id);
+    }
+
+    for (std::vector<int>& list : found)
+    {
+        std::sort(list.begin(), list.end(), [this](int a, int b) { return entries[a].sequence < entries[b].sequence; });
+    }
+
+    sprites.clear();
+    animations.clear();
+    emitters.clear();
+
+    for (int id : found[static_cast<int>(Kind::sprite)])
+    {
+        sprites.push_back((StaticSpriteComponent*)entries[id].component);
+    }
+
+    for (int id : found[static_cast<int>(Kind::animation)])
+    {
+        animations.push_back((AnimationComponent*)entries[id].component);
+    }
+
+    for (int id : found[static_cast<int>(Kind::emitter)])
+    {
+        emitters.push_back((ParticleComponent*)entries[id].component);
+    }
+}
+
+#pragma endregion
@@ -0,0 +1,95 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+// Visibility is the one place that works out what the camera can see. Everything that draws (or spawns
+// particles) registers with it, and once a frame Update() looks at the camera rectangle and fills in the
+// visible lists below, which the systems then go through instead of testing every component they've got.
+//
+// Under the hood it's a loose grid: each entry lives in the CELL_SIZE square its position falls in,
+// and since a thing can poke out of its cell by up to CELL_SIZE, we look one cell further out than the
+// camera reaches. Anything bigger than that goes on a short list that's always tested. Once a frame, every
+// entry that could have changed gets checked and moved if its position has changed or it's grown past (or
+// shrunk back under) CELL_SIZE. That's everything but emitters on static positions, which never move and
+// have no size to speak of; a sprite or animation can be resized wherever it is.
+//
+// The visible lists come out in the order things were registered, same as the systems' own lists,
+// so ties in the render queue still come out the same way they always have.
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class Component;
+class GlobalPositionComponent;
+class StaticSpriteComponent;
+class AnimationComponent;
+class ParticleComponent;
+
+class Visibility
+{
+public:
+    static Visibility main;
+
+    static constexpr float CELL_SIZE = 256.0f;
+
+    // What the camera can see this frame, as of the last Update().
+    std::vector<StaticSpriteComponent*> sprites;
+    std::vector<AnimationComponent*> animations;
+
+    // Emitters get a screen's worth of margin (half on each side), so particles are already
+    // flying by the time whatever's making them comes into view.
+    std::vector<ParticleComponent*> emitters;
+
+    // Just so we can see what it's doing.
+    int entryCount = 0;
+    int cellsVisited = 0;
+    int candidatesTested = 0;
+
+    void Add(StaticSpriteComponent* sprite);
+    void Add(AnimationComponent* animation);
+    void Add(ParticleComponent* emitter);
+    void Remove(Component* component);
+
+    // Call once a frame, after the camera's moved and before anything asks what's visible.
+    void Update();
+
+private:
+    enum class Kind : uint8_t { sprite, animation, emitter };
+
+    struct Entry
+    {
+        Kind kind;
+        Component* component = nullptr;
+        GlobalPositionComponent* pos = nullptr;
+
+        // When it was registered, for putting the visible lists back in order.
+        uint64_t sequence = 0;
+
+        // The cell it's in, and the position that put it there.
+        uint64_t cell = 0;
+        bool oversized = false;
+        float x = 0.0f;
+        float y = 0.0f;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<int> freeEntries;
+    std::unordered_map<Component*, int> lookup;
+    std::unordered_map<uint64_t, std::vector<int>> cells;
+    std::vector<int> oversized;
+    std::vector<int> watched;
+    uint64_t nextSequence = 0;
+
+    // Scratch for sorting the visible lists.
+    std::vector<int> found[3];
+
+    void Add(Kind kind, Component* component, GlobalPositionComponent* pos);
+    void Place(int id);
+    void Unplace(int id);
+
+    // The half-width and half-height it'll be drawn at, and where its middle is.
+    void Bounds(const Entry& e, float& x, float& y, float& halfWidth, float& halfHeight) const;
+    static uint64_t CellKey(int cx, int cy);
+};
+
+#endif